@@ -0,0 +1,410 @@
+/* SPDX-License-Identifier: MIT */
+#include "cmaze.h"
+
+/*
+ * Batch runner
+ *
+ * Mazes flow through 4 stages, each run by its own pool of threads:
+ *
+ *   pool -> generate -> analyze -> solve -> export -> pool
+ *
+ * Stages are linked by bounded lock-free queues. A full queue stalls the
+ * stage feeding it, and since only pool_size jobs exist the generators
+ * also stall once every maze is in flight. Jobs carry their maze back to
+ * the pool after export, and maze_create() reuses the board of a recycled
+ * maze, so after the first round the pipeline does not allocate.
+ */
+
+struct BatchJob {
+	struct Maze *maze;
+	int index;
+	guint32 seed;
+	int err;
+
+	int num_open;
+	int num_dead_ends;
+	int num_junctions;
+	gint64 gen_time;
+};
+
+/*
+ * Bounded multi-producer multi-consumer queue (Vyukov). Each slot carries
+ * a sequence number telling whether it is ready to be written or read for
+ * a given lap, so producers and consumers only contend on their own index.
+ */
+struct BatchSlot {
+	gint seq;
+	struct BatchJob *job;
+};
+
+struct BatchQueue {
+	struct BatchSlot *slots;
+	guint mask;
+
+	/* Keep both indexes on separate cache lines */
+	char pad0[64];
+	gint enqueue_pos;
+	char pad1[64];
+	gint dequeue_pos;
+	char pad2[64];
+};
+
+static void batch_queue_init(struct BatchQueue *q, guint size)
+{
+	guint i;
+
+	q->slots = g_new(struct BatchSlot, size);
+	q->mask = size - 1;
+	q->enqueue_pos = 0;
+	q->dequeue_pos = 0;
+
+	for (i = 0; i < size; i++) {
+		q->slots[i].seq = i;
+		q->slots[i].job = NULL;
+	}
+}
+
+static void batch_queue_clear(struct BatchQueue *q)
+{
+	g_free(q->slots);
+	q->slots = NULL;
+}
+
+static gboolean batch_queue_push(struct BatchQueue *q, struct BatchJob *job)
+{
+	struct BatchSlot *slot;
+	gint pos;
+	gint diff;
+
+	pos = g_atomic_int_get(&q->enqueue_pos);
+	while (1) {
+		slot = &q->slots[pos & q->mask];
+		diff = g_atomic_int_get(&slot->seq) - pos;
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&q->enqueue_pos,
+							      pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			/* Full */
+			return FALSE;
+		}
+
+		pos = g_atomic_int_get(&q->enqueue_pos);
+	}
+
+	slot->job = job;
+	g_atomic_int_set(&slot->seq, pos + 1);
+
+	return TRUE;
+}
+
+static struct BatchJob *batch_queue_pop(struct BatchQueue *q)
+{
+	struct BatchSlot *slot;
+	struct BatchJob *job;
+	gint pos;
+	gint diff;
+
+	pos = g_atomic_int_get(&q->dequeue_pos);
+	while (1) {
+		slot = &q->slots[pos & q->mask];
+		diff = g_atomic_int_get(&slot->seq) - (pos + 1);
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&q->dequeue_pos,
+							      pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			/* Empty */
+			return NULL;
+		}
+
+		pos = g_atomic_int_get(&q->dequeue_pos);
+	}
+
+	job = slot->job;
+	g_atomic_int_set(&slot->seq, pos + q->mask + 1);
+
+	return job;
+}
+
+/* Backpressure: wait for room downstream, or for work upstream */
+static void batch_queue_push_wait(struct BatchQueue *q, struct BatchJob *job)
+{
+	while (!batch_queue_push(q, job))
+		g_thread_yield();
+}
+
+static struct BatchJob *batch_queue_pop_wait(struct BatchQueue *q)
+{
+	struct BatchJob *job;
+
+	while (!(job = batch_queue_pop(q)))
+		g_thread_yield();
+
+	return job;
+}
+
+typedef enum {
+	BATCH_STAGE_GENERATE = 0,
+	BATCH_STAGE_ANALYZE,
+	BATCH_STAGE_SOLVE,
+	BATCH_STAGE_EXPORT,
+	BATCH_STAGE_NUM,
+} BatchStage;
+
+struct Batch;
+
+struct BatchWorker {
+	struct Batch *batch;
+	BatchStage stage;
+	GThread *thread;
+};
+
+struct Batch {
+	const struct MazeBatchConfig *cfg;
+
+	struct BatchJob *jobs;
+	struct BatchQueue pool;
+
+	/* Input queue of each stage, the generators read from the pool */
+	struct BatchQueue queues[BATCH_STAGE_NUM];
+
+	/* Jobs claimed so far by each stage */
+	gint claimed[BATCH_STAGE_NUM];
+
+	gint num_errors;
+};
+
+static void batch_generate(struct Batch *batch, struct BatchJob *job)
+{
+	const struct MazeBatchConfig *cfg = batch->cfg;
+	struct Maze *maze = job->maze;
+	gint64 start;
+
+	job->seed = cfg->seed + job->index;
+	maze_set_seed(maze, job->seed);
+	/* The stages already run in parallel, keep each maze on one thread */
+	maze_set_num_threads(maze, 1);
+	maze_set_max_cost(maze, cfg->max_cost);
+	maze_set_topology(maze, cfg->topology);
+	maze_set_generator(maze, cfg->generator);
+	maze_set_solver_algorithm(maze, cfg->algorithm);
+
+	start = g_get_monotonic_time();
+	job->err = maze_create(maze, cfg->num_levels, cfg->num_rows,
+			       cfg->num_cols, cfg->complex);
+	job->gen_time = g_get_monotonic_time() - start;
+}
+
+static gboolean batch_cell_is_open(struct Maze *maze, int level, int row,
+				   int col)
+{
+	if (row < 0 || row >= maze_get_num_rows(maze) ||
+	    col < 0 || col >= maze_get_num_cols(maze))
+		return FALSE;
+
+	return maze_get_cell_type(maze, level, row, col) != CELL_TYPE_WALL;
+}
+
+/* Count dead ends and junctions of the square grid layout */
+static void batch_analyze(struct Batch *batch, struct BatchJob *job)
+{
+	struct Maze *maze = job->maze;
+	int level;
+	int row;
+	int col;
+	int exits;
+
+	job->num_open = 0;
+	job->num_dead_ends = 0;
+	job->num_junctions = 0;
+
+	if (job->err)
+		return;
+
+	for (level = 0; level < maze_get_num_levels(maze); level++) {
+		for (row = 0; row < maze_get_num_rows(maze); row++) {
+			for (col = 0; col < maze_get_num_cols(maze); col++) {
+				if (!batch_cell_is_open(maze, level, row, col))
+					continue;
+
+				exits = batch_cell_is_open(maze, level, row - 1, col) +
+					batch_cell_is_open(maze, level, row + 1, col) +
+					batch_cell_is_open(maze, level, row, col - 1) +
+					batch_cell_is_open(maze, level, row, col + 1);
+				if (maze_get_cell_stairs(maze, level, row, col) & MAZE_STAIRS_UP)
+					exits++;
+				if (maze_get_cell_stairs(maze, level, row, col) & MAZE_STAIRS_DOWN)
+					exits++;
+
+				job->num_open++;
+				if (exits == 1)
+					job->num_dead_ends++;
+				else if (exits > 2)
+					job->num_junctions++;
+			}
+		}
+	}
+}
+
+static void batch_solve(struct Batch *batch, struct BatchJob *job)
+{
+	if (!job->err)
+		job->err = maze_solve_headless(job->maze);
+}
+
+static void batch_export(struct Batch *batch, struct BatchJob *job)
+{
+	struct Maze *maze = job->maze;
+
+	if (job->err) {
+		g_atomic_int_inc(&batch->num_errors);
+		return;
+	}
+
+	/* One call per line, stdio keeps lines from several writers whole */
+	g_fprintf(batch->cfg->output, "%d,%u,%d,%d,%d,%d,%d,%d,%d,%d,%" G_GINT64_FORMAT ",%.0f\n",
+		  job->index, job->seed,
+		  maze_get_num_levels(maze), maze_get_num_rows(maze),
+		  maze_get_num_cols(maze),
+		  job->num_open, job->num_dead_ends, job->num_junctions,
+		  maze_get_path_length(maze), maze_get_path_cost(maze),
+		  job->gen_time,
+		  maze_get_solve_time(maze) * G_USEC_PER_SEC);
+}
+
+static gpointer batch_worker(struct BatchWorker *worker)
+{
+	struct Batch *batch = worker->batch;
+	struct BatchQueue *in;
+	struct BatchQueue *out;
+	struct BatchJob *job;
+	BatchStage stage = worker->stage;
+
+	in = stage == BATCH_STAGE_GENERATE ? &batch->pool :
+					     &batch->queues[stage];
+	out = stage == BATCH_STAGE_EXPORT ? &batch->pool :
+					    &batch->queues[stage + 1];
+
+	/*
+	 * Claim a job before waiting for one: a stage never pops more than
+	 * num_mazes jobs, so no worker is left waiting when the batch ends.
+	 */
+	while (1) {
+		int index;
+
+		index = g_atomic_int_add(&batch->claimed[stage], 1);
+		if (index >= batch->cfg->num_mazes)
+			break;
+
+		job = batch_queue_pop_wait(in);
+
+		switch (stage) {
+		case BATCH_STAGE_GENERATE:
+			job->index = index;
+			batch_generate(batch, job);
+			break;
+		case BATCH_STAGE_ANALYZE:
+			batch_analyze(batch, job);
+			break;
+		case BATCH_STAGE_SOLVE:
+			batch_solve(batch, job);
+			break;
+		case BATCH_STAGE_EXPORT:
+			batch_export(batch, job);
+			break;
+		case BATCH_STAGE_NUM:
+			break;
+		}
+
+		batch_queue_push_wait(out, job);
+	}
+
+	return NULL;
+}
+
+int maze_batch_run(const struct MazeBatchConfig *cfg)
+{
+	static const char *thread_names[BATCH_STAGE_NUM] = {
+		"batch-gen", "batch-analyze", "batch-solve", "batch-export",
+	};
+	struct Batch batch = { 0 };
+	struct BatchWorker *workers;
+	int num_workers[BATCH_STAGE_NUM];
+	int total_workers = 0;
+	guint queue_size;
+	gint64 start;
+	float elapsed;
+	BatchStage stage;
+	int i;
+	int n;
+
+	if (cfg->num_mazes <= 0 || cfg->pool_size <= 0 || !cfg->output)
+		return -1;
+
+	num_workers[BATCH_STAGE_GENERATE] = MAX(cfg->num_gen_workers, 1);
+	num_workers[BATCH_STAGE_ANALYZE] = MAX(cfg->num_analyze_workers, 1);
+	num_workers[BATCH_STAGE_SOLVE] = MAX(cfg->num_solve_workers, 1);
+	num_workers[BATCH_STAGE_EXPORT] = MAX(cfg->num_export_workers, 1);
+
+	batch.cfg = cfg;
+
+	/* Every queue can hold the whole pool, a push only waits on a slot */
+	queue_size = 1;
+	while (queue_size < (guint)cfg->pool_size)
+		queue_size <<= 1;
+
+	batch_queue_init(&batch.pool, queue_size);
+	for (stage = BATCH_STAGE_ANALYZE; stage < BATCH_STAGE_NUM; stage++)
+		batch_queue_init(&batch.queues[stage], queue_size);
+
+	batch.jobs = g_new0(struct BatchJob, cfg->pool_size);
+	for (i = 0; i < cfg->pool_size; i++) {
+		batch.jobs[i].maze = maze_alloc();
+		batch_queue_push(&batch.pool, &batch.jobs[i]);
+	}
+
+	for (stage = 0; stage < BATCH_STAGE_NUM; stage++)
+		total_workers += num_workers[stage];
+
+	workers = g_new0(struct BatchWorker, total_workers);
+
+	g_fprintf(cfg->output, "index,seed,levels,rows,cols,open,dead_ends,"
+		  "junctions,length,cost,gen_us,solve_us\n");
+
+	start = g_get_monotonic_time();
+
+	n = 0;
+	for (stage = 0; stage < BATCH_STAGE_NUM; stage++) {
+		for (i = 0; i < num_workers[stage]; i++, n++) {
+			workers[n].batch = &batch;
+			workers[n].stage = stage;
+			workers[n].thread = g_thread_new(thread_names[stage],
+						(GThreadFunc)batch_worker,
+						&workers[n]);
+		}
+	}
+
+	for (n = 0; n < total_workers; n++)
+		g_thread_join(workers[n].thread);
+
+	elapsed = (float)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+	g_fprintf(stderr, "%d mazes in %.03fs (%.0f mazes/s), %d failed\n",
+		  cfg->num_mazes, elapsed, cfg->num_mazes / elapsed,
+		  batch.num_errors);
+
+	for (i = 0; i < cfg->pool_size; i++)
+		maze_free(batch.jobs[i].maze);
+
+	g_free(batch.jobs);
+	g_free(workers);
+
+	batch_queue_clear(&batch.pool);
+	for (stage = BATCH_STAGE_ANALYZE; stage < BATCH_STAGE_NUM; stage++)
+		batch_queue_clear(&batch.queues[stage]);
+
+	return batch.num_errors ? -1 : 0;
+}
@@ -1,4 +1,19 @@
 /* SPDX-License-Identifier: MIT */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+
 #include "cmaze.h"
 
 typedef enum {
@@ -7,11 +22,18 @@ typedef enum {
 	CANCELED,
 	SOLVED,
 	UNSOLVABLE,
+	LIMITED,
 } SolverStatus;
 
+/* Stair flags of a cell, a room can link to the same room one level up/down */
+#define CELL_STAIRS_UP   MAZE_STAIRS_UP
+#define CELL_STAIRS_DOWN MAZE_STAIRS_DOWN
+
 struct Cell {
+	int level;
 	int row;
 	int col;
+	int stairs;
 	int value;
 	int heuristic;
 	CellType type;
@@ -20,24 +42,144 @@ struct Cell {
 };
 
 struct Maze {
+	int num_levels;
 	int num_rows;
 	int num_cols;
+
+	/*
+	 * Cells are stored level by level, each level row by row, so a level
+	 * is one contiguous slice of the board. strides[dir] is the index
+	 * offset to the neighbour cell in direction dir.
+	 */
 	struct Cell *board;
+	int board_size;
+	int strides[6];
+	int num_dirs;
+	MazeTopology topology;
 
 	gboolean complex;
 	uint anim_speed;
 
+	/*
+	 * Optional cost of entering each cell, indexed like the board.
+	 * NULL when every move costs 1.
+	 */
+	guint8 *costs;
+	guint8 *cost_plane;
+	uint max_cost;
+
+	/* Private generator, random() is used until maze_set_seed() */
+	GRand *rand;
+
+	/*
+	 * Generation in progress, see maze_generate_step(). The backtracker
+	 * stack lives in the work list.
+	 */
+	MazeGenerator generator;
+	gboolean generating;
+	int gen_stack_len;
+	struct Cell *gen_cell;
+	guint64 *gen_unvisited;
+	int gen_num_words;
+	int gen_cursor;
+
+	/* Threads of the parallel solvers, 0 for one per CPU */
+	int num_threads;
+	gboolean pin_threads;
+
+	/*
+	 * Scratch list of board cells, sized for the whole board and kept
+	 * between runs. Used as the generator stack and the BFS queue since
+	 * both hold every cell at most once.
+	 */
+	struct Cell **work;
+	int work_size;
+
 	SolverStatus solver_status;
 	GThread *solver_thread;
+
+	/*
+	 * Bumped on every solver step, see maze_get_changes(). With the
+	 * frontier size and the start time they feed maze_get_solver_stats()
+	 * while the solver runs.
+	 */
+	gint changes;
+	gint changes_start;
+	gint frontier;
+	gint64 solve_start;
+
+	/*
+	 * Budget of the solver, see maze_set_solve_limits(). Expansions are
+	 * counted in num_expanded, and the limits only looked at once it
+	 * reaches limit_check. frontier_entry is the size of a frontier entry
+	 * of the current solver.
+	 */
+	struct MazeSolveLimits limits;
+	int num_expanded;
+	int limit_check;
+	gsize frontier_entry;
+
+	/*
+	 * Asynchronous solve, see maze_solve_async(). async_fd holds the read
+	 * and write ends of the notification pipe, both the same eventfd on
+	 * Linux. async_reason is the result slot, published last by the
+	 * solver thread. An async solve can be canceled but isn't animated,
+	 * async is set while it runs.
+	 */
+	int async_fd[2];
+	gboolean async;
+	gint async_reason;
+	gint64 async_interval;
+	gint64 async_progress;
+
 	SolverAlgorithm solver_algorithm;
 	MazeSolverFunc solver_cb;
 	void *solver_cb_userdata;
 
 	int path_len;
+	int path_cost;
 	gint64 solve_time;
 
 	struct Cell *start_cell;
 	struct Cell *end_cell;
+
+	/* Additional exits. end_cell is always the first exit */
+	GList *exits;
+
+	/*
+	 * Edits made through the public API, see maze_undo(). The entries
+	 * before journal_pos are applied, the ones after it can be redone.
+	 */
+	GArray *journal;
+	guint journal_pos;
+
+	/* Compressed layout replacing board, see maze_compact() */
+	struct CompactBoard *compact;
+
+	/*
+	 * Layout pages shared with the snapshots, see maze_snapshot(). A page
+	 * matches the board until one of its cells is edited and its
+	 * page_dirty flag is set. NULL until the first snapshot.
+	 */
+	struct MazePage **pages;
+	guint8 *page_dirty;
+	int num_pages;
+
+	/*
+	 * Bumped whenever a cell turns into or out of a wall, an endpoint or
+	 * an exit. The distance field to goal_cell is valid while
+	 * goal_version matches it.
+	 */
+	guint layout_version;
+	guint goal_version;
+	struct Cell *goal_cell;
+	guint32 *goal_dist;
+	int goal_dist_size;
+
+	/* Walls bit plane at wall_version, see maze_diff() */
+	guint64 *wall_plane;
+	int wall_plane_size;
+	guint wall_version;
 };
 
 typedef enum {
@@ -45,13 +187,21 @@ typedef enum {
 	DIR_RIGHT,
 	DIR_DOWN,
 	DIR_LEFT,
-	DIR_LAST = DIR_LEFT,
-	DIR_NUM_DIRS = 4,
+	DIR_ABOVE,
+	DIR_BELOW,
+	DIR_LAST = DIR_BELOW,
+	DIR_NUM_PLANAR_DIRS = 4,
+	DIR_NUM_DIRS = 6,
 	DIR_FIRST = DIR_UP,
 } Direction;
 
 static int cell_cmp(struct Cell *c1, struct Cell *c2)
 {
+	if (c1->level < c2->level)
+		return -1;
+	if (c1->level > c2->level)
+		return 1;
+
 	if (c1->row < c2->row)
 		return -1;
 	if (c1->row > c2->row)
@@ -65,23 +215,18 @@ static int cell_cmp(struct Cell *c1, struct Cell *c2)
 	return 0;
 }
 
-static struct Cell *cell_new(int row, int col)
+static struct Cell *cell_new(int level, int row, int col)
 {
 	struct Cell *cell;
 
 	cell = g_malloc0(sizeof(*cell));
+	cell->level = level;
 	cell->row = row;
 	cell->col = col;
 
 	return cell;
 }
 
-static int cell_distance(struct Cell *cell1, struct Cell *cell2)
-{
-	return (abs(cell1->row - cell2->row) +
-		abs(cell1->col - cell2->col));
-}
-
 static int cell_cmp_heuristic(const struct Cell *c1, const struct Cell *c2)
 {
 	if (c1->heuristic <= c2->heuristic)
@@ -98,35 +243,385 @@ static gint cell_cmp_lower_value(struct Cell *c1, struct Cell *c2)
 	return 1;
 }
 
-static struct Cell *maze_get_cell(struct Maze *maze, int row, int col)
+static inline int maze_num_cells(struct Maze *maze)
+{
+	return maze->num_levels * maze->num_rows * maze->num_cols;
+}
+
+static struct Cell **maze_get_work_list(struct Maze *maze)
 {
-	if (row < 0 || row >= maze->num_rows ||
+	if (maze->work_size < maze_num_cells(maze)) {
+		g_free(maze->work);
+		maze->work_size = maze_num_cells(maze);
+		maze->work = g_new(struct Cell *, maze->work_size);
+	}
+
+	return maze->work;
+}
+
+static struct Cell *maze_get_cell(struct Maze *maze, int level, int row, int col)
+{
+	if (level < 0 || level >= maze->num_levels ||
+	    row < 0 || row >= maze->num_rows ||
 	    col < 0 || col >= maze->num_cols)
 		return NULL;
 
-	return &maze->board[row * maze->num_cols + col];
+	return &maze->board[(level * maze->num_rows + row) * maze->num_cols + col];
+}
+
+static int maze_cell_cost(struct Maze *maze, struct Cell *cell)
+{
+	if (!maze->costs)
+		return 1;
+
+	return maze->costs[cell - maze->board];
+}
+
+/*
+ * Layout of a cell in one byte, as stored in snapshots and maze files:
+ * a wall bit and the stairs.
+ */
+#define CELL_LAYOUT_WALL		(1 << 0)
+#define CELL_LAYOUT_STAIRS_SHIFT	1
+
+static guint8 maze_cell_layout(struct Cell *cell)
+{
+	return (cell->type == CELL_TYPE_WALL ? CELL_LAYOUT_WALL : 0) |
+	       cell->stairs << CELL_LAYOUT_STAIRS_SHIFT;
+}
+
+/* Set the layout of a cell and drop its solver state */
+static void maze_cell_set_layout(struct Cell *cell, guint8 layout)
+{
+	cell->type = (layout & CELL_LAYOUT_WALL) ? CELL_TYPE_WALL :
+						   CELL_TYPE_EMPTY;
+	cell->stairs = layout >> CELL_LAYOUT_STAIRS_SHIFT;
+	cell->value = 0;
+	cell->heuristic = 0;
+	cell->parent = NULL;
+}
+
+/*
+ * Snapshot pages hold the layout and cost of MAZE_PAGE_CELLS consecutive
+ * board cells. They are immutable and shared between the maze and its
+ * snapshots.
+ */
+#define MAZE_PAGE_SHIFT 12
+#define MAZE_PAGE_CELLS (1 << MAZE_PAGE_SHIFT)
+
+struct MazePage {
+	gint refcount;
+	guint8 layout[MAZE_PAGE_CELLS];
+	guint8 costs[MAZE_PAGE_CELLS];
+};
+
+static struct MazePage *maze_page_ref(struct MazePage *page)
+{
+	g_atomic_int_inc(&page->refcount);
+
+	return page;
+}
+
+static void maze_page_unref(struct MazePage *page)
+{
+	if (page && g_atomic_int_dec_and_test(&page->refcount))
+		g_free(page);
+}
+
+static void maze_drop_pages(struct Maze *maze)
+{
+	int i;
+
+	for (i = 0; i < maze->num_pages; i++)
+		maze_page_unref(maze->pages[i]);
+
+	g_free(maze->pages);
+	g_free(maze->page_dirty);
+	maze->pages = NULL;
+	maze->page_dirty = NULL;
+	maze->num_pages = 0;
+}
+
+/* The layout of cell changed, its page can't be shared anymore */
+static void maze_touch_cell(struct Maze *maze, struct Cell *cell)
+{
+	if (maze->page_dirty && cell)
+		maze->page_dirty[(cell - maze->board) >> MAZE_PAGE_SHIFT] = 1;
+}
+
+static void maze_init_strides(struct Maze *maze)
+{
+	maze->strides[DIR_UP] = -maze->num_cols;
+	maze->strides[DIR_RIGHT] = 1;
+	maze->strides[DIR_DOWN] = maze->num_cols;
+	maze->strides[DIR_LEFT] = -1;
+	maze->strides[DIR_ABOVE] = maze->num_rows * maze->num_cols;
+	maze->strides[DIR_BELOW] = -maze->num_rows * maze->num_cols;
+
+	maze->num_dirs = (maze->num_levels > 1) ? DIR_NUM_DIRS :
+						  DIR_NUM_PLANAR_DIRS;
 }
 
+/*
+ * Geometric neighbour, regardless of walls or stairs. offset counts cells
+ * in the plane and levels for DIR_ABOVE and DIR_BELOW.
+ */
 static struct Cell *maze_get_neighbour_cell_offset(struct Maze *maze,
 						   struct Cell *cell,
 						   Direction dir, int offset)
 {
-	/* Neighbour cells in UP, RIGHT, DOWN, and LEFT diections */
-	int neighbours[4][2] = { { -1, 0 },  { 0, 1 }, { 1, 0 }, { 0, -1 } };
+	/* Level, row and col moves in UP, RIGHT, DOWN, LEFT, ABOVE and BELOW */
+	static const int neighbours[DIR_NUM_DIRS][3] = {
+		{ 0, -1, 0 }, { 0, 0, 1 }, { 0, 1, 0 },
+		{ 0, 0, -1 }, { 1, 0, 0 }, { -1, 0, 0 },
+	};
+	int level;
+	int row;
+	int col;
 
 	if (dir >= DIR_NUM_DIRS)
 		return NULL;
 
-	return maze_get_cell(maze, cell->row + (neighbours[dir][0] * offset),
-				   cell->col + (neighbours[dir][1] * offset));
+	level = cell->level + neighbours[dir][0] * offset;
+	row = cell->row + neighbours[dir][1] * offset;
+	col = cell->col + neighbours[dir][2] * offset;
+
+	if (level < 0 || level >= maze->num_levels ||
+	    row < 0 || row >= maze->num_rows ||
+	    col < 0 || col >= maze->num_cols)
+		return NULL;
+
+	return &maze->board[(cell - maze->board) + maze->strides[dir] * offset];
 }
 
+/* Neighbour a solver can move to, levels are only linked by stairs */
 static struct Cell *maze_get_neighbour_cell(struct Maze *maze,
 					    struct Cell *cell, Direction dir)
 {
+	if (dir == DIR_ABOVE && !(cell->stairs & CELL_STAIRS_UP))
+		return NULL;
+	if (dir == DIR_BELOW && !(cell->stairs & CELL_STAIRS_DOWN))
+		return NULL;
+
 	return maze_get_neighbour_cell_offset(maze, cell, dir, 1);
 }
 
+/*
+ * Topology kernels
+ *
+ * Rooms and walls always sit on a square grid, the topology decides how a
+ * solver may move between open cells. Each kernel fills neighbours[] with
+ * the open cells reachable from cell and returns how many there are.
+ *
+ * The kernels and the solver bodies are always inlined and take the
+ * topology as a compile time constant: MAZE_SOLVER_INSTANTIATE() below
+ * stamps out one copy of a solver per topology, so each copy runs its own
+ * unrolled kernel without any per-cell switch.
+ */
+#define MAZE_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/* 8 planar moves plus stairs up and down */
+#define MAZE_MAX_NEIGHBOURS 10
+
+/* Row and col moves, clockwise from UP */
+static const int square_moves[4][2] = {
+	{ -1, 0 }, { 0, 1 }, { 1, 0 }, { 0, -1 },
+};
+
+static const int octile_moves[8][2] = {
+	{ -1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 },
+	{ 1, 0 }, { 1, -1 }, { 0, -1 }, { -1, -1 },
+};
+
+/* "odd-r" layout: odd rows are drawn shifted right by half a cell */
+static const int hex_moves[2][6][2] = {
+	{ { -1, -1 }, { -1, 0 }, { 0, 1 }, { 1, 0 }, { 1, -1 }, { 0, -1 } },
+	{ { -1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, -1 } },
+};
+
+/*
+ * Walls come from the cell types, or from the walls bit plane when the
+ * cells around may be written by another thread.
+ */
+MAZE_ALWAYS_INLINE gboolean maze_cell_is_wall(struct Maze *maze,
+					      const guint64 *walls,
+					      struct Cell *cell)
+{
+	int i;
+
+	if (!walls)
+		return cell->type == CELL_TYPE_WALL;
+
+	i = cell - maze->board;
+	return (walls[i >> 6] >> (i & 63)) & 1;
+}
+
+MAZE_ALWAYS_INLINE int maze_neighbours_planar(struct Maze *maze,
+					      struct Cell *cell,
+					      const int (*moves)[2],
+					      const int num_moves,
+					      const gboolean wrap,
+					      const gboolean diagonal,
+					      const guint64 *walls,
+					      struct Cell **neighbours)
+{
+	struct Cell *level_board;
+	struct Cell *n_cell;
+	int num = 0;
+	int row;
+	int col;
+	int i;
+
+	level_board = cell - (cell->row * maze->num_cols + cell->col);
+
+	for (i = 0; i < num_moves; i++) {
+		row = cell->row + moves[i][0];
+		col = cell->col + moves[i][1];
+
+		if (wrap) {
+			row = (row + maze->num_rows) % maze->num_rows;
+			col = (col + maze->num_cols) % maze->num_cols;
+		} else if (row < 0 || row >= maze->num_rows ||
+			   col < 0 || col >= maze->num_cols) {
+			continue;
+		}
+
+		n_cell = &level_board[row * maze->num_cols + col];
+		if (maze_cell_is_wall(maze, walls, n_cell))
+			continue;
+
+		/* No cutting corners, both sides of a diagonal move are open */
+		if (diagonal && moves[i][0] && moves[i][1] &&
+		    (maze_cell_is_wall(maze, walls,
+				       &level_board[cell->row * maze->num_cols + col]) ||
+		     maze_cell_is_wall(maze, walls,
+				       &level_board[row * maze->num_cols + cell->col])))
+			continue;
+
+		neighbours[num++] = n_cell;
+	}
+
+	if (cell->stairs & CELL_STAIRS_UP)
+		neighbours[num++] = cell + maze->strides[DIR_ABOVE];
+	if (cell->stairs & CELL_STAIRS_DOWN)
+		neighbours[num++] = cell + maze->strides[DIR_BELOW];
+
+	return num;
+}
+
+MAZE_ALWAYS_INLINE int maze_topology_neighbours_walls(struct Maze *maze,
+						      const MazeTopology topology,
+						      struct Cell *cell,
+						      const guint64 *walls,
+						      struct Cell **neighbours)
+{
+	switch (topology) {
+	case TOPOLOGY_OCTILE:
+		return maze_neighbours_planar(maze, cell, octile_moves, 8,
+					      FALSE, TRUE, walls, neighbours);
+	case TOPOLOGY_TORUS:
+		return maze_neighbours_planar(maze, cell, square_moves, 4,
+					      TRUE, FALSE, walls, neighbours);
+	case TOPOLOGY_HEX:
+		return maze_neighbours_planar(maze, cell,
+					      hex_moves[cell->row & 1], 6,
+					      FALSE, FALSE, walls, neighbours);
+	case TOPOLOGY_SQUARE:
+	default:
+		return maze_neighbours_planar(maze, cell, square_moves, 4,
+					      FALSE, FALSE, walls, neighbours);
+	}
+}
+
+MAZE_ALWAYS_INLINE int maze_topology_neighbours(struct Maze *maze,
+						const MazeTopology topology,
+						struct Cell *cell,
+						struct Cell **neighbours)
+{
+	return maze_topology_neighbours_walls(maze, topology, cell, NULL,
+					      neighbours);
+}
+
+/* Fewest moves between two cells, ignoring walls */
+MAZE_ALWAYS_INLINE int maze_topology_distance(struct Maze *maze,
+					      const MazeTopology topology,
+					      struct Cell *cell1,
+					      struct Cell *cell2)
+{
+	int d_level = abs(cell1->level - cell2->level);
+	int d_row = abs(cell1->row - cell2->row);
+	int d_col = abs(cell1->col - cell2->col);
+	int q1;
+	int q2;
+
+	switch (topology) {
+	case TOPOLOGY_OCTILE:
+		return d_level + MAX(d_row, d_col);
+	case TOPOLOGY_TORUS:
+		return d_level + MIN(d_row, maze->num_rows - d_row) +
+		       MIN(d_col, maze->num_cols - d_col);
+	case TOPOLOGY_HEX:
+		/* Through cube coordinates, q + r + s = 0 */
+		q1 = cell1->col - (cell1->row - (cell1->row & 1)) / 2;
+		q2 = cell2->col - (cell2->row - (cell2->row & 1)) / 2;
+		return d_level + (abs(q1 - q2) + d_row +
+				  abs(q1 - q2 + cell1->row - cell2->row)) / 2;
+	case TOPOLOGY_SQUARE:
+	default:
+		return d_level + d_row + d_col;
+	}
+}
+
+/* For the non critical paths, dispatch on the maze topology at runtime */
+static int maze_get_neighbours(struct Maze *maze, struct Cell *cell,
+			       struct Cell **neighbours)
+{
+	return maze_topology_neighbours(maze, maze->topology, cell, neighbours);
+}
+
+typedef int (*SolverFunc)(struct Maze *);
+
+/*
+ * Every solver comes in an interactive flavour, run by the GUI thread with
+ * cancellation and animation, and a headless one for batch and benchmark
+ * use where both checks compile away.
+ *
+ * MAZE_TMPL_INSTANTIATE(func, type) expects func##_tmpl(type arg, topology,
+ * interactive) returning an int, and defines func##_funcs[interactive][topology].
+ */
+#define MAZE_TMPL_VARIANT(func, name, type, topology, interactive)	\
+static int func##_##name(type arg)					\
+{									\
+	return func##_tmpl(arg, topology, interactive);			\
+}
+
+#define MAZE_TMPL_INSTANTIATE(func, type)				\
+MAZE_TMPL_VARIANT(func, square, type, TOPOLOGY_SQUARE, TRUE)		\
+MAZE_TMPL_VARIANT(func, octile, type, TOPOLOGY_OCTILE, TRUE)		\
+MAZE_TMPL_VARIANT(func, torus, type, TOPOLOGY_TORUS, TRUE)		\
+MAZE_TMPL_VARIANT(func, hex, type, TOPOLOGY_HEX, TRUE)			\
+MAZE_TMPL_VARIANT(func, square_headless, type, TOPOLOGY_SQUARE, FALSE)	\
+MAZE_TMPL_VARIANT(func, octile_headless, type, TOPOLOGY_OCTILE, FALSE)	\
+MAZE_TMPL_VARIANT(func, torus_headless, type, TOPOLOGY_TORUS, FALSE)	\
+MAZE_TMPL_VARIANT(func, hex_headless, type, TOPOLOGY_HEX, FALSE)	\
+static int (* const func##_funcs[2][TOPOLOGY_NUM])(type) = {		\
+	[FALSE] = {							\
+		[TOPOLOGY_SQUARE] = func##_square_headless,		\
+		[TOPOLOGY_OCTILE] = func##_octile_headless,		\
+		[TOPOLOGY_TORUS] = func##_torus_headless,		\
+		[TOPOLOGY_HEX] = func##_hex_headless,			\
+	},								\
+	[TRUE] = {							\
+		[TOPOLOGY_SQUARE] = func##_square,			\
+		[TOPOLOGY_OCTILE] = func##_octile,			\
+		[TOPOLOGY_TORUS] = func##_torus,			\
+		[TOPOLOGY_HEX] = func##_hex,				\
+	},								\
+}
+
+#define MAZE_SOLVER_INSTANTIATE(solver)					\
+	MAZE_TMPL_INSTANTIATE(solver, struct Maze *)
+
 static gboolean maze_cell_is_perimeter(struct Maze *maze, struct Cell *cell)
 {
 	return cell->row == 0 || cell->col == 0 ||
@@ -145,760 +640,6366 @@ static void maze_cell_reset(struct Maze *maze, struct Cell *cell)
 		cell->type = CELL_TYPE_EMPTY;
 }
 
-static struct Cell *maze_get_cell_for_start_or_end(struct Maze *maze, int row, int col)
+static void maze_mark_endpoints(struct Maze *maze)
 {
-	struct Cell *cell;
-	struct Cell *n_cell;
-	Direction dir;
+	GList *elem;
 
-	if (maze->solver_status == RUNNING)
-		return NULL;
+	for (elem = maze->exits; elem; elem = elem->next)
+		((struct Cell *)elem->data)->type = CELL_TYPE_END;
 
-	cell = maze_get_cell(maze, row, col);
-	if (!cell)
-		return NULL;
+	maze->start_cell->type = CELL_TYPE_START;
+	maze->end_cell->type = CELL_TYPE_END;
+}
 
-	if (cell->type == CELL_TYPE_WALL) {
-		if (!maze_cell_is_perimeter(maze, cell))
-			return NULL;
+/*
+ * Compact boards
+ *
+ * maze_compact() replaces the cell array, the bulk of the memory of a
+ * maze, with bit planes of its walls and stairs. Each level of a plane is
+ * cut in MAZE_BLOCK_SIZE x MAZE_BLOCK_SIZE blocks, each one run length
+ * encoded on its own or kept as raw bits when the runs don't pay off. The
+ * offsets index gives random access to any block, and each thread caches
+ * the blocks it decoded last, so scanning a level through the cell getters
+ * decodes each block once without any locking. The board is expanded back
+ * as soon as the maze is solved or edited.
+ */
+#define MAZE_BLOCK_SHIFT	6
+#define MAZE_BLOCK_SIZE		(1 << MAZE_BLOCK_SHIFT)
+#define MAZE_BLOCK_MASK		(MAZE_BLOCK_SIZE - 1)
+#define MAZE_BLOCK_BITS		(MAZE_BLOCK_SIZE * MAZE_BLOCK_SIZE)
+#define MAZE_BLOCK_WORDS	(MAZE_BLOCK_BITS / 64)
+#define MAZE_BLOCK_BYTES	(MAZE_BLOCK_BITS / 8)
+#define MAZE_BLOCK_CACHE_SIZE	8
 
-		/* The cell is part of the perimeter walls */
-		for (dir = DIR_FIRST; dir < DIR_NUM_DIRS; dir++) {
-			n_cell = maze_get_neighbour_cell(maze, cell, dir);
-			if (!n_cell || n_cell->type == CELL_TYPE_WALL)
-				continue;
+typedef enum {
+	BLOCK_RAW = 0,
+	BLOCK_RLE,
+} BlockEncoding;
 
-			return cell;
-		}
+typedef enum {
+	PLANE_WALLS = 0,
+	PLANE_STAIRS_UP,
+	PLANE_STAIRS_DOWN,
+	PLANE_NUM_PLANES,
+} BoardPlane;
+
+struct PlaneBlock {
+	int index;
+	guint64 bits[MAZE_BLOCK_WORDS];
+};
 
-		return NULL;
-	}
+/* Per thread, holds blocks of the compact board numbered serial */
+struct BlockCache {
+	guint serial;
+	struct PlaneBlock blocks[MAZE_BLOCK_CACHE_SIZE];
+	int last;
+	int next;
+};
 
-	return cell;
-}
+static GPrivate block_cache_key = G_PRIVATE_INIT(g_free);
 
-int maze_set_end_cell(struct Maze *maze, int row, int col)
-{
-	struct Cell *cell;
+/* Never 0, so a new cache matches no board */
+static gint compact_serial;
 
-	cell = maze_get_cell_for_start_or_end(maze, row, col);
-	if (!cell)
-		return -1;
+struct CompactBoard {
+	int blocks_per_row;
+	int blocks_per_level;
 
-	/* Reset previous start_cell */
-	maze_cell_reset(maze, maze->end_cell);
+	/* Blocks of each plane */
+	int num_blocks;
 
-	cell->type = CELL_TYPE_END;
-	maze->end_cell = cell;
+	/*
+	 * Block i of plane p is encoded in data[offsets[p * num_blocks + i]]
+	 * up to the offset of the next block.
+	 */
+	guint32 *offsets;
+	guint8 *data;
 
-	return 0;
-}
+	/* Tells the block caches of a freed board from this one */
+	guint serial;
+
+	/*
+	 * The distance field for maze_get_path_to_end() is built once by the
+	 * first caller, the others wait for it.
+	 */
+	GMutex dist_lock;
+
+	/* Board indexes of the endpoints */
+	guint32 start;
+	guint32 end;
+	guint32 *exits;
+	int num_exits;
+};
+
+/* Bits are packed MSB first */
+struct BitStream {
+	guint8 *data;
+	int size;
+	int pos;
+};
 
-int maze_set_start_cell(struct Maze *maze, int row, int col)
+static gboolean bit_stream_write(struct BitStream *bs, guint value,
+				 int num_bits)
 {
-	struct Cell *cell;
+	int i;
 
-	cell = maze_get_cell_for_start_or_end(maze, row, col);
-	if (!cell)
-		return -1;
+	if (bs->pos + num_bits > bs->size * 8)
+		return FALSE;
 
-	/* Reset previous start_cell */
-	maze_cell_reset(maze, maze->start_cell);
+	for (i = num_bits - 1; i >= 0; i--, bs->pos++) {
+		if (value & (1U << i))
+			bs->data[bs->pos >> 3] |= 0x80 >> (bs->pos & 7);
+		else
+			bs->data[bs->pos >> 3] &= ~(0x80 >> (bs->pos & 7));
+	}
 
-	cell->type = CELL_TYPE_START;
-	maze->start_cell = cell;
+	return TRUE;
+}
 
-	return 0;
+static guint bit_stream_read(struct BitStream *bs)
+{
+	guint bit;
+
+	bit = (bs->data[bs->pos >> 3] >> (7 - (bs->pos & 7))) & 1;
+	bs->pos++;
+
+	return bit;
 }
 
-gboolean maze_solver_running(struct Maze *maze)
+/* Elias gamma code of a run length: its bit length - 1 zeros, then it */
+static gboolean bit_stream_write_run(struct BitStream *bs, guint run)
 {
-	return (maze->solver_status == RUNNING);
+	int num_bits = g_bit_storage(run);
+
+	return bit_stream_write(bs, 0, num_bits - 1) &&
+	       bit_stream_write(bs, run, num_bits);
 }
 
-void maze_set_anim_speed(struct Maze *maze, uint speed)
+static guint bit_stream_read_run(struct BitStream *bs)
 {
-	maze->anim_speed = (speed < 100) ? speed : 100;
+	guint run = 1;
+	int num_zeros = 0;
+
+	while (!bit_stream_read(bs))
+		num_zeros++;
+
+	while (num_zeros--)
+		run = run << 1 | bit_stream_read(bs);
+
+	return run;
 }
 
-uint maze_get_anim_speed(struct Maze *maze)
+static inline gboolean plane_bits_get(const guint64 *bits, int bit)
 {
-	return maze->anim_speed;
+	return (bits[bit >> 6] >> (bit & 63)) & 1;
 }
 
-int maze_get_num_rows(struct Maze *maze)
+static void plane_bits_fill(guint64 *bits, int bit, int len)
 {
-	return maze->num_rows;
+	int num;
+
+	while (len > 0) {
+		num = MIN(64 - (bit & 63), len);
+		bits[bit >> 6] |= (num == 64 ? ~G_GUINT64_CONSTANT(0) :
+				   ((G_GUINT64_CONSTANT(1) << num) - 1)) <<
+				  (bit & 63);
+		bit += num;
+		len -= num;
+	}
 }
 
-int maze_get_num_cols(struct Maze *maze)
+static void maze_block_origin(struct CompactBoard *cb, int index, int *level,
+			      int *row, int *col)
 {
-	return maze->num_cols;
+	*level = index / cb->blocks_per_level;
+	*row = (index % cb->blocks_per_level) / cb->blocks_per_row *
+	       MAZE_BLOCK_SIZE;
+	*col = (index % cb->blocks_per_row) * MAZE_BLOCK_SIZE;
 }
 
-gboolean maze_get_difficult(struct Maze *maze)
+static gboolean maze_cell_plane_bit(struct Cell *cell, BoardPlane plane)
 {
-	return maze->complex;
+	switch (plane) {
+	case PLANE_STAIRS_UP:
+		return !!(cell->stairs & CELL_STAIRS_UP);
+	case PLANE_STAIRS_DOWN:
+		return !!(cell->stairs & CELL_STAIRS_DOWN);
+	default:
+		return cell->type == CELL_TYPE_WALL;
+	}
 }
 
-int maze_get_path_length(struct Maze *maze)
+/*
+ * Gather the bits of a block. The cells past the board edges are walls
+ * without stairs, which extends the runs of the perimeter.
+ */
+static void maze_block_gather(struct Maze *maze, struct CompactBoard *cb,
+			      BoardPlane plane, int index, guint64 *bits)
 {
-	return maze->path_len;
+	struct Cell *cell;
+	gboolean pad;
+	int level;
+	int row0;
+	int col0;
+	int row;
+	int col;
+	int bit;
+
+	maze_block_origin(cb, index, &level, &row0, &col0);
+
+	pad = plane == PLANE_WALLS;
+	memset(bits, pad ? 0xff : 0, MAZE_BLOCK_BYTES);
+
+	for (row = 0; row < MAZE_BLOCK_SIZE && row0 + row < maze->num_rows;
+	     row++) {
+		cell = maze_get_cell(maze, level, row0 + row, col0);
+		for (col = 0; col < MAZE_BLOCK_SIZE && col0 + col < maze->num_cols;
+		     col++, cell++) {
+			bit = row * MAZE_BLOCK_SIZE + col;
+			if (maze_cell_plane_bit(cell, plane) != pad)
+				bits[bit >> 6] ^= G_GUINT64_CONSTANT(1) <<
+						  (bit & 63);
+		}
+	}
 }
 
-float maze_get_solve_time(struct Maze *maze)
+/* Encode a block in out, at most 1 + MAZE_BLOCK_BYTES bytes */
+static int maze_block_encode(const guint64 *bits, guint8 *out)
 {
-	return (float)maze->solve_time / G_USEC_PER_SEC;
+	struct BitStream bs = {
+		.data = out + 1,
+		.size = MAZE_BLOCK_BYTES,
+	};
+	gboolean value;
+	int run;
+	int bit;
+
+	value = plane_bits_get(bits, 0);
+	if (!bit_stream_write(&bs, value, 1))
+		goto raw;
+
+	for (bit = 0; bit < MAZE_BLOCK_BITS; bit += run) {
+		for (run = 1; bit + run < MAZE_BLOCK_BITS &&
+			      plane_bits_get(bits, bit + run) == value; run++)
+			;
+
+		if (!bit_stream_write_run(&bs, run))
+			goto raw;
+
+		value = !value;
+	}
+
+	out[0] = BLOCK_RLE;
+
+	return 1 + (bs.pos + 7) / 8;
+
+raw:
+	out[0] = BLOCK_RAW;
+	memcpy(out + 1, bits, MAZE_BLOCK_BYTES);
+
+	return 1 + MAZE_BLOCK_BYTES;
 }
 
-SolverAlgorithm maze_get_solver_algorithm(struct Maze *maze)
+static void maze_block_decode(const guint8 *in, guint64 *bits)
 {
-	return maze->solver_algorithm;
+	struct BitStream bs = {
+		.data = (guint8 *)in + 1,
+	};
+	gboolean value;
+	int run;
+	int bit;
+
+	if (in[0] == BLOCK_RAW) {
+		memcpy(bits, in + 1, MAZE_BLOCK_BYTES);
+		return;
+	}
+
+	memset(bits, 0, MAZE_BLOCK_BYTES);
+
+	value = bit_stream_read(&bs);
+	for (bit = 0; bit < MAZE_BLOCK_BITS; bit += run) {
+		run = bit_stream_read_run(&bs);
+		if (value)
+			plane_bits_fill(bits, bit, run);
+
+		value = !value;
+	}
 }
 
-void maze_set_solver_algorithm(struct Maze *maze, SolverAlgorithm algo)
+static struct BlockCache *maze_block_cache(struct CompactBoard *cb)
 {
-	maze->solver_algorithm = algo;
+	struct BlockCache *cache;
+	int i;
+
+	cache = g_private_get(&block_cache_key);
+	if (!cache) {
+		cache = g_new0(struct BlockCache, 1);
+		g_private_set(&block_cache_key, cache);
+	}
+
+	if (cache->serial != cb->serial) {
+		for (i = 0; i < MAZE_BLOCK_CACHE_SIZE; i++)
+			cache->blocks[i].index = -1;
+		cache->serial = cb->serial;
+		cache->last = 0;
+		cache->next = 0;
+	}
+
+	return cache;
 }
 
-static void _maze_clear_board(struct Maze *maze)
+/* index runs over the blocks of every plane */
+static const guint64 *maze_compact_get_block(struct CompactBoard *cb,
+					     int index)
 {
-	struct Cell *cell;
+	struct BlockCache *cache = maze_block_cache(cb);
+	struct PlaneBlock *block;
 	int i;
 
-	for (i = 0; i < maze->num_rows * maze->num_cols; i++) {
-		cell = &maze->board[i];
+	if (cache->blocks[cache->last].index == index)
+		return cache->blocks[cache->last].bits;
 
-		cell->value = 0;
-		cell->heuristic = 0;
-		cell->parent = NULL;
-		if (cell->type != CELL_TYPE_WALL)
-			cell->type = CELL_TYPE_EMPTY;
+	for (i = 0; i < MAZE_BLOCK_CACHE_SIZE; i++) {
+		if (cache->blocks[i].index == index) {
+			cache->last = i;
+			return cache->blocks[i].bits;
+		}
 	}
 
-	maze->start_cell->type = CELL_TYPE_START;
-	maze->end_cell->type = CELL_TYPE_END;
+	block = &cache->blocks[cache->next];
+	block->index = index;
+	maze_block_decode(&cb->data[cb->offsets[index]], block->bits);
+
+	cache->last = cache->next;
+	cache->next = (cache->next + 1) % MAZE_BLOCK_CACHE_SIZE;
+
+	return block->bits;
 }
 
-void maze_clear_board(struct Maze *maze)
+static gboolean maze_compact_get_bit(struct CompactBoard *cb,
+				     BoardPlane plane, int level, int row,
+				     int col)
 {
-	if (maze->solver_status == RUNNING)
-		return;
+	const guint64 *bits;
 
-	_maze_clear_board(maze);
+	bits = maze_compact_get_block(cb, plane * cb->num_blocks +
+					  level * cb->blocks_per_level +
+					  (row >> MAZE_BLOCK_SHIFT) *
+					  cb->blocks_per_row +
+					  (col >> MAZE_BLOCK_SHIFT));
+
+	return plane_bits_get(bits, (row & MAZE_BLOCK_MASK) * MAZE_BLOCK_SIZE +
+				   (col & MAZE_BLOCK_MASK));
 }
 
-static inline void maze_anim_delay(struct Maze *maze)
+static int maze_compact_cell_index(struct Maze *maze, int level, int row,
+				   int col)
 {
-	if (maze->anim_speed < 100)
-		g_usleep((100 - maze->anim_speed) * (100 - maze->anim_speed));
+	if (level < 0 || level >= maze->num_levels ||
+	    row < 0 || row >= maze->num_rows ||
+	    col < 0 || col >= maze->num_cols)
+		return -1;
+
+	return (level * maze->num_rows + row) * maze->num_cols + col;
 }
 
-static int maze_solve_a_star(struct Maze *maze)
+static CellType maze_compact_get_type(struct Maze *maze, int level, int row,
+				      int col)
 {
-	struct Cell *cell;
-	struct Cell *path;
-	GList *open = NULL;
-	GList *elem;
-	Direction dir;
-	int err = 0;
-	struct Cell *board_cell;
+	struct CompactBoard *cb = maze->compact;
+	int index;
+	int i;
 
-	cell = cell_new(maze->start_cell->row, maze->start_cell->col);
-	cell->value = 1;
-	cell->heuristic = cell_distance(cell, maze->end_cell);
+	index = maze_compact_cell_index(maze, level, row, col);
+	if (index < 0)
+		return 0;
 
-	open = g_list_append(open, cell);
+	if (index == cb->start)
+		return CELL_TYPE_START;
+	if (index == cb->end)
+		return CELL_TYPE_END;
+	for (i = 0; i < cb->num_exits; i++)
+		if (index == cb->exits[i])
+			return CELL_TYPE_END;
 
-	while (open != NULL) {
-		if (maze->solver_status == CANCELED) {
-			err = -1;
-			goto exit;
-		}
+	if (maze_compact_get_bit(cb, PLANE_WALLS, level, row, col))
+		return CELL_TYPE_WALL;
 
-		maze_anim_delay(maze);
+	return CELL_TYPE_EMPTY;
+}
 
-		elem = g_list_first(open);
-		cell = (struct Cell *)elem->data;
-		open = g_list_delete_link(open, elem);
+static int maze_compact_get_stairs(struct Maze *maze, int level, int row,
+				   int col)
+{
+	struct CompactBoard *cb = maze->compact;
+	int stairs = 0;
 
-		board_cell = maze_get_cell(maze, cell->row, cell->col);
-		board_cell->type = CELL_TYPE_PATH_VISITED;
+	if (maze_compact_cell_index(maze, level, row, col) < 0)
+		return 0;
 
-		/* Put the cell in the closed list */
-		board_cell->value = 1;
+	if (maze_compact_get_bit(cb, PLANE_STAIRS_UP, level, row, col))
+		stairs |= CELL_STAIRS_UP;
+	if (maze_compact_get_bit(cb, PLANE_STAIRS_DOWN, level, row, col))
+		stairs |= CELL_STAIRS_DOWN;
 
-		if (!cell_cmp(cell, maze->end_cell))
-			break;
+	return stairs;
+}
 
-		for (dir = DIR_FIRST; dir < DIR_NUM_DIRS; dir++) {
-			struct Cell *n_cell;
+static void maze_compact_free(struct Maze *maze)
+{
+	struct CompactBoard *cb = maze->compact;
 
-			board_cell = maze_get_neighbour_cell(maze, cell, dir);
-			/*
-			 * n_cell->value != 0 means the cell is in the closed
-			 * list and can be skipped
-			 */
-			if (!board_cell || board_cell->type == CELL_TYPE_WALL ||
-			    board_cell->value)
-				continue;
+	if (!cb)
+		return;
 
-			n_cell = cell_new(board_cell->row, board_cell->col);
-			n_cell->parent = cell;
-			n_cell->value = cell->value + 1;
-			n_cell->heuristic = n_cell->value +
-					  cell_distance(n_cell, maze->end_cell);
+	g_mutex_clear(&cb->dist_lock);
+	g_free(cb->offsets);
+	g_free(cb->data);
+	g_free(cb->exits);
+	g_free(cb);
 
-			/* Lookup in open for same cell with a lower value */
-			if (!g_list_find_custom(open, n_cell,
-					  (GCompareFunc)cell_cmp_lower_value)) {
-				open = g_list_insert_sorted(open, n_cell,
-					      (GCompareFunc)cell_cmp_heuristic);
+	maze->compact = NULL;
+}
 
-				board_cell = maze_get_cell(maze,
-							   n_cell->row,
-							   n_cell->col);
-				board_cell->type = CELL_TYPE_PATH_HEAD;
-			} else {
-				g_free(n_cell);
+static gsize maze_compact_size(struct CompactBoard *cb)
+{
+	int num_blocks = cb->num_blocks * PLANE_NUM_PLANES;
+
+	return sizeof(*cb) + (num_blocks + 1) * sizeof(guint32) +
+	       cb->offsets[num_blocks] + cb->num_exits * sizeof(guint32);
+}
+
+/* Rebuild the cell array of a compact maze */
+static void maze_expand(struct Maze *maze)
+{
+	struct CompactBoard *cb = maze->compact;
+	guint64 bits[PLANE_NUM_PLANES][MAZE_BLOCK_WORDS];
+	struct Cell *cell;
+	BoardPlane plane;
+	int index;
+	int level;
+	int row0;
+	int col0;
+	int row;
+	int col;
+	int bit;
+	int i;
+
+	if (!cb)
+		return;
+
+	maze->board = g_new(struct Cell, maze->board_size);
+	memset(maze->board, 0, maze_num_cells(maze) * sizeof(struct Cell));
+
+	for (i = 0; i < cb->num_blocks; i++) {
+		for (plane = PLANE_WALLS; plane < PLANE_NUM_PLANES; plane++) {
+			index = plane * cb->num_blocks + i;
+			maze_block_decode(&cb->data[cb->offsets[index]],
+					  bits[plane]);
+		}
+
+		maze_block_origin(cb, i, &level, &row0, &col0);
+
+		for (row = 0; row < MAZE_BLOCK_SIZE &&
+			      row0 + row < maze->num_rows; row++) {
+			cell = maze_get_cell(maze, level, row0 + row, col0);
+			for (col = 0; col < MAZE_BLOCK_SIZE &&
+				      col0 + col < maze->num_cols;
+			     col++, cell++) {
+				bit = row * MAZE_BLOCK_SIZE + col;
+				cell->level = level;
+				cell->row = row0 + row;
+				cell->col = col0 + col;
+				if (plane_bits_get(bits[PLANE_WALLS], bit))
+					cell->type = CELL_TYPE_WALL;
+				if (plane_bits_get(bits[PLANE_STAIRS_UP], bit))
+					cell->stairs |= CELL_STAIRS_UP;
+				if (plane_bits_get(bits[PLANE_STAIRS_DOWN], bit))
+					cell->stairs |= CELL_STAIRS_DOWN;
 			}
 		}
 	}
 
-	maze->path_len = 0;
+	maze->start_cell = &maze->board[cb->start];
+	maze->end_cell = &maze->board[cb->end];
+	for (i = cb->num_exits - 1; i >= 0; i--)
+		maze->exits = g_list_prepend(maze->exits,
+					     &maze->board[cb->exits[i]]);
+	maze_mark_endpoints(maze);
 
-	while (cell) {
-		path = maze_get_cell(maze, cell->row, cell->col);
-		path->type = CELL_TYPE_PATH_SOLUTION;
-		maze->path_len++;
+	maze_compact_free(maze);
+}
 
-		cell = cell->parent;
+/*
+ * Drop the cell array and the solver scratch, keeping a compressed copy of
+ * the layout. The cell getters keep working on a compact maze, anything
+ * else expands it back first.
+ */
+int maze_compact(struct Maze *maze)
+{
+	struct CompactBoard *cb;
+	guint64 bits[MAZE_BLOCK_WORDS];
+	BoardPlane plane;
+	guint8 *out;
+	GList *elem;
+	gsize size = 0;
+	int num_blocks;
+	int i;
+
+	if (maze->compact)
+		return 0;
+
+	if (maze->solver_status == RUNNING || maze->generating || !maze->board)
+		return -1;
+
+	cb = g_new0(struct CompactBoard, 1);
+	cb->blocks_per_row = (maze->num_cols + MAZE_BLOCK_MASK) >>
+			     MAZE_BLOCK_SHIFT;
+	cb->blocks_per_level = cb->blocks_per_row *
+			       ((maze->num_rows + MAZE_BLOCK_MASK) >>
+				MAZE_BLOCK_SHIFT);
+	cb->num_blocks = cb->blocks_per_level * maze->num_levels;
+	num_blocks = cb->num_blocks * PLANE_NUM_PLANES;
+
+	cb->offsets = g_new(guint32, num_blocks + 1);
+	out = g_malloc((gsize)num_blocks * (1 + MAZE_BLOCK_BYTES));
+	for (plane = PLANE_WALLS; plane < PLANE_NUM_PLANES; plane++) {
+		for (i = 0; i < cb->num_blocks; i++) {
+			maze_block_gather(maze, cb, plane, i, bits);
+			cb->offsets[plane * cb->num_blocks + i] = size;
+			size += maze_block_encode(bits, out + size);
+		}
 	}
+	cb->offsets[num_blocks] = size;
+	cb->data = g_realloc(out, size);
 
-	maze->start_cell->type = CELL_TYPE_START;
-	maze->end_cell->type = CELL_TYPE_END;
+	cb->serial = g_atomic_int_add(&compact_serial, 1) + 1;
+	g_mutex_init(&cb->dist_lock);
 
-exit:
-	g_list_free_full(open, (GDestroyNotify)g_free);
+	cb->start = maze->start_cell - maze->board;
+	cb->end = maze->end_cell - maze->board;
+	cb->num_exits = g_list_length(maze->exits);
+	cb->exits = g_new(guint32, cb->num_exits);
+	for (elem = maze->exits, i = 0; elem; elem = elem->next, i++)
+		cb->exits[i] = (struct Cell *)elem->data - maze->board;
 
-	return err;
+	g_list_free(maze->exits);
+	maze->exits = NULL;
+	maze->start_cell = NULL;
+	maze->end_cell = NULL;
+
+	g_free(maze->board);
+	maze->board = NULL;
+	g_free(maze->work);
+	maze->work = NULL;
+	maze->work_size = 0;
+	g_free(maze->goal_dist);
+	maze->goal_dist = NULL;
+	maze->goal_dist_size = 0;
+	maze->goal_cell = NULL;
+
+	/* The solver state went with the cells */
+	maze->solver_status = STOPPED;
+	maze->compact = cb;
+
+	return 0;
 }
 
-static void maze_set_solution_path(struct Maze *maze)
+static struct Cell *maze_get_cell_for_start_or_end(struct Maze *maze, int level,
+						   int row, int col)
 {
 	struct Cell *cell;
 	struct Cell *n_cell;
-	struct Cell *t_cell;
 	Direction dir;
 
-	cell = maze->end_cell;
-	maze->path_len = 1;
+	if (maze->solver_status == RUNNING || maze->generating)
+		return NULL;
 
-	/* Light up the shortest path */
-	while (cell != maze->start_cell) {
-		if (maze->solver_status == CANCELED)
-			return;
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell)
+		return NULL;
 
-		maze->path_len++;
-		cell->type = CELL_TYPE_PATH_SOLUTION;
-		t_cell = cell;
+	if (cell->type == CELL_TYPE_WALL) {
+		if (!maze_cell_is_perimeter(maze, cell))
+			return NULL;
 
-		/* Search for a neighbours with the lowest value */
+		/* The cell is part of the perimeter walls */
 		for (dir = DIR_FIRST; dir < DIR_NUM_DIRS; dir++) {
 			n_cell = maze_get_neighbour_cell(maze, cell, dir);
 			if (!n_cell || n_cell->type == CELL_TYPE_WALL)
 				continue;
 
-			if (n_cell->value && n_cell->value < t_cell->value)
-				t_cell = n_cell;
+			return cell;
 		}
 
-		/* Return if didn't find any cell with a lower value */
-		if (cell == t_cell)
-			return;
-
-		cell = t_cell;
+		return NULL;
 	}
 
-	maze->start_cell->type = CELL_TYPE_START;
-	maze->end_cell->type = CELL_TYPE_END;
+	return cell;
 }
 
-static int maze_solve_always_turn(struct Maze *maze)
+typedef enum {
+	MAZE_DELTA_START = 0,
+	MAZE_DELTA_END,
+	MAZE_DELTA_ADD_EXIT,
+	MAZE_DELTA_REMOVE_EXIT,
+	MAZE_DELTA_WALL,
+	MAZE_DELTA_NUM_OPS,
+} MazeDeltaOp;
+
+/* MAZE_DELTA_WALL turns the cell into a wall */
+#define MAZE_DELTA_FLAG_WALL	(1 << 0)
+/* Undone and redone together with the previous entry */
+#define MAZE_DELTA_FLAG_CHAINED	(1 << 1)
+
+/* One journaled edit. Cells are board indexes, from is the old endpoint */
+struct MazeDelta {
+	guint8 op;
+	guint8 flags;
+	guint32 from;
+	guint32 to;
+};
+
+/*
+ * Moving an endpoint or an exit closes the old cell when it's on the
+ * perimeter and opens the new one, which the layout caches must see.
+ */
+static void maze_move_start(struct Maze *maze, struct Cell *cell)
 {
-	struct Cell *cell;
-	struct Cell *n_cell;
-	int i;
-	Direction dir;
-	int dir_offset;
-	int err = 0;
-	int value;
+	/* Reset previous start_cell */
+	maze_cell_reset(maze, maze->start_cell);
+	maze_touch_cell(maze, maze->start_cell);
 
-	dir = DIR_FIRST;
-	dir_offset = maze->solver_algorithm == SOLVER_ALWAYS_TURN_RIGHT ? 1 : -1;
+	cell->type = CELL_TYPE_START;
+	maze->start_cell = cell;
+	maze_touch_cell(maze, cell);
+	maze->layout_version++;
+}
 
-	cell = maze->start_cell;
-	value = 1;
+static void maze_move_end(struct Maze *maze, struct Cell *cell)
+{
+	/* Reset previous end_cell */
+	maze_cell_reset(maze, maze->end_cell);
+	maze_touch_cell(maze, maze->end_cell);
 
-	while (cell != maze->end_cell) {
-		if (maze->solver_status == CANCELED) {
-			err = -1;
-			goto exit;
-		}
+	cell->type = CELL_TYPE_END;
+	maze->end_cell = cell;
+	maze_touch_cell(maze, cell);
+	maze->layout_version++;
+}
 
-		maze_anim_delay(maze);
+static void maze_add_exit_cell(struct Maze *maze, struct Cell *cell)
+{
+	cell->type = CELL_TYPE_END;
+	maze->exits = g_list_prepend(maze->exits, cell);
+	maze_touch_cell(maze, cell);
+	maze->layout_version++;
+}
 
-		cell->value = value++;
+static void maze_remove_exit_cell(struct Maze *maze, struct Cell *cell)
+{
+	maze->exits = g_list_remove(maze->exits, cell);
+	cell->type = CELL_TYPE_EMPTY;
+	maze_cell_reset(maze, cell);
+	maze_touch_cell(maze, cell);
+	maze->layout_version++;
+}
 
-		/* First look left or right */
-		dir = (dir + dir_offset) % DIR_NUM_DIRS;
-		for (i = 0; i < 4; i++) {
-			n_cell = maze_get_neighbour_cell(maze, cell, dir);
-			if (!n_cell || n_cell->type == CELL_TYPE_WALL) {
-				dir = (dir - dir_offset) % DIR_NUM_DIRS;
-				continue;
-			}
+static void maze_set_wall_cell(struct Maze *maze, struct Cell *cell,
+			       gboolean wall)
+{
+	cell->type = wall ? CELL_TYPE_WALL : CELL_TYPE_EMPTY;
+	maze_touch_cell(maze, cell);
+	maze->layout_version++;
+}
 
-			/* Not a wall. Go on */
-			cell->type = CELL_TYPE_PATH_VISITED;
-			n_cell->type = CELL_TYPE_PATH_HEAD;
-			cell = n_cell;
-			break;
-		}
+static void maze_delta_apply(struct Maze *maze, const struct MazeDelta *delta,
+			     gboolean undo)
+{
+	struct Cell *from = &maze->board[delta->from];
+	struct Cell *to = &maze->board[delta->to];
+	gboolean wall;
 
-		if (!cell_cmp(cell, maze->start_cell)) {
-			// Infinite loop
-			maze->solver_status = UNSOLVABLE;
-			err = -1;
-			goto exit;
-		}
+	switch (delta->op) {
+	case MAZE_DELTA_START:
+		maze_move_start(maze, undo ? from : to);
+		break;
+	case MAZE_DELTA_END:
+		maze_move_end(maze, undo ? from : to);
+		break;
+	case MAZE_DELTA_ADD_EXIT:
+		if (undo)
+			maze_remove_exit_cell(maze, to);
+		else
+			maze_add_exit_cell(maze, to);
+		break;
+	case MAZE_DELTA_REMOVE_EXIT:
+		if (undo)
+			maze_add_exit_cell(maze, to);
+		else
+			maze_remove_exit_cell(maze, to);
+		break;
+	case MAZE_DELTA_WALL:
+		wall = !!(delta->flags & MAZE_DELTA_FLAG_WALL);
+		maze_set_wall_cell(maze, to, undo ? !wall : wall);
+		break;
 	}
+}
 
-	/* Last cell */
-	cell->value = value++;
-
-	maze_set_solution_path(maze);
+/* Journal an edit, dropping the ones which were undone, and apply it */
+static void maze_edit(struct Maze *maze, MazeDeltaOp op, guint8 flags,
+		      struct Cell *from, struct Cell *to)
+{
+	struct MazeDelta delta = {
+		.op = op,
+		.flags = flags,
+		.from = (from ? from : to) - maze->board,
+		.to = to - maze->board,
+	};
+
+	if (!maze->journal)
+		maze->journal = g_array_new(FALSE, FALSE,
+					    sizeof(struct MazeDelta));
+
+	g_array_set_size(maze->journal, maze->journal_pos);
+	g_array_append_val(maze->journal, delta);
+	maze->journal_pos++;
+
+	maze_delta_apply(maze, &delta, FALSE);
+}
 
-exit:
-	return err;
+static void maze_journal_clear(struct Maze *maze)
+{
+	if (maze->journal)
+		g_array_set_size(maze->journal, 0);
+	maze->journal_pos = 0;
 }
 
-/**
- * procedure DFS_iterative(G, v) is
- *    let S be a stack
- *    S.push(v)
- *    while S is not empty do
- *        v = S.pop()
- *        if v is not labeled as discovered then
- *            label v as discovered
- *            for all edges from v to w in G.adjacentEdges(v) do
- *                S.push(w)
+/*
+ * Move an endpoint onto cell. An exit there is removed first, in the same
+ * undo step.
  */
-static int maze_solve_dfs(struct Maze *maze)
+static int maze_move_endpoint(struct Maze *maze, MazeDeltaOp op, int level,
+			      int row, int col)
 {
-	GList *stack = NULL;
-	GList *elem;
 	struct Cell *cell;
-	struct Cell *n_cell;
-	int i;
-	int err = 0;
+	struct Cell *from;
+	guint8 flags = 0;
 
-	stack = g_list_prepend(stack, maze->start_cell);
+	maze_expand(maze);
 
-	while (stack != NULL) {
-		if (maze->solver_status == CANCELED) {
-			err = -1;
-			goto exit;
-		}
+	cell = maze_get_cell_for_start_or_end(maze, level, row, col);
+	if (!cell || cell == maze->start_cell || cell == maze->end_cell)
+		return -1;
 
-		maze_anim_delay(maze);
+	if (g_list_find(maze->exits, cell)) {
+		maze_edit(maze, MAZE_DELTA_REMOVE_EXIT, 0, NULL, cell);
+		flags = MAZE_DELTA_FLAG_CHAINED;
+	}
 
-		elem = g_list_first(stack);
-		cell = elem->data;
-		stack = g_list_delete_link(stack, elem);
+	from = op == MAZE_DELTA_START ? maze->start_cell : maze->end_cell;
+	maze_edit(maze, op, flags, from, cell);
 
-		cell->value = cell->parent ? cell->parent->value + 1 : 1;
-		cell->type = CELL_TYPE_PATH_VISITED;
+	return 0;
+}
 
-		if (cell == maze->end_cell)
-			break;
+int maze_set_end_cell(struct Maze *maze, int level, int row, int col)
+{
+	return maze_move_endpoint(maze, MAZE_DELTA_END, level, row, col);
+}
 
-		for (i = 0; i < 4; i++) {
-			n_cell = maze_get_neighbour_cell(maze, cell, i);
-			if (!n_cell || n_cell->type == CELL_TYPE_WALL || n_cell->value)
-				continue;
+int maze_add_exit(struct Maze *maze, int level, int row, int col)
+{
+	struct Cell *cell;
 
-			n_cell->parent = cell;
-			n_cell->type = CELL_TYPE_PATH_HEAD;
-			stack = g_list_prepend(stack, n_cell);
-		}
-	}
+	maze_expand(maze);
 
-	maze_set_solution_path(maze);
+	cell = maze_get_cell_for_start_or_end(maze, level, row, col);
+	if (!cell || cell == maze->start_cell || cell == maze->end_cell ||
+	    g_list_find(maze->exits, cell))
+		return -1;
 
-exit:
-	g_list_free(stack);
+	maze_edit(maze, MAZE_DELTA_ADD_EXIT, 0, NULL, cell);
 
-	return err;
+	return 0;
 }
 
-/**
- * procedure BFS(G, root) is
- * let Q be a queue
- *     label root as discovered
- *     Q.enqueue(root)
- *     while Q is not empty do
- *         v := Q.dequeue()
- *         if v is the goal then
- *             return v
- *         for all edges from v to w in G.adjacentEdges(v) do
- *             if w is not labeled as discovered then
- *                 label w as discovered
- *                 Q.enqueue(w)
- */
-int maze_solve_bfs(struct Maze *maze)
+int maze_remove_exit(struct Maze *maze, int level, int row, int col)
 {
-	GQueue *queue = NULL;
 	struct Cell *cell;
-	struct Cell *n_cell;
-	int i;
-	int err = 0;
 
-	queue = g_queue_new();
-	maze->start_cell->value = 1;
-	g_queue_push_tail(queue, maze->start_cell);
+	maze_expand(maze);
 
-	while (!g_queue_is_empty(queue)) {
-		if (maze->solver_status == CANCELED) {
-			err = -1;
+	if (maze->solver_status == RUNNING)
+		return -1;
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell || !g_list_find(maze->exits, cell))
+		return -1;
+
+	maze_edit(maze, MAZE_DELTA_REMOVE_EXIT, 0, NULL, cell);
+
+	return 0;
+}
+
+int maze_get_num_exits(struct Maze *maze)
+{
+	if (maze->compact)
+		return maze->compact->num_exits + 1;
+
+	return g_list_length(maze->exits) + 1;
+}
+
+int maze_set_start_cell(struct Maze *maze, int level, int row, int col)
+{
+	return maze_move_endpoint(maze, MAZE_DELTA_START, level, row, col);
+}
+
+static int maze_get_endpoint(struct Maze *maze, gboolean start,
+			     struct MazePos *pos)
+{
+	struct Cell *cell;
+	int index;
+
+	if (maze->compact) {
+		index = start ? maze->compact->start : maze->compact->end;
+		pos->col = index % maze->num_cols;
+		pos->row = index / maze->num_cols % maze->num_rows;
+		pos->level = index / (maze->num_cols * maze->num_rows);
+		return 0;
+	}
+
+	cell = start ? maze->start_cell : maze->end_cell;
+	if (!cell)
+		return -1;
+
+	pos->level = cell->level;
+	pos->row = cell->row;
+	pos->col = cell->col;
+
+	return 0;
+}
+
+int maze_get_start_cell(struct Maze *maze, struct MazePos *pos)
+{
+	return maze_get_endpoint(maze, TRUE, pos);
+}
+
+int maze_get_end_cell(struct Maze *maze, struct MazePos *pos)
+{
+	return maze_get_endpoint(maze, FALSE, pos);
+}
+
+/*
+ * Carve or fill an inner cell. The perimeter, the stairs and the endpoints
+ * can't be edited.
+ */
+int maze_set_wall(struct Maze *maze, int level, int row, int col,
+		  gboolean wall)
+{
+	struct Cell *cell;
+
+	maze_expand(maze);
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell || maze_cell_is_perimeter(maze, cell) || cell->stairs ||
+	    cell->type == CELL_TYPE_START || cell->type == CELL_TYPE_END)
+		return -1;
+
+	if ((cell->type == CELL_TYPE_WALL) == !!wall)
+		return 0;
+
+	maze_edit(maze, MAZE_DELTA_WALL, wall ? MAZE_DELTA_FLAG_WALL : 0,
+		  NULL, cell);
+
+	return 0;
+}
+
+/* Revert the last journaled edit, in O(cells it changed) */
+int maze_undo(struct Maze *maze)
+{
+	struct MazeDelta *delta;
+
+	maze_expand(maze);
+
+	if (maze->solver_status == RUNNING || maze->generating ||
+	    !maze->journal_pos)
+		return -1;
+
+	do {
+		delta = &g_array_index(maze->journal, struct MazeDelta,
+				       --maze->journal_pos);
+		maze_delta_apply(maze, delta, TRUE);
+	} while (maze->journal_pos && (delta->flags & MAZE_DELTA_FLAG_CHAINED));
+
+	return 0;
+}
+
+int maze_redo(struct Maze *maze)
+{
+	struct MazeDelta *delta;
+
+	maze_expand(maze);
+
+	if (maze->solver_status == RUNNING || maze->generating ||
+	    !maze->journal || maze->journal_pos >= maze->journal->len)
+		return -1;
+
+	do {
+		delta = &g_array_index(maze->journal, struct MazeDelta,
+				       maze->journal_pos++);
+		maze_delta_apply(maze, delta, FALSE);
+	} while (maze->journal_pos < maze->journal->len &&
+		 (g_array_index(maze->journal, struct MazeDelta,
+				maze->journal_pos).flags &
+		  MAZE_DELTA_FLAG_CHAINED));
+
+	return 0;
+}
+
+gboolean maze_solver_running(struct Maze *maze)
+{
+	return (maze->solver_status == RUNNING);
+}
+
+void maze_set_anim_speed(struct Maze *maze, uint speed)
+{
+	maze->anim_speed = (speed < 100) ? speed : 100;
+}
+
+uint maze_get_anim_speed(struct Maze *maze)
+{
+	return maze->anim_speed;
+}
+
+int maze_get_num_levels(struct Maze *maze)
+{
+	return maze->num_levels;
+}
+
+int maze_get_num_rows(struct Maze *maze)
+{
+	return maze->num_rows;
+}
+
+int maze_get_num_cols(struct Maze *maze)
+{
+	return maze->num_cols;
+}
+
+gboolean maze_get_difficult(struct Maze *maze)
+{
+	return maze->complex;
+}
+
+int maze_get_path_length(struct Maze *maze)
+{
+	return maze->path_len;
+}
+
+int maze_get_path_cost(struct Maze *maze)
+{
+	return maze->path_cost;
+}
+
+/*
+ * The terrain of the current maze is clamped to the new limit, or dropped
+ * without terrain, the cost buckets of the solvers are sized after it.
+ * Like a wall edit, that unshares the snapshot pages and the distance
+ * field it changes.
+ */
+void maze_set_max_cost(struct Maze *maze, uint max_cost)
+{
+	gboolean changed = FALSE;
+	guint8 limit;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return;
+
+	maze->max_cost = (max_cost < MAZE_MAX_COST) ? max_cost : MAZE_MAX_COST;
+
+	if (!maze->costs)
+		return;
+
+	if (maze->max_cost <= 1) {
+		maze->costs = NULL;
+		for (i = 0; i < maze->num_pages; i++)
+			maze->page_dirty[i] = 1;
+		maze->layout_version++;
+		return;
+	}
+
+	limit = maze->max_cost;
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		if (maze->costs[i] <= limit)
+			continue;
+
+		maze->costs[i] = limit;
+		if (maze->page_dirty)
+			maze->page_dirty[i >> MAZE_PAGE_SHIFT] = 1;
+		changed = TRUE;
+	}
+
+	if (changed)
+		maze->layout_version++;
+}
+
+uint maze_get_max_cost(struct Maze *maze)
+{
+	return maze->max_cost;
+}
+
+float maze_get_solve_time(struct Maze *maze)
+{
+	return (float)maze->solve_time / G_USEC_PER_SEC;
+}
+
+/*
+ * Safe to call from another thread while the solver runs. Only the
+ * interactive solvers publish progress, headless ones report zeros until
+ * they finish.
+ */
+void maze_get_solver_stats(struct Maze *maze, struct MazeSolverStats *stats)
+{
+	/* Headless solvers only count their expansions once done */
+	if (maze->solver_status == RUNNING)
+		stats->expanded = g_atomic_int_get(&maze->changes) -
+				  maze->changes_start;
+	else
+		stats->expanded = maze->num_expanded;
+	stats->frontier = g_atomic_int_get(&maze->frontier);
+
+	if (maze->solver_status == RUNNING)
+		stats->elapsed = (float)(g_get_monotonic_time() -
+					 maze->solve_start) / G_USEC_PER_SEC;
+	else
+		stats->elapsed = maze_get_solve_time(maze);
+}
+
+SolverAlgorithm maze_get_solver_algorithm(struct Maze *maze)
+{
+	return maze->solver_algorithm;
+}
+
+void maze_set_solver_algorithm(struct Maze *maze, SolverAlgorithm algo)
+{
+	maze->solver_algorithm = algo;
+}
+
+void maze_set_generator(struct Maze *maze, MazeGenerator generator)
+{
+	maze->generator = generator;
+}
+
+MazeGenerator maze_get_generator(struct Maze *maze)
+{
+	return maze->generator;
+}
+
+void maze_set_num_threads(struct Maze *maze, int num_threads)
+{
+	maze->num_threads = MAX(num_threads, 0);
+}
+
+int maze_get_num_threads(struct Maze *maze)
+{
+	return maze->num_threads;
+}
+
+void maze_set_pin_threads(struct Maze *maze, gboolean pin)
+{
+	maze->pin_threads = pin;
+}
+
+MazeTopology maze_get_topology(struct Maze *maze)
+{
+	return maze->topology;
+}
+
+void maze_set_topology(struct Maze *maze, MazeTopology topology)
+{
+	if (maze->solver_status == RUNNING || topology >= TOPOLOGY_NUM)
+		return;
+
+	maze->topology = topology;
+}
+
+static void _maze_clear_board(struct Maze *maze)
+{
+	struct Cell *cell;
+	int i;
+
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+
+		cell->value = 0;
+		cell->heuristic = 0;
+		cell->parent = NULL;
+		if (cell->type != CELL_TYPE_WALL)
+			cell->type = CELL_TYPE_EMPTY;
+	}
+
+	maze_mark_endpoints(maze);
+}
+
+void maze_clear_board(struct Maze *maze)
+{
+	if (maze->solver_status == RUNNING || maze->generating)
+		return;
+
+	maze_expand(maze);
+
+	_maze_clear_board(maze);
+}
+
+static inline void maze_anim_delay(struct Maze *maze)
+{
+	g_atomic_int_inc(&maze->changes);
+
+	if (maze->anim_speed < 100 && !maze->async)
+		g_usleep((100 - maze->anim_speed) * (100 - maze->anim_speed));
+}
+
+/* Expansions between two looks at the clock and the frontier size */
+#define MAZE_LIMIT_INTERVAL 4096
+
+static void maze_solver_next_limit_check(struct Maze *maze)
+{
+	struct MazeSolveLimits *limits = &maze->limits;
+
+	maze->limit_check = G_MAXINT;
+	if (limits->max_time || limits->max_memory || maze->async_interval)
+		maze->limit_check = maze->num_expanded + MAZE_LIMIT_INTERVAL;
+	if (limits->max_expanded)
+		maze->limit_check = MIN(maze->limit_check, limits->max_expanded);
+}
+
+/* Make the async fd readable */
+static void maze_async_notify(struct Maze *maze)
+{
+#ifdef __linux__
+	guint64 one = 1;
+#else
+	char one = 1;
+#endif
+
+	/* A full pipe or counter is already readable */
+	if (write(maze->async_fd[1], &one, sizeof(one)) < 0)
+		return;
+}
+
+/* Stop the solver with LIMITED status if it went over budget */
+static int maze_solver_check_limits(struct Maze *maze, int frontier)
+{
+	struct MazeSolveLimits *limits = &maze->limits;
+	gint64 now;
+
+	maze_solver_next_limit_check(maze);
+
+	if (maze->async_interval) {
+		now = g_get_monotonic_time();
+		if (now - maze->async_progress >= maze->async_interval) {
+			maze->async_progress = now;
+			maze_async_notify(maze);
+		}
+	}
+
+	if ((limits->max_expanded &&
+	     maze->num_expanded >= limits->max_expanded) ||
+	    (limits->max_time &&
+	     g_get_monotonic_time() - maze->solve_start >= limits->max_time) ||
+	    (limits->max_memory &&
+	     (gsize)frontier * maze->frontier_entry > limits->max_memory)) {
+		maze->solver_status = LIMITED;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Called once per expanded cell with the number of cells waiting to be
+ * expanded. Returns -1 when the solver was canceled or went over its
+ * limits. Headless solvers are never canceled, animated nor watched, so
+ * only the limits are left.
+ */
+MAZE_ALWAYS_INLINE int maze_solver_checkpoint(struct Maze *maze,
+					      const gboolean interactive,
+					      int frontier)
+{
+	if (G_UNLIKELY(maze->num_expanded >= maze->limit_check) &&
+	    maze_solver_check_limits(maze, frontier))
+		return -1;
+
+	maze->num_expanded++;
+
+	if (!interactive)
+		return 0;
+
+	if (maze->solver_status == CANCELED)
+		return -1;
+
+	g_atomic_int_set(&maze->frontier, frontier);
+
+	maze_anim_delay(maze);
+
+	return 0;
+}
+
+MAZE_ALWAYS_INLINE int maze_solve_a_star_tmpl(struct Maze *maze,
+					      const MazeTopology topology,
+					      const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	struct Cell *path;
+	GList *open = NULL;
+	GList *elem;
+	int open_len;
+	int num_neighbours;
+	int i;
+	int err = 0;
+	struct Cell *board_cell;
+	struct Cell *cur_cell;
+
+	cell = cell_new(maze->start_cell->level, maze->start_cell->row,
+			maze->start_cell->col);
+	cell->value = 1;
+	cell->heuristic = maze_topology_distance(maze, topology, cell,
+						 maze->end_cell);
+
+	open = g_list_append(open, cell);
+	open_len = 1;
+
+	while (open != NULL) {
+		if (maze_solver_checkpoint(maze, interactive, open_len)) {
+			err = -1;
 			goto exit;
 		}
 
-		maze_anim_delay(maze);
+		elem = g_list_first(open);
+		cell = (struct Cell *)elem->data;
+		open = g_list_delete_link(open, elem);
+		open_len--;
+
+		cur_cell = maze_get_cell(maze, cell->level, cell->row, cell->col);
+		cur_cell->type = CELL_TYPE_PATH_VISITED;
+
+		/* Put the cell in the closed list */
+		cur_cell->value = 1;
+
+		if (!cell_cmp(cell, maze->end_cell))
+			break;
+
+		num_neighbours = maze_topology_neighbours(maze, topology,
+							  cur_cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			struct Cell *n_cell;
+
+			board_cell = neighbours[i];
+			/*
+			 * n_cell->value != 0 means the cell is in the closed
+			 * list and can be skipped
+			 */
+			if (board_cell->value)
+				continue;
+
+			n_cell = cell_new(board_cell->level, board_cell->row,
+					  board_cell->col);
+			n_cell->parent = cell;
+			n_cell->value = cell->value + 1;
+			n_cell->heuristic = n_cell->value +
+					  maze_topology_distance(maze, topology,
+								 n_cell,
+								 maze->end_cell);
+
+			/* Lookup in open for same cell with a lower value */
+			if (!g_list_find_custom(open, n_cell,
+					  (GCompareFunc)cell_cmp_lower_value)) {
+				open = g_list_insert_sorted(open, n_cell,
+					      (GCompareFunc)cell_cmp_heuristic);
+				open_len++;
+
+				board_cell = maze_get_cell(maze,
+							   n_cell->level,
+							   n_cell->row,
+							   n_cell->col);
+				board_cell->type = CELL_TYPE_PATH_HEAD;
+			} else {
+				g_free(n_cell);
+			}
+		}
+	}
+
+	maze->path_len = 0;
+	maze->path_cost = 0;
+
+	while (cell) {
+		path = maze_get_cell(maze, cell->level, cell->row, cell->col);
+		path->type = CELL_TYPE_PATH_SOLUTION;
+		maze->path_len++;
+		if (cell->parent)
+			maze->path_cost += maze_cell_cost(maze, path);
+
+		cell = cell->parent;
+	}
+
+	maze_mark_endpoints(maze);
+
+exit:
+	g_list_free_full(open, (GDestroyNotify)g_free);
+
+	return err;
+}
+
+MAZE_SOLVER_INSTANTIATE(maze_solve_a_star);
+
+static void maze_set_solution_path(struct Maze *maze)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	struct Cell *n_cell;
+	struct Cell *t_cell;
+	int num_neighbours;
+	int i;
+
+	cell = maze->end_cell;
+	maze->path_len = 1;
+	maze->path_cost = 0;
+
+	/* Light up the shortest path */
+	while (cell != maze->start_cell) {
+		if (maze->solver_status == CANCELED)
+			return;
+
+		maze->path_len++;
+		maze->path_cost += maze_cell_cost(maze, cell);
+		cell->type = CELL_TYPE_PATH_SOLUTION;
+		t_cell = cell;
+
+		/* Search for a neighbours with the lowest value */
+		num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+
+			if (n_cell->value && n_cell->value < t_cell->value)
+				t_cell = n_cell;
+		}
+
+		/* Return if didn't find any cell with a lower value */
+		if (cell == t_cell)
+			return;
+
+		cell = t_cell;
+	}
+
+	maze_mark_endpoints(maze);
+}
+
+MAZE_ALWAYS_INLINE int maze_solve_always_turn_tmpl(struct Maze *maze,
+						   const gboolean interactive)
+{
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int i;
+	Direction dir;
+	int dir_offset;
+	int err = 0;
+	int value;
+
+	dir = DIR_FIRST;
+	dir_offset = maze->solver_algorithm == SOLVER_ALWAYS_TURN_RIGHT ? 1 : -1;
+
+	cell = maze->start_cell;
+	value = 1;
+
+	while (cell != maze->end_cell) {
+		if (maze_solver_checkpoint(maze, interactive, 1)) {
+			err = -1;
+			goto exit;
+		}
+
+		cell->value = value++;
+
+		/* First look left or right. Walls are followed within a level */
+		dir = (dir + dir_offset) % DIR_NUM_PLANAR_DIRS;
+		for (i = 0; i < DIR_NUM_PLANAR_DIRS; i++) {
+			n_cell = maze_get_neighbour_cell(maze, cell, dir);
+			if (!n_cell || n_cell->type == CELL_TYPE_WALL) {
+				dir = (dir - dir_offset) % DIR_NUM_PLANAR_DIRS;
+				continue;
+			}
+
+			/* Not a wall. Go on */
+			cell->type = CELL_TYPE_PATH_VISITED;
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			cell = n_cell;
+			break;
+		}
+
+		if (!cell_cmp(cell, maze->start_cell)) {
+			// Infinite loop
+			maze->solver_status = UNSOLVABLE;
+			err = -1;
+			goto exit;
+		}
+	}
+
+	/* Last cell */
+	cell->value = value++;
+
+	maze_set_solution_path(maze);
+
+exit:
+	return err;
+}
+
+/* Wall followers only move on the square grid, whatever the topology */
+static int maze_solve_always_turn(struct Maze *maze)
+{
+	return maze_solve_always_turn_tmpl(maze, TRUE);
+}
+
+static int maze_solve_always_turn_headless(struct Maze *maze)
+{
+	return maze_solve_always_turn_tmpl(maze, FALSE);
+}
+
+/**
+ * procedure DFS_iterative(G, v) is
+ *    let S be a stack
+ *    S.push(v)
+ *    while S is not empty do
+ *        v = S.pop()
+ *        if v is not labeled as discovered then
+ *            label v as discovered
+ *            for all edges from v to w in G.adjacentEdges(v) do
+ *                S.push(w)
+ */
+MAZE_ALWAYS_INLINE int maze_solve_dfs_tmpl(struct Maze *maze,
+					   const MazeTopology topology,
+					   const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	GList *stack = NULL;
+	GList *elem;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int stack_len;
+	int num_neighbours;
+	int i;
+	int err = 0;
+
+	stack = g_list_prepend(stack, maze->start_cell);
+	stack_len = 1;
+
+	while (stack != NULL) {
+		if (maze_solver_checkpoint(maze, interactive, stack_len)) {
+			err = -1;
+			goto exit;
+		}
+
+		elem = g_list_first(stack);
+		cell = elem->data;
+		stack = g_list_delete_link(stack, elem);
+		stack_len--;
+
+		cell->value = cell->parent ? cell->parent->value + 1 : 1;
+		cell->type = CELL_TYPE_PATH_VISITED;
+
+		if (cell == maze->end_cell)
+			break;
+
+		num_neighbours = maze_topology_neighbours(maze, topology, cell,
+							  neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (n_cell->value)
+				continue;
+
+			n_cell->parent = cell;
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			stack = g_list_prepend(stack, n_cell);
+			stack_len++;
+		}
+	}
+
+	maze_set_solution_path(maze);
+
+exit:
+	g_list_free(stack);
+
+	return err;
+}
+
+MAZE_SOLVER_INSTANTIATE(maze_solve_dfs);
+
+/**
+ * procedure BFS(G, root) is
+ * let Q be a queue
+ *     label root as discovered
+ *     Q.enqueue(root)
+ *     while Q is not empty do
+ *         v := Q.dequeue()
+ *         if v is the goal then
+ *             return v
+ *         for all edges from v to w in G.adjacentEdges(v) do
+ *             if w is not labeled as discovered then
+ *                 label w as discovered
+ *                 Q.enqueue(w)
+ */
+MAZE_ALWAYS_INLINE int maze_solve_bfs_tmpl(struct Maze *maze,
+					   const MazeTopology topology,
+					   const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell **queue;
+	int head = 0;
+	int tail = 0;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int num_neighbours;
+	int i;
+	int err = 0;
+
+	/* A cell is queued at most once, the board sized list never wraps */
+	queue = maze_get_work_list(maze);
+	maze->start_cell->value = 1;
+	queue[tail++] = maze->start_cell;
+
+	while (head < tail) {
+		if (maze_solver_checkpoint(maze, interactive, tail - head)) {
+			err = -1;
+			goto exit;
+		}
+
+		cell = queue[head++];
+
+		if (cell == maze->end_cell)
+			break;
+
+		cell->type = CELL_TYPE_PATH_VISITED;
+
+		num_neighbours = maze_topology_neighbours(maze, topology, cell,
+							  neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (n_cell->value)
+				continue;
+
+			n_cell->value = cell->value + 1;
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			queue[tail++] = n_cell;
+		}
+	}
+
+	maze_set_solution_path(maze);
+
+exit:
+	return err;
+}
+
+MAZE_SOLVER_INSTANTIATE(maze_solve_bfs);
+
+/*
+ * Walk down the distance field from the start cell to the nearest exit,
+ * which is the reverse of what maze_set_solution_path() does.
+ */
+static void maze_set_exit_path(struct Maze *maze)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	struct Cell *n_cell;
+	struct Cell *t_cell;
+	int num_neighbours;
+	int i;
+
+	cell = maze->start_cell;
+	maze->path_len = 1;
+	maze->path_cost = 0;
+
+	while (cell->value > 1) {
+		if (maze->solver_status == CANCELED)
+			return;
+
+		t_cell = cell;
+
+		num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+
+			if (n_cell->value && n_cell->value < t_cell->value)
+				t_cell = n_cell;
+		}
+
+		if (cell == t_cell)
+			return;
+
+		cell = t_cell;
+		cell->type = CELL_TYPE_PATH_SOLUTION;
+		maze->path_len++;
+		maze->path_cost += maze_cell_cost(maze, cell);
+	}
+
+	maze_mark_endpoints(maze);
+}
+
+/**
+ * Multi-source BFS seeded with every exit at distance 0. A single pass
+ * labels each reachable cell with the distance to its nearest exit, so
+ * the search does not stop at the start cell.
+ */
+MAZE_ALWAYS_INLINE int maze_solve_nearest_exit_tmpl(struct Maze *maze,
+						    const MazeTopology topology,
+						    const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell **queue;
+	int head = 0;
+	int tail = 0;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	GList *elem;
+	int num_neighbours;
+	int i;
+	int err = 0;
+
+	queue = maze_get_work_list(maze);
+
+	maze->end_cell->value = 1;
+	queue[tail++] = maze->end_cell;
+	for (elem = maze->exits; elem; elem = elem->next) {
+		cell = elem->data;
+		cell->value = 1;
+		queue[tail++] = cell;
+	}
+
+	while (head < tail) {
+		if (maze_solver_checkpoint(maze, interactive, tail - head)) {
+			err = -1;
+			goto exit;
+		}
+
+		cell = queue[head++];
+		cell->type = CELL_TYPE_PATH_VISITED;
+
+		num_neighbours = maze_topology_neighbours(maze, topology, cell,
+							  neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (n_cell->value)
+				continue;
+
+			n_cell->value = cell->value + 1;
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			queue[tail++] = n_cell;
+		}
+	}
+
+	maze_set_exit_path(maze);
+
+exit:
+	return err;
+}
+
+MAZE_SOLVER_INSTANTIATE(maze_solve_nearest_exit);
+
+int maze_get_exit_distance(struct Maze *maze, int level, int row, int col)
+{
+	struct Cell *cell;
+
+	if (maze->solver_algorithm != SOLVER_NEAREST_EXIT ||
+	    maze->solver_status != SOLVED)
+		return -1;
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell || !cell->value)
+		return -1;
+
+	return cell->value - 1;
+}
+
+/*
+ * Monotone bucket queue (Dial's algorithm). Costs are small integers, so
+ * every key waiting in the queue lies within [cur, cur + num_buckets) and a
+ * circular array of FIFO buckets replaces a binary heap: push is O(1) and
+ * pop only scans forward over empty buckets.
+ */
+struct BucketQueue {
+	GQueue *buckets;
+	int num_buckets;
+	int cur;
+	int size;
+};
+
+static void bucket_queue_init(struct BucketQueue *bq, int num_buckets,
+			      int min_key)
+{
+	int i;
+
+	bq->buckets = g_new(GQueue, num_buckets);
+	for (i = 0; i < num_buckets; i++)
+		g_queue_init(&bq->buckets[i]);
+
+	bq->num_buckets = num_buckets;
+	bq->cur = min_key;
+	bq->size = 0;
+}
+
+static void bucket_queue_clear(struct BucketQueue *bq)
+{
+	int i;
+
+	for (i = 0; i < bq->num_buckets; i++)
+		g_queue_clear(&bq->buckets[i]);
+
+	g_free(bq->buckets);
+	bq->buckets = NULL;
+}
+
+static void bucket_queue_push(struct BucketQueue *bq, gpointer data, int key)
+{
+	g_queue_push_tail(&bq->buckets[key % bq->num_buckets], data);
+	bq->size++;
+}
+
+static gpointer bucket_queue_pop(struct BucketQueue *bq, int *key)
+{
+	GQueue *bucket;
+
+	if (!bq->size)
+		return NULL;
+
+	while (1) {
+		bucket = &bq->buckets[bq->cur % bq->num_buckets];
+		if (!g_queue_is_empty(bucket))
+			break;
+
+		bq->cur++;
+	}
+
+	bq->size--;
+	*key = bq->cur;
+
+	return g_queue_pop_head(bucket);
+}
+
+/* Empty bq to be used again with num_buckets, growing it if needed */
+static void bucket_queue_reset(struct BucketQueue *bq, int num_buckets,
+			       int min_key)
+{
+	int key;
+
+	if (num_buckets > bq->num_buckets) {
+		bucket_queue_clear(bq);
+		bucket_queue_init(bq, num_buckets, min_key);
+		return;
+	}
+
+	/* Only scans the keys still queued, not the whole ring */
+	while (bucket_queue_pop(bq, &key))
+		;
+
+	bq->cur = min_key;
+}
+
+static int maze_get_min_cost(struct Maze *maze)
+{
+	int min_cost = MAZE_MAX_COST;
+	int i;
+
+	if (!maze->costs)
+		return 1;
+
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		if (maze->board[i].type != CELL_TYPE_WALL &&
+		    maze->costs[i] < min_cost)
+			min_cost = maze->costs[i];
+	}
+
+	return min_cost;
+}
+
+/**
+ * Dijkstra over the cost plane. The weighted A* variant orders the queue
+ * by g + h where h is the Manhattan distance scaled by the cheapest cell
+ * cost, which never overestimates a single move and keeps h consistent.
+ * Both key sequences are monotone, so the bucket queue applies to both.
+ *
+ * cell->value holds the best known cost + 1 (0 means unreached) and
+ * cell->heuristic the key the cell was last queued with, which lets stale
+ * queue entries be skipped instead of decreasing keys in place.
+ */
+MAZE_ALWAYS_INLINE int maze_solve_dijkstra_tmpl(struct Maze *maze,
+						const MazeTopology topology,
+						const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct BucketQueue bq;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int num_neighbours;
+	int h_scale;
+	int value;
+	int key;
+	int i;
+	int err = 0;
+
+	h_scale = 0;
+	if (maze->solver_algorithm == SOLVER_WEIGHTED_A_STAR)
+		h_scale = maze_get_min_cost(maze);
+
+	cell = maze->start_cell;
+	cell->value = 1;
+	cell->heuristic = h_scale * maze_topology_distance(maze, topology, cell,
+							   maze->end_cell);
+
+	/* A key can grow by at most one cell cost plus one heuristic step */
+	bucket_queue_init(&bq, (maze->costs ? maze->max_cost : 1) * 2 + 1,
+			  cell->heuristic);
+	bucket_queue_push(&bq, cell, cell->heuristic);
+
+	while ((cell = bucket_queue_pop(&bq, &key)) != NULL) {
+		/* Stale entry: the cell was settled or re-queued cheaper */
+		if (cell->type == CELL_TYPE_PATH_VISITED ||
+		    cell->heuristic != key)
+			continue;
+
+		if (maze_solver_checkpoint(maze, interactive, bq.size)) {
+			err = -1;
+			goto exit;
+		}
+
+		if (cell == maze->end_cell)
+			break;
+
+		cell->type = CELL_TYPE_PATH_VISITED;
+
+		num_neighbours = maze_topology_neighbours(maze, topology, cell,
+							  neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (n_cell->type == CELL_TYPE_PATH_VISITED)
+				continue;
+
+			value = cell->value + maze_cell_cost(maze, n_cell);
+			if (n_cell->value && n_cell->value <= value)
+				continue;
+
+			n_cell->value = value;
+			n_cell->heuristic = value - 1 + h_scale *
+					    maze_topology_distance(maze, topology,
+								   n_cell,
+								   maze->end_cell);
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			bucket_queue_push(&bq, n_cell, n_cell->heuristic);
+		}
+	}
+
+	maze_set_solution_path(maze);
+
+exit:
+	bucket_queue_clear(&bq);
+
+	return err;
+}
+
+MAZE_SOLVER_INSTANTIATE(maze_solve_dijkstra);
+
+/*
+ * Cost of the cheapest path from every cell to the end cell, found by
+ * searching backwards from it. Moves are symmetric, so going from a cell
+ * to its neighbour n costs cost(n) both ways and a Dijkstra rooted at the
+ * end cell relaxes dist[n] = dist[cell] + cost(cell). Without terrain
+ * that's a plain BFS.
+ */
+static void maze_update_goal_dist(struct Maze *maze)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct BucketQueue bq;
+	struct Cell **queue;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	guint32 *dist;
+	guint32 value;
+	int num_neighbours;
+	int head = 0;
+	int tail = 0;
+	int key;
+	int i;
+
+	if (maze->goal_cell == maze->end_cell &&
+	    maze->goal_version == maze->layout_version)
+		return;
+
+	if (maze->goal_dist_size < maze_num_cells(maze)) {
+		g_free(maze->goal_dist);
+		maze->goal_dist_size = maze_num_cells(maze);
+		maze->goal_dist = g_new(guint32, maze->goal_dist_size);
+	}
+
+	dist = maze->goal_dist;
+	memset(dist, 0xff, maze_num_cells(maze) * sizeof(guint32));
+	dist[maze->end_cell - maze->board] = 0;
+
+	if (!maze->costs) {
+		queue = maze_get_work_list(maze);
+		queue[tail++] = maze->end_cell;
+
+		while (head < tail) {
+			cell = queue[head++];
+			value = dist[cell - maze->board] + 1;
+
+			num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+			for (i = 0; i < num_neighbours; i++) {
+				n_cell = neighbours[i];
+				if (dist[n_cell - maze->board] != G_MAXUINT32)
+					continue;
+
+				dist[n_cell - maze->board] = value;
+				queue[tail++] = n_cell;
+			}
+		}
+	} else {
+		bucket_queue_init(&bq, maze->max_cost + 1, 0);
+		bucket_queue_push(&bq, maze->end_cell, 0);
+
+		while ((cell = bucket_queue_pop(&bq, &key)) != NULL) {
+			/* Stale entry, the cell was re-queued cheaper */
+			if (dist[cell - maze->board] != (guint32)key)
+				continue;
+
+			value = key + maze_cell_cost(maze, cell);
+
+			num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+			for (i = 0; i < num_neighbours; i++) {
+				n_cell = neighbours[i];
+				if (dist[n_cell - maze->board] <= value)
+					continue;
+
+				dist[n_cell - maze->board] = value;
+				bucket_queue_push(&bq, n_cell, value);
+			}
+		}
+
+		bucket_queue_clear(&bq);
+	}
+
+	maze->goal_cell = maze->end_cell;
+	maze->goal_version = maze->layout_version;
+}
+
+/*
+ * Same moves as maze_topology_neighbours() for a compact maze, on cell
+ * indexes and decoding the blocks it touches.
+ */
+static int maze_compact_neighbours(struct Maze *maze, int index,
+				   int *neighbours)
+{
+	const int (*moves)[2];
+	gboolean wrap = maze->topology == TOPOLOGY_TORUS;
+	gboolean diagonal = maze->topology == TOPOLOGY_OCTILE;
+	int num_moves;
+	int level;
+	int row;
+	int col;
+	int n_row;
+	int n_col;
+	int stairs;
+	int num = 0;
+	int i;
+
+	col = index % maze->num_cols;
+	row = index / maze->num_cols % maze->num_rows;
+	level = index / (maze->num_cols * maze->num_rows);
+
+	switch (maze->topology) {
+	case TOPOLOGY_OCTILE:
+		moves = octile_moves;
+		num_moves = 8;
+		break;
+	case TOPOLOGY_HEX:
+		moves = hex_moves[row & 1];
+		num_moves = 6;
+		break;
+	case TOPOLOGY_TORUS:
+	case TOPOLOGY_SQUARE:
+	default:
+		moves = square_moves;
+		num_moves = 4;
+		break;
+	}
+
+	for (i = 0; i < num_moves; i++) {
+		n_row = row + moves[i][0];
+		n_col = col + moves[i][1];
+
+		if (wrap) {
+			n_row = (n_row + maze->num_rows) % maze->num_rows;
+			n_col = (n_col + maze->num_cols) % maze->num_cols;
+		} else if (n_row < 0 || n_row >= maze->num_rows ||
+			   n_col < 0 || n_col >= maze->num_cols) {
+			continue;
+		}
+
+		if (maze_compact_get_type(maze, level, n_row, n_col) == CELL_TYPE_WALL)
+			continue;
+
+		/* No cutting corners, both sides of a diagonal move are open */
+		if (diagonal && moves[i][0] && moves[i][1] &&
+		    (maze_compact_get_type(maze, level, row, n_col) == CELL_TYPE_WALL ||
+		     maze_compact_get_type(maze, level, n_row, col) == CELL_TYPE_WALL))
+			continue;
+
+		neighbours[num++] = maze_compact_cell_index(maze, level, n_row,
+							    n_col);
+	}
+
+	stairs = maze_compact_get_stairs(maze, level, row, col);
+	if (stairs & CELL_STAIRS_UP)
+		neighbours[num++] = index + maze->strides[DIR_ABOVE];
+	if (stairs & CELL_STAIRS_DOWN)
+		neighbours[num++] = index + maze->strides[DIR_BELOW];
+
+	return num;
+}
+
+static int maze_compact_cost(struct Maze *maze, int index)
+{
+	if (!maze->costs)
+		return 1;
+
+	return maze->costs[index];
+}
+
+/*
+ * maze_update_goal_dist() for a compact maze. goal_dist was dropped with
+ * the cells, so it's valid again once rebuilt at the current layout_version.
+ * Concurrent callers get the same field, built once under dist_lock.
+ */
+static guint32 *maze_compact_update_goal_dist(struct Maze *maze)
+{
+	struct CompactBoard *cb = maze->compact;
+	int neighbours[MAZE_MAX_NEIGHBOURS];
+	struct BucketQueue bq;
+	guint32 *queue;
+	guint32 *dist;
+	guint32 value;
+	int num_neighbours;
+	int num_cells = maze_num_cells(maze);
+	int head = 0;
+	int tail = 0;
+	int index;
+	int key;
+	int i;
+
+	g_mutex_lock(&cb->dist_lock);
+
+	if (maze->goal_dist && maze->goal_version == maze->layout_version) {
+		dist = maze->goal_dist;
+		goto exit;
+	}
+
+	dist = g_new(guint32, num_cells);
+	memset(dist, 0xff, num_cells * sizeof(guint32));
+	dist[cb->end] = 0;
+
+	if (!maze->costs) {
+		queue = g_new(guint32, num_cells);
+		queue[tail++] = cb->end;
+
+		while (head < tail) {
+			index = queue[head++];
+			value = dist[index] + 1;
+
+			num_neighbours = maze_compact_neighbours(maze, index,
+								 neighbours);
+			for (i = 0; i < num_neighbours; i++) {
+				if (dist[neighbours[i]] != G_MAXUINT32)
+					continue;
+
+				dist[neighbours[i]] = value;
+				queue[tail++] = neighbours[i];
+			}
+		}
+
+		g_free(queue);
+	} else {
+		/* Entries are offset by one, a NULL pointer means empty */
+		bucket_queue_init(&bq, maze->max_cost + 1, 0);
+		bucket_queue_push(&bq, GINT_TO_POINTER(cb->end + 1), 0);
+
+		while (bq.size) {
+			index = GPOINTER_TO_INT(bucket_queue_pop(&bq, &key)) - 1;
+			/* Stale entry, the cell was re-queued cheaper */
+			if (dist[index] != (guint32)key)
+				continue;
+
+			value = key + maze_compact_cost(maze, index);
+
+			num_neighbours = maze_compact_neighbours(maze, index,
+								 neighbours);
+			for (i = 0; i < num_neighbours; i++) {
+				if (dist[neighbours[i]] <= value)
+					continue;
+
+				dist[neighbours[i]] = value;
+				bucket_queue_push(&bq,
+						  GINT_TO_POINTER(neighbours[i] + 1),
+						  value);
+			}
+		}
+
+		bucket_queue_clear(&bq);
+	}
+
+	g_free(maze->goal_dist);
+	maze->goal_dist = dist;
+	maze->goal_dist_size = num_cells;
+	maze->goal_version = maze->layout_version;
+
+exit:
+	g_mutex_unlock(&cb->dist_lock);
+
+	return dist;
+}
+
+/*
+ * A compact maze stays compact while hovering paths in the GUI, only the
+ * distance field is kept next to the compressed blocks.
+ */
+static int maze_compact_path_to_end(struct Maze *maze, int level, int row,
+				    int col, struct MazePos *path, int max_len)
+{
+	struct CompactBoard *cb = maze->compact;
+	int neighbours[MAZE_MAX_NEIGHBOURS];
+	guint32 *dist;
+	guint32 best;
+	guint32 value;
+	int num_neighbours;
+	int index;
+	int next;
+	int len = 0;
+	int i;
+
+	index = maze_compact_cell_index(maze, level, row, col);
+	if (index < 0 ||
+	    maze_compact_get_type(maze, level, row, col) == CELL_TYPE_WALL)
+		return -1;
+
+	dist = maze_compact_update_goal_dist(maze);
+
+	if (dist[index] == G_MAXUINT32)
+		return -1;
+
+	/* Walk down the distance field, each step lands on a cheapest path */
+	while (len < max_len) {
+		path[len].col = index % maze->num_cols;
+		path[len].row = index / maze->num_cols % maze->num_rows;
+		path[len].level = index / (maze->num_cols * maze->num_rows);
+		len++;
+
+		if (index == cb->end)
+			break;
+
+		next = -1;
+		best = G_MAXUINT32;
+		num_neighbours = maze_compact_neighbours(maze, index,
+							 neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			if (dist[neighbours[i]] == G_MAXUINT32)
+				continue;
+
+			value = dist[neighbours[i]] +
+				maze_compact_cost(maze, neighbours[i]);
+			if (value < best) {
+				best = value;
+				next = neighbours[i];
+			}
+		}
+
+		index = next;
+	}
+
+	return len;
+}
+
+int maze_get_path_to_end(struct Maze *maze, int level, int row, int col,
+			 struct MazePos *path, int max_len)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	struct Cell *n_cell;
+	struct Cell *next;
+	guint32 *dist;
+	guint32 best;
+	guint32 value;
+	int num_neighbours;
+	int len = 0;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	if (maze->compact)
+		return maze_compact_path_to_end(maze, level, row, col, path,
+						max_len);
+
+	if (!maze->end_cell)
+		return -1;
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell || cell->type == CELL_TYPE_WALL)
+		return -1;
+
+	maze_update_goal_dist(maze);
+	dist = maze->goal_dist;
+
+	if (dist[cell - maze->board] == G_MAXUINT32)
+		return -1;
+
+	/* Walk down the distance field, each step lands on a cheapest path */
+	while (len < max_len) {
+		path[len].level = cell->level;
+		path[len].row = cell->row;
+		path[len].col = cell->col;
+		len++;
+
+		if (cell == maze->end_cell)
+			break;
+
+		next = NULL;
+		best = G_MAXUINT32;
+		num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (dist[n_cell - maze->board] == G_MAXUINT32)
+				continue;
+
+			value = dist[n_cell - maze->board] +
+				maze_cell_cost(maze, n_cell);
+			if (value < best) {
+				best = value;
+				next = n_cell;
+			}
+		}
+
+		cell = next;
+	}
+
+	return len;
+}
+
+/*
+ * Cooperative A*
+ *
+ * Agents are planned one after the other with an A* over (cell, time)
+ * states, each agent avoiding the cells and moves reserved by the agents
+ * planned before it. Every move, or a wait in place, takes one time step,
+ * terrain is not accounted. An agent stays at its goal once there.
+ *
+ * The heuristic is the exact distance to the goal ignoring the other
+ * agents, from a BFS rooted at the goal. It's consistent and every step
+ * changes g + h by 0, 1 or 2, so the open list is a bucket queue. All the
+ * ways to a state take the same time, so a state is final as soon as it
+ * is first reached.
+ */
+
+/*
+ * Open addressing hash table of (cell, time) keys, with linear probing.
+ * Keys store time + 1 in their high half so 0 marks an empty slot. Grown
+ * at half load.
+ */
+struct SpaceTimeTable {
+	guint64 *keys;
+	gint32 *values;
+	guint32 mask;
+	guint32 num_keys;
+};
+
+#define SPACE_TIME_MIN_SIZE 1024
+
+static inline guint64 space_time_key(int cell, int time)
+{
+	return (guint64)(time + 1) << 32 | (guint32)cell;
+}
+
+static void space_time_init(struct SpaceTimeTable *st, guint32 size)
+{
+	st->keys = g_new0(guint64, size);
+	st->values = g_new(gint32, size);
+	st->mask = size - 1;
+	st->num_keys = 0;
+}
+
+static void space_time_clear(struct SpaceTimeTable *st)
+{
+	g_free(st->keys);
+	g_free(st->values);
+}
+
+/* Empty the table, shrinking it to what the last use needed */
+static void space_time_reset(struct SpaceTimeTable *st)
+{
+	guint32 size = st->mask + 1;
+
+	while (size > SPACE_TIME_MIN_SIZE && 8 * st->num_keys < size)
+		size /= 2;
+
+	if (size != st->mask + 1) {
+		space_time_clear(st);
+		space_time_init(st, size);
+		return;
+	}
+
+	memset(st->keys, 0, size * sizeof(guint64));
+	st->num_keys = 0;
+}
+
+static inline guint32 space_time_slot(struct SpaceTimeTable *st, guint64 key)
+{
+	guint32 slot;
+
+	/* Fibonacci hashing, the high bits mix both halves of the key */
+	slot = (key * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15)) >> 32;
+	slot &= st->mask;
+
+	while (st->keys[slot] && st->keys[slot] != key)
+		slot = (slot + 1) & st->mask;
+
+	return slot;
+}
+
+/* Value stored for (cell, time), or -1 */
+static inline gint32 space_time_get(struct SpaceTimeTable *st, int cell,
+				    int time)
+{
+	guint32 slot;
+
+	slot = space_time_slot(st, space_time_key(cell, time));
+
+	return st->keys[slot] ? st->values[slot] : -1;
+}
+
+static void space_time_set(struct SpaceTimeTable *st, int cell, int time,
+			   gint32 value);
+
+static void space_time_grow(struct SpaceTimeTable *st)
+{
+	struct SpaceTimeTable old = *st;
+	guint32 i;
+
+	space_time_init(st, (old.mask + 1) * 2);
+
+	for (i = 0; i <= old.mask; i++)
+		if (old.keys[i])
+			space_time_set(st, (guint32)old.keys[i],
+				       (old.keys[i] >> 32) - 1, old.values[i]);
+
+	space_time_clear(&old);
+}
+
+static void space_time_set(struct SpaceTimeTable *st, int cell, int time,
+			   gint32 value)
+{
+	guint64 key = space_time_key(cell, time);
+	guint32 slot;
+
+	if (2 * (st->num_keys + 1) > st->mask + 1)
+		space_time_grow(st);
+
+	slot = space_time_slot(st, key);
+	if (!st->keys[slot]) {
+		st->keys[slot] = key;
+		st->num_keys++;
+	}
+
+	st->values[slot] = value;
+}
+
+struct AgentNode {
+	gint32 cell;
+	gint32 time;
+	gint32 parent;
+};
+
+struct AgentPlanner {
+	struct Maze *maze;
+
+	/* Agent holding (cell, time) */
+	struct SpaceTimeTable reserved;
+
+	/* Keyed at time 0: arrival time of the agent parked on the cell */
+	struct SpaceTimeTable parked;
+
+	/* Keyed at time 0: last time the cell is reserved */
+	struct SpaceTimeTable last;
+
+	/* States reached by the current search, node index as value */
+	struct SpaceTimeTable reached;
+	struct AgentNode *nodes;
+	int num_nodes;
+	int nodes_size;
+
+	/* Distance to the goal of the current agent, G_MAXUINT32 if none */
+	guint32 *dist;
+
+	/*
+	 * Latest time the current agent can be on a cell and still reach its
+	 * goal in time past the parked agents, -1 if none
+	 */
+	gint32 *latest;
+
+	/*
+	 * dist and latest only hold values for the cells whose stamp is the
+	 * generation of the current agent, so moving on to the next agent
+	 * costs nothing for the cells its searches don't reach.
+	 */
+	guint32 *stamp;
+	guint32 generation;
+
+	/* Shared by the searches of every agent */
+	struct BucketQueue bq;
+};
+
+static void agent_planner_next(struct AgentPlanner *ap)
+{
+	/* Stamps can't tell an old generation after a wrap around */
+	if (++ap->generation == 0) {
+		memset(ap->stamp, 0, maze_num_cells(ap->maze) * sizeof(guint32));
+		ap->generation = 1;
+	}
+}
+
+static void agent_planner_touch(struct AgentPlanner *ap, int cell)
+{
+	if (ap->stamp[cell] == ap->generation)
+		return;
+
+	ap->stamp[cell] = ap->generation;
+	ap->dist[cell] = G_MAXUINT32;
+	ap->latest[cell] = -1;
+}
+
+static inline guint32 agent_planner_dist(struct AgentPlanner *ap, int cell)
+{
+	return ap->stamp[cell] == ap->generation ? ap->dist[cell] : G_MAXUINT32;
+}
+
+static inline gint32 agent_planner_latest_at(struct AgentPlanner *ap,
+					     int cell)
+{
+	return ap->stamp[cell] == ap->generation ? ap->latest[cell] : -1;
+}
+
+/*
+ * Fill ap->dist from the goal and return the time limit of the agent at
+ * start, or -1 if it can't reach the goal. Cells further than the limit
+ * are of no use to the search and are left out.
+ */
+static int agent_planner_goal_dist(struct AgentPlanner *ap, struct Cell *goal,
+				   struct Cell *start, int max_delay)
+{
+	struct Maze *maze = ap->maze;
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell **queue;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	guint32 *dist = ap->dist;
+	guint32 max_time = G_MAXUINT32;
+	int num_neighbours;
+	int head = 0;
+	int tail = 0;
+	int i;
+
+	agent_planner_touch(ap, goal - maze->board);
+	dist[goal - maze->board] = 0;
+
+	queue = maze_get_work_list(maze);
+	queue[tail++] = goal;
+
+	while (head < tail) {
+		cell = queue[head++];
+
+		if (cell == start)
+			max_time = dist[cell - maze->board] + max_delay;
+
+		if (dist[cell - maze->board] >= max_time)
+			break;
+
+		num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+			if (agent_planner_dist(ap, n_cell - maze->board) !=
+			    G_MAXUINT32)
+				continue;
+
+			agent_planner_touch(ap, n_cell - maze->board);
+			dist[n_cell - maze->board] = dist[cell - maze->board] + 1;
+			queue[tail++] = n_cell;
+		}
+	}
+
+	return max_time == G_MAXUINT32 ? -1 : (int)max_time;
+}
+
+/*
+ * Fill ap->latest, a cell is left one step before the latest time of the
+ * next one and before the agent parked on it arrives. Reservations along
+ * the way are ignored, so this only bounds the search: states past their
+ * latest time can't lead to the goal, and when the start is past it the
+ * search is not even needed. Keys are max_time - latest, growing as the
+ * cells are settled.
+ */
+static void agent_planner_latest(struct AgentPlanner *ap, struct Cell *goal,
+				 int max_time)
+{
+	struct Maze *maze = ap->maze;
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct BucketQueue *bq = &ap->bq;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	gint32 *latest = ap->latest;
+	gint32 parked;
+	gint32 value;
+	int num_neighbours;
+	int key;
+	int i;
+
+	/* Another agent stays on the goal */
+	if (space_time_get(&ap->parked, goal - maze->board, 0) >= 0)
+		return;
+
+	agent_planner_touch(ap, goal - maze->board);
+	latest[goal - maze->board] = max_time;
+
+	bucket_queue_reset(bq, max_time + 1, 0);
+	bucket_queue_push(bq, goal, 0);
+
+	while ((cell = bucket_queue_pop(bq, &key)) != NULL) {
+		/* Stale entry, the cell was reached later since */
+		if (key != max_time - latest[cell - maze->board])
+			continue;
+
+		num_neighbours = maze_get_neighbours(maze, cell, neighbours);
+		for (i = 0; i < num_neighbours; i++) {
+			n_cell = neighbours[i];
+
+			value = latest[cell - maze->board] - 1;
+			parked = space_time_get(&ap->parked,
+						n_cell - maze->board, 0);
+			if (parked >= 0)
+				value = MIN(value, parked - 1);
+
+			if (value <= agent_planner_latest_at(ap, n_cell - maze->board))
+				continue;
+
+			agent_planner_touch(ap, n_cell - maze->board);
+			latest[n_cell - maze->board] = value;
+			bucket_queue_push(bq, n_cell, max_time - value);
+		}
+	}
+}
+
+/* Can an agent be on cell at time, as far as the planned agents go */
+static gboolean agent_planner_free(struct AgentPlanner *ap, int cell,
+				   int time)
+{
+	gint32 parked;
+
+	if (space_time_get(&ap->reserved, cell, time) >= 0)
+		return FALSE;
+
+	parked = space_time_get(&ap->parked, cell, 0);
+
+	return parked < 0 || time < parked;
+}
+
+static int agent_planner_add_node(struct AgentPlanner *ap, int cell,
+				  int time, int parent)
+{
+	struct AgentNode *node;
+
+	if (ap->num_nodes == ap->nodes_size) {
+		ap->nodes_size *= 2;
+		ap->nodes = g_renew(struct AgentNode, ap->nodes, ap->nodes_size);
+	}
+
+	node = &ap->nodes[ap->num_nodes];
+	node->cell = cell;
+	node->time = time;
+	node->parent = parent;
+
+	space_time_set(&ap->reached, cell, time, ap->num_nodes);
+
+	return ap->num_nodes++;
+}
+
+/*
+ * Space-time A* of one agent, index of the node reaching the goal or -1.
+ * Arrival is only allowed after the last reservation of the goal, since
+ * the agent stays there.
+ */
+static int agent_planner_search(struct AgentPlanner *ap, int start, int goal,
+				int max_time)
+{
+	struct Maze *maze = ap->maze;
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS + 1];
+	struct BucketQueue *bq = &ap->bq;
+	struct AgentNode *node;
+	gpointer data;
+	gint32 holder;
+	int num_neighbours;
+	int goal_free;
+	int num_expanded = 0;
+	int found = -1;
+	int parent;
+	int index;
+	int cell;
+	int time;
+	int key;
+	int n;
+	int i;
+
+	ap->num_nodes = 0;
+	space_time_reset(&ap->reached);
+
+	goal_free = space_time_get(&ap->last, goal, 0) + 1;
+
+	if (agent_planner_latest_at(ap, start) < 0 ||
+	    !agent_planner_free(ap, start, 0))
+		return -1;
+
+	/* Nodes are queued as their index + 1, NULL ends the queue */
+	index = agent_planner_add_node(ap, start, 0, -1);
+	bucket_queue_reset(bq, 3, ap->dist[start]);
+	bucket_queue_push(bq, GINT_TO_POINTER(index + 1), ap->dist[start]);
+
+	while ((data = bucket_queue_pop(bq, &key)) != NULL) {
+		/* The expansion limit of the solvers bounds each agent */
+		if (maze->limits.max_expanded &&
+		    ++num_expanded > maze->limits.max_expanded)
+			break;
+
+		parent = GPOINTER_TO_INT(data) - 1;
+		node = &ap->nodes[parent];
+		cell = node->cell;
+		time = node->time;
+
+		if (cell == goal && time >= goal_free) {
+			found = parent;
+			break;
+		}
+
+		if (time >= max_time)
+			continue;
+
+		/* Waiting is a move to the same cell */
+		num_neighbours = maze_get_neighbours(maze, &maze->board[cell],
+						     neighbours);
+		neighbours[num_neighbours++] = &maze->board[cell];
+
+		for (i = 0; i < num_neighbours; i++) {
+			n = neighbours[i] - maze->board;
+			if (time + 1 > agent_planner_latest_at(ap, n) ||
+			    time + 1 + (int)agent_planner_dist(ap, n) > max_time ||
+			    space_time_get(&ap->reached, n, time + 1) >= 0 ||
+			    !agent_planner_free(ap, n, time + 1))
+				continue;
+
+			/* Two agents can't swap cells */
+			holder = space_time_get(&ap->reserved, n, time);
+			if (n != cell && holder >= 0 &&
+			    space_time_get(&ap->reserved, cell, time + 1) == holder)
+				continue;
+
+			index = agent_planner_add_node(ap, n, time + 1, parent);
+			bucket_queue_push(bq, GINT_TO_POINTER(index + 1),
+					  time + 1 + ap->dist[n]);
+		}
+	}
+
+	return found;
+}
+
+/* Reserve the path ending at node for agent and fill its path */
+static void agent_planner_reserve(struct AgentPlanner *ap, int node,
+				  int agent, struct MazeAgent *ma)
+{
+	struct Cell *cell;
+	struct AgentNode *n;
+	int last;
+	int i;
+
+	ma->path_len = ap->nodes[node].time + 1;
+	ma->path = g_new(struct MazePos, ma->path_len);
+
+	for (i = node; i >= 0; i = n->parent) {
+		n = &ap->nodes[i];
+		cell = &ap->maze->board[n->cell];
+
+		ma->path[n->time].level = cell->level;
+		ma->path[n->time].row = cell->row;
+		ma->path[n->time].col = cell->col;
+
+		space_time_set(&ap->reserved, n->cell, n->time, agent);
+		last = space_time_get(&ap->last, n->cell, 0);
+		if (n->time > last)
+			space_time_set(&ap->last, n->cell, 0, n->time);
+	}
+
+	n = &ap->nodes[node];
+	space_time_set(&ap->parked, n->cell, 0, n->time);
+}
+
+/*
+ * Plan collision free paths for the agents, in order, and return how many
+ * got one. Agents never share a cell at the same time nor swap cells in one
+ * step, and each one may take up to max_delay steps more than its shortest
+ * path. Others get a NULL path, free the paths with maze_agents_clear().
+ * The max_expanded solve limit applies to the search of each agent.
+ */
+int maze_plan_agents(struct Maze *maze, struct MazeAgent *agents,
+		     int num_agents, int max_delay)
+{
+	struct AgentPlanner ap = { 0 };
+	struct MazeAgent *ma;
+	struct Cell *start;
+	struct Cell *goal;
+	int num_planned = 0;
+	int max_time;
+	int node;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	maze_expand(maze);
+	if (!maze->board)
+		return -1;
+
+	ap.maze = maze;
+	space_time_init(&ap.reserved, SPACE_TIME_MIN_SIZE);
+	space_time_init(&ap.parked, SPACE_TIME_MIN_SIZE);
+	space_time_init(&ap.last, SPACE_TIME_MIN_SIZE);
+	space_time_init(&ap.reached, SPACE_TIME_MIN_SIZE);
+	ap.nodes_size = SPACE_TIME_MIN_SIZE;
+	ap.nodes = g_new(struct AgentNode, ap.nodes_size);
+	ap.dist = g_new(guint32, maze_num_cells(maze));
+	ap.latest = g_new(gint32, maze_num_cells(maze));
+	ap.stamp = g_new0(guint32, maze_num_cells(maze));
+
+	for (i = 0; i < num_agents; i++) {
+		ma = &agents[i];
+		ma->path = NULL;
+		ma->path_len = 0;
+
+		start = maze_get_cell(maze, ma->start.level, ma->start.row,
+				      ma->start.col);
+		goal = maze_get_cell(maze, ma->goal.level, ma->goal.row,
+				     ma->goal.col);
+		if (!start || !goal || start->type == CELL_TYPE_WALL ||
+		    goal->type == CELL_TYPE_WALL)
+			continue;
+
+		agent_planner_next(&ap);
+		max_time = agent_planner_goal_dist(&ap, goal, start,
+						   MAX(max_delay, 0));
+		if (max_time < 0)
+			continue;
+
+		agent_planner_latest(&ap, goal, max_time);
+
+		node = agent_planner_search(&ap, start - maze->board,
+					    goal - maze->board, max_time);
+		if (node < 0)
+			continue;
+
+		agent_planner_reserve(&ap, node, i, ma);
+		num_planned++;
+	}
+
+	space_time_clear(&ap.reserved);
+	space_time_clear(&ap.parked);
+	space_time_clear(&ap.last);
+	space_time_clear(&ap.reached);
+	g_free(ap.nodes);
+	g_free(ap.dist);
+	g_free(ap.latest);
+	g_free(ap.stamp);
+	bucket_queue_clear(&ap.bq);
+
+	return num_planned;
+}
+
+void maze_agents_clear(struct MazeAgent *agents, int num_agents)
+{
+	int i;
+
+	for (i = 0; i < num_agents; i++) {
+		g_free(agents[i].path);
+		agents[i].path = NULL;
+		agents[i].path_len = 0;
+	}
+}
+
+static int maze_get_num_stripes(struct Maze *maze)
+{
+	int num_threads = maze->num_threads;
+
+	if (num_threads <= 0)
+		num_threads = g_get_num_processors();
+
+	/* Keep stripes a few rows high so most moves stay local */
+	return CLAMP(num_threads, 1, maze->num_rows / 4);
+}
+
+/*
+ * Rows owned by stripe i. The board initialization and the parallel
+ * solvers share this split, so the pages of a stripe are first touched by
+ * the thread that later works on them.
+ */
+static void maze_get_stripe_rows(struct Maze *maze, int num_stripes, int i,
+				 int *row_start, int *row_end)
+{
+	*row_start = i * maze->num_rows / num_stripes;
+	*row_end = (i + 1) * maze->num_rows / num_stripes;
+}
+
+/* Pin the calling stripe thread to a CPU, so it stays next to its pages */
+static void maze_pin_thread(struct Maze *maze, int i)
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (!maze->pin_threads)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(i % g_get_num_processors(), &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		g_fprintf(stderr, "Can't pin stripe thread %d\n", i);
+#endif
+}
+
+/*
+ * Walls bit plane
+ *
+ * Each maze keeps its walls as a bit plane in board order, rebuilt when
+ * the layout changes. Solvers never write it, so threads can test walls
+ * anywhere on the board while the cell types change under them, and
+ * maze_diff() compares two planes with vectors. The planes are padded to
+ * whole vectors with zeros.
+ */
+typedef guint64 WallVec __attribute__((vector_size(32), aligned(8)));
+
+#define WALL_VEC_WORDS	(sizeof(WallVec) / sizeof(guint64))
+
+static int maze_wall_plane_words(struct Maze *maze)
+{
+	int num_words = (maze_num_cells(maze) + 63) / 64;
+
+	return (num_words + WALL_VEC_WORDS - 1) / WALL_VEC_WORDS *
+	       WALL_VEC_WORDS;
+}
+
+static const guint64 *maze_get_wall_plane(struct Maze *maze)
+{
+	int num_words;
+	int i;
+
+	if (maze->wall_plane && maze->wall_version == maze->layout_version)
+		return maze->wall_plane;
+
+	num_words = maze_wall_plane_words(maze);
+	if (maze->wall_plane_size < num_words) {
+		g_free(maze->wall_plane);
+		maze->wall_plane_size = num_words;
+		maze->wall_plane = g_new(guint64, num_words);
+	}
+
+	memset(maze->wall_plane, 0, num_words * sizeof(guint64));
+	for (i = 0; i < maze_num_cells(maze); i++)
+		if (maze->board[i].type == CELL_TYPE_WALL)
+			maze->wall_plane[i / 64] |= G_GUINT64_CONSTANT(1) << (i % 64);
+
+	maze->wall_version = maze->layout_version;
+
+	return maze->wall_plane;
+}
+
+/*
+ * Stripe decomposed parallel BFS
+ *
+ * The rows are split into horizontal stripes, one per thread, spanning
+ * every level so stairs never leave a stripe. A thread only ever writes
+ * the cells of its own stripe: neighbours owned by another stripe are
+ * appended to an outbox for that stripe, the ghost cells, and picked up
+ * by their owner once every thread is done with the current BFS level.
+ *
+ * Cells of other stripes still get looked at as neighbours, so the walls
+ * are read from the walls bit plane rather than from their types.
+ *
+ * Each BFS level is then two phases separated by a barrier:
+ *  1. expand the local frontier, claiming local cells and filling outboxes
+ *  2. drain the outboxes addressed to this stripe
+ * and a second barrier makes the next frontier sizes visible to everyone.
+ */
+struct ParallelBfs;
+
+struct ParallelBfsStripe {
+	struct ParallelBfs *pbfs;
+	int index;
+	GThread *thread;
+
+	/* Cells of the current and next BFS level, in this stripe */
+	struct Cell **frontier;
+	struct Cell **next;
+	int frontier_len;
+	int next_len;
+
+	/* The end cell was expanded, published to the others in phase 2 */
+	gboolean found;
+
+	/* Ghost cells for each other stripe */
+	struct Cell ***outbox;
+	int *outbox_len;
+	int *outbox_size;
+};
+
+struct ParallelBfs {
+	struct Maze *maze;
+	gboolean interactive;
+	int (*expand)(struct ParallelBfsStripe *);
+	const guint64 *walls;
+
+	int num_stripes;
+	struct ParallelBfsStripe *stripes;
+
+	/* Stripe owning each row */
+	int *row_owner;
+
+	GMutex lock;
+	GCond cond;
+	int num_waiting;
+	int generation;
+
+	/*
+	 * Only written in phase 2 and read after the second barrier, so a fast
+	 * thread moving on to phase 1 can't change them under a slow one.
+	 * Frontier sizes rotate over 3 BFS levels for the same reason.
+	 */
+	gint counts[3];
+	gboolean found;
+	gboolean canceled;
+};
+
+static void parallel_bfs_barrier(struct ParallelBfs *pbfs)
+{
+	int generation;
+
+	g_mutex_lock(&pbfs->lock);
+
+	generation = pbfs->generation;
+	if (++pbfs->num_waiting == pbfs->num_stripes) {
+		pbfs->num_waiting = 0;
+		pbfs->generation++;
+		g_cond_broadcast(&pbfs->cond);
+	} else {
+		while (generation == pbfs->generation)
+			g_cond_wait(&pbfs->cond, &pbfs->lock);
+	}
+
+	g_mutex_unlock(&pbfs->lock);
+}
+
+static void parallel_bfs_send(struct ParallelBfsStripe *stripe, int owner,
+			      struct Cell *cell)
+{
+	if (stripe->outbox_len[owner] == stripe->outbox_size[owner]) {
+		stripe->outbox_size[owner] *= 2;
+		stripe->outbox[owner] = g_renew(struct Cell *,
+						stripe->outbox[owner],
+						stripe->outbox_size[owner]);
+	}
+
+	stripe->outbox[owner][stripe->outbox_len[owner]++] = cell;
+}
+
+MAZE_ALWAYS_INLINE int parallel_bfs_expand_tmpl(struct ParallelBfsStripe *stripe,
+						const MazeTopology topology,
+						const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct ParallelBfs *pbfs = stripe->pbfs;
+	struct Maze *maze = pbfs->maze;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int num_neighbours;
+	int owner;
+	int i;
+	int j;
+
+	for (i = 0; i < pbfs->num_stripes; i++)
+		stripe->outbox_len[i] = 0;
+
+	for (i = 0; i < stripe->frontier_len; i++) {
+		cell = stripe->frontier[i];
+
+		if (interactive)
+			maze_anim_delay(maze);
+
+		/* Finish the level, the path is traced once all threads are done */
+		if (cell == maze->end_cell) {
+			stripe->found = TRUE;
+			continue;
+		}
+
+		cell->type = CELL_TYPE_PATH_VISITED;
+
+		num_neighbours = maze_topology_neighbours_walls(maze, topology,
+								cell,
+								pbfs->walls,
+								neighbours);
+		for (j = 0; j < num_neighbours; j++) {
+			n_cell = neighbours[j];
+
+			owner = pbfs->row_owner[n_cell->row];
+			if (owner != stripe->index) {
+				parallel_bfs_send(stripe, owner, n_cell);
+				continue;
+			}
+
+			if (n_cell->value)
+				continue;
+
+			n_cell->value = cell->value + 1;
+			n_cell->type = CELL_TYPE_PATH_HEAD;
+			stripe->next[stripe->next_len++] = n_cell;
+		}
+	}
+
+	return stripe->next_len;
+}
+
+MAZE_TMPL_INSTANTIATE(parallel_bfs_expand, struct ParallelBfsStripe *);
+
+/* Claim the ghost cells the other stripes found for this one */
+static void parallel_bfs_drain(struct ParallelBfsStripe *stripe, int value)
+{
+	struct ParallelBfs *pbfs = stripe->pbfs;
+	struct ParallelBfsStripe *src;
+	struct Cell *cell;
+	int i;
+	int j;
+
+	for (i = 0; i < pbfs->num_stripes; i++) {
+		src = &pbfs->stripes[i];
+
+		for (j = 0; j < src->outbox_len[stripe->index]; j++) {
+			cell = src->outbox[stripe->index][j];
+			if (cell->value)
+				continue;
+
+			cell->value = value;
+			cell->type = CELL_TYPE_PATH_HEAD;
+			stripe->next[stripe->next_len++] = cell;
+		}
+	}
+}
+
+static gpointer parallel_bfs_worker(struct ParallelBfsStripe *stripe)
+{
+	struct ParallelBfs *pbfs = stripe->pbfs;
+	struct Cell **tmp;
+	int frontier;
+	int round;
+
+	maze_pin_thread(pbfs->maze, stripe->index);
+
+	for (round = 0; ; round++) {
+		pbfs->expand(stripe);
+
+		parallel_bfs_barrier(pbfs);
+
+		/* Cells reached in this round are one step past the frontier */
+		parallel_bfs_drain(stripe, round + 2);
+		g_atomic_int_add(&pbfs->counts[round % 3], stripe->next_len);
+		if (stripe->found)
+			pbfs->found = TRUE;
+
+		if (stripe->index == 0) {
+			pbfs->counts[(round + 1) % 3] = 0;
+			if (pbfs->interactive &&
+			    pbfs->maze->solver_status == CANCELED)
+				pbfs->canceled = TRUE;
+
+			/* The frontier of this round was counted last round */
+			frontier = round ? pbfs->counts[(round + 2) % 3] : 1;
+			pbfs->maze->num_expanded += frontier;
+			if (maze_solver_check_limits(pbfs->maze, frontier))
+				pbfs->canceled = TRUE;
+		}
+
+		parallel_bfs_barrier(pbfs);
+
+		if (pbfs->canceled || pbfs->found ||
+		    !g_atomic_int_get(&pbfs->counts[round % 3]))
+			break;
+
+		tmp = stripe->frontier;
+		stripe->frontier = stripe->next;
+		stripe->frontier_len = stripe->next_len;
+		stripe->next = tmp;
+		stripe->next_len = 0;
+	}
+
+	return NULL;
+}
+
+static int maze_solve_parallel_bfs_run(struct Maze *maze, gboolean interactive)
+{
+	struct ParallelBfs pbfs = { 0 };
+	struct ParallelBfsStripe *stripe;
+	int stripe_cells;
+	int row_start;
+	int row_end;
+	int row;
+	int i;
+	int j;
+
+	pbfs.maze = maze;
+	pbfs.interactive = interactive;
+	pbfs.expand = parallel_bfs_expand_funcs[interactive][maze->topology];
+	pbfs.walls = maze_get_wall_plane(maze);
+	pbfs.num_stripes = maze_get_num_stripes(maze);
+	pbfs.stripes = g_new0(struct ParallelBfsStripe, pbfs.num_stripes);
+	pbfs.row_owner = g_new(int, maze->num_rows);
+	g_mutex_init(&pbfs.lock);
+	g_cond_init(&pbfs.cond);
+
+	for (i = 0; i < pbfs.num_stripes; i++) {
+		stripe = &pbfs.stripes[i];
+		stripe->pbfs = &pbfs;
+		stripe->index = i;
+
+		maze_get_stripe_rows(maze, pbfs.num_stripes, i, &row_start,
+				     &row_end);
+		for (row = row_start; row < row_end; row++)
+			pbfs.row_owner[row] = i;
+
+		/* A cell joins a frontier at most once */
+		stripe_cells = maze->num_levels * (row_end - row_start) *
+			       maze->num_cols;
+		stripe->frontier = g_new(struct Cell *, stripe_cells);
+		stripe->next = g_new(struct Cell *, stripe_cells);
+
+		stripe->outbox = g_new(struct Cell **, pbfs.num_stripes);
+		stripe->outbox_len = g_new0(int, pbfs.num_stripes);
+		stripe->outbox_size = g_new(int, pbfs.num_stripes);
+		for (j = 0; j < pbfs.num_stripes; j++) {
+			stripe->outbox_size[j] = maze->num_levels * maze->num_cols;
+			stripe->outbox[j] = g_new(struct Cell *,
+						  stripe->outbox_size[j]);
+		}
+	}
+
+	stripe = &pbfs.stripes[pbfs.row_owner[maze->start_cell->row]];
+	maze->start_cell->value = 1;
+	stripe->frontier[stripe->frontier_len++] = maze->start_cell;
+
+	for (i = 0; i < pbfs.num_stripes; i++)
+		pbfs.stripes[i].thread = g_thread_new("solver-stripe",
+					(GThreadFunc)parallel_bfs_worker,
+					&pbfs.stripes[i]);
+
+	for (i = 0; i < pbfs.num_stripes; i++)
+		g_thread_join(pbfs.stripes[i].thread);
+
+	if (!pbfs.canceled)
+		maze_set_solution_path(maze);
+
+	for (i = 0; i < pbfs.num_stripes; i++) {
+		stripe = &pbfs.stripes[i];
+
+		for (j = 0; j < pbfs.num_stripes; j++)
+			g_free(stripe->outbox[j]);
+
+		g_free(stripe->outbox);
+		g_free(stripe->outbox_len);
+		g_free(stripe->outbox_size);
+		g_free(stripe->frontier);
+		g_free(stripe->next);
+	}
+
+	g_mutex_clear(&pbfs.lock);
+	g_cond_clear(&pbfs.cond);
+	g_free(pbfs.row_owner);
+	g_free(pbfs.stripes);
+
+	return pbfs.canceled ? -1 : 0;
+}
+
+static int maze_solve_parallel_bfs(struct Maze *maze)
+{
+	return maze_solve_parallel_bfs_run(maze, TRUE);
+}
+
+static int maze_solve_parallel_bfs_headless(struct Maze *maze)
+{
+	return maze_solve_parallel_bfs_run(maze, FALSE);
+}
+
+#ifdef __linux__
+/*
+ * Multi-process sharded BFS
+ *
+ * Same stripe decomposition and level synchronous scheme as the parallel
+ * BFS, but each stripe is owned by a forked worker process. The distance
+ * field, the frontiers and the ghost cell outboxes live in one POSIX shared
+ * memory mapping set up by the coordinator before forking, and workers
+ * meet at a futex based barrier in that mapping. The board is only read
+ * by the workers, so they share the coordinator's pages copy-on-write.
+ *
+ * Workers never allocate nor touch stdio: a fork from a multi-threaded
+ * process only guarantees async-signal-safe calls in the child.
+ *
+ * The GUI only sees the board once the distance field is brought back,
+ * so the solver isn't animated: the workers always run the headless
+ * expand and the interactive flavour only adds cancellation.
+ */
+struct ShardShared {
+	gint barrier_count;
+	gint barrier_generation;
+
+	gint counts[3];
+	gint found;
+
+	/* Set by the coordinator, latched into canceled by worker 0 */
+	gint cancel;
+	gint canceled;
+	gint overflow;
+
+	/* Expansions and budget, kept by worker 0 */
+	gint expanded;
+	gint limited;
+};
+
+struct ShardBfs;
+
+struct ShardWorker {
+	struct ShardBfs *sbfs;
+	int index;
+	pid_t pid;
+
+	/* CPU to pin the worker to, -1 for none */
+	int cpu;
+
+	/* Cell indexes, in the shared mapping */
+	gint *frontier;
+	gint *next;
+	int frontier_len;
+	int next_len;
+
+	gboolean found;
+};
+
+struct ShardBfs {
+	struct Maze *maze;
+	int (*expand)(struct ShardWorker *);
+
+	int num_shards;
+	int *row_owner;
+	struct ShardWorker *workers;
+
+	void *map;
+	gsize map_size;
+	struct ShardShared *shared;
+	gint *dist;
+
+	/* outbox_len[src * num_shards + dst], outbox_size cells each */
+	gint *outbox_len;
+	gint *outboxes;
+	int outbox_size;
+};
+
+static void shard_futex(gint *addr, int op, int val)
+{
+	syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void shard_barrier(struct ShardBfs *sbfs)
+{
+	struct ShardShared *shared = sbfs->shared;
+	gint generation;
+
+	generation = g_atomic_int_get(&shared->barrier_generation);
+
+	if (g_atomic_int_add(&shared->barrier_count, 1) == sbfs->num_shards - 1) {
+		g_atomic_int_set(&shared->barrier_count, 0);
+		g_atomic_int_inc(&shared->barrier_generation);
+		shard_futex(&shared->barrier_generation, FUTEX_WAKE, INT_MAX);
+		return;
+	}
+
+	while (g_atomic_int_get(&shared->barrier_generation) == generation)
+		shard_futex(&shared->barrier_generation, FUTEX_WAIT, generation);
+}
+
+static gint *shard_outbox(struct ShardBfs *sbfs, int src, int dst)
+{
+	return &sbfs->outboxes[(gsize)(src * sbfs->num_shards + dst) *
+			       sbfs->outbox_size];
+}
+
+MAZE_ALWAYS_INLINE int shard_bfs_expand_tmpl(struct ShardWorker *worker,
+					     const MazeTopology topology,
+					     const gboolean interactive)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct ShardBfs *sbfs = worker->sbfs;
+	struct Maze *maze = sbfs->maze;
+	gint *outbox_len;
+	struct Cell *cell;
+	int num_neighbours;
+	int n_index;
+	int value;
+	int owner;
+	int i;
+	int j;
+
+	outbox_len = &sbfs->outbox_len[worker->index * sbfs->num_shards];
+	for (i = 0; i < sbfs->num_shards; i++)
+		outbox_len[i] = 0;
+
+	for (i = 0; i < worker->frontier_len; i++) {
+		cell = &maze->board[worker->frontier[i]];
+		value = g_atomic_int_get(&sbfs->dist[worker->frontier[i]]);
+
+		if (cell == maze->end_cell) {
+			worker->found = TRUE;
+			continue;
+		}
+
+		num_neighbours = maze_topology_neighbours(maze, topology, cell,
+							  neighbours);
+		for (j = 0; j < num_neighbours; j++) {
+			n_index = neighbours[j] - maze->board;
+			if (g_atomic_int_get(&sbfs->dist[n_index]))
+				continue;
+
+			owner = sbfs->row_owner[neighbours[j]->row];
+			if (owner != worker->index) {
+				if (outbox_len[owner] == sbfs->outbox_size) {
+					g_atomic_int_set(&sbfs->shared->overflow, 1);
+					continue;
+				}
+
+				shard_outbox(sbfs, worker->index, owner)[outbox_len[owner]++] = n_index;
+				continue;
+			}
+
+			g_atomic_int_set(&sbfs->dist[n_index], value + 1);
+			worker->next[worker->next_len++] = n_index;
+		}
+	}
+
+	return worker->next_len;
+}
+
+MAZE_TMPL_INSTANTIATE(shard_bfs_expand, struct ShardWorker *);
+
+static void shard_bfs_drain(struct ShardWorker *worker, int value)
+{
+	struct ShardBfs *sbfs = worker->sbfs;
+	gint *outbox;
+	int n_index;
+	int len;
+	int i;
+	int j;
+
+	for (i = 0; i < sbfs->num_shards; i++) {
+		outbox = shard_outbox(sbfs, i, worker->index);
+		len = sbfs->outbox_len[i * sbfs->num_shards + worker->index];
+
+		for (j = 0; j < len; j++) {
+			n_index = outbox[j];
+			if (g_atomic_int_get(&sbfs->dist[n_index]))
+				continue;
+
+			g_atomic_int_set(&sbfs->dist[n_index], value);
+			worker->next[worker->next_len++] = n_index;
+		}
+	}
+}
+
+/*
+ * maze_pin_thread() for the forked workers. The child of a threaded
+ * process may only make async-signal-safe calls, so no stdio here.
+ */
+static void shard_bfs_pin(struct ShardWorker *worker)
+{
+	static const char msg[] = "Can't pin shard worker\n";
+	cpu_set_t set;
+
+	if (worker->cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(worker->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) &&
+	    write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0)
+		return;
+}
+
+/* Runs in the forked worker process */
+static void shard_bfs_worker(struct ShardWorker *worker)
+{
+	struct ShardBfs *sbfs = worker->sbfs;
+	struct ShardShared *shared = sbfs->shared;
+	gint *tmp;
+	int frontier;
+	int round;
+
+	shard_bfs_pin(worker);
+
+	for (round = 0; ; round++) {
+		sbfs->expand(worker);
+
+		shard_barrier(sbfs);
+
+		shard_bfs_drain(worker, round + 2);
+		g_atomic_int_add(&shared->counts[round % 3], worker->next_len);
+		if (worker->found)
+			g_atomic_int_set(&shared->found, 1);
+
+		if (worker->index == 0) {
+			g_atomic_int_set(&shared->counts[(round + 1) % 3], 0);
+			if (g_atomic_int_get(&shared->cancel))
+				g_atomic_int_set(&shared->canceled, 1);
+
+			/* This copy of the maze is private to the worker */
+			frontier = round ?
+				g_atomic_int_get(&shared->counts[(round + 2) % 3]) : 1;
+			sbfs->maze->num_expanded += frontier;
+			g_atomic_int_set(&shared->expanded,
+					 sbfs->maze->num_expanded);
+			if (maze_solver_check_limits(sbfs->maze, frontier)) {
+				g_atomic_int_set(&shared->limited, 1);
+				g_atomic_int_set(&shared->canceled, 1);
+			}
+		}
+
+		shard_barrier(sbfs);
+
+		if (g_atomic_int_get(&shared->canceled) ||
+		    g_atomic_int_get(&shared->found) ||
+		    !g_atomic_int_get(&shared->counts[round % 3]))
+			break;
+
+		tmp = worker->frontier;
+		worker->frontier = worker->next;
+		worker->frontier_len = worker->next_len;
+		worker->next = tmp;
+		worker->next_len = 0;
+	}
+}
+
+static int shard_bfs_map(struct ShardBfs *sbfs)
+{
+	static gint map_count;
+	struct Maze *maze = sbfs->maze;
+	gsize stripe_cells;
+	gsize offset;
+	char name[64];
+	char *map;
+	int row_start;
+	int row_end;
+	int fd;
+	int i;
+
+	/* Ghost cells sent to one stripe during one level, at most */
+	sbfs->outbox_size = maze->num_levels * maze->num_cols *
+			    MAZE_MAX_NEIGHBOURS;
+
+	offset = sizeof(struct ShardShared);
+	offset += maze_num_cells(maze) * sizeof(gint);
+	offset += sbfs->num_shards * sbfs->num_shards * sizeof(gint);
+	offset += (gsize)sbfs->num_shards * sbfs->num_shards *
+		  sbfs->outbox_size * sizeof(gint);
+	/* Each cell sits in one of the 2 frontier lists of its owner */
+	offset += 2 * maze_num_cells(maze) * sizeof(gint);
+	sbfs->map_size = offset;
+
+	g_snprintf(name, sizeof(name), "/cmaze-%d-%d", getpid(),
+		   g_atomic_int_add(&map_count, 1));
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		g_fprintf(stderr, "shm_open %s failed\n", name);
+		return -1;
+	}
+
+	/* Only the mapping is needed, children inherit it through fork() */
+	shm_unlink(name);
+
+	if (ftruncate(fd, sbfs->map_size)) {
+		g_fprintf(stderr, "Can't size shared memory\n");
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, sbfs->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		g_fprintf(stderr, "Can't map shared memory\n");
+		return -1;
+	}
+
+	sbfs->map = map;
+	sbfs->shared = (struct ShardShared *)map;
+	offset = sizeof(struct ShardShared);
+	sbfs->dist = (gint *)(map + offset);
+	offset += maze_num_cells(maze) * sizeof(gint);
+	sbfs->outbox_len = (gint *)(map + offset);
+	offset += sbfs->num_shards * sbfs->num_shards * sizeof(gint);
+	sbfs->outboxes = (gint *)(map + offset);
+	offset += (gsize)sbfs->num_shards * sbfs->num_shards *
+		  sbfs->outbox_size * sizeof(gint);
+
+	for (i = 0; i < sbfs->num_shards; i++) {
+		maze_get_stripe_rows(maze, sbfs->num_shards, i, &row_start,
+				     &row_end);
+		stripe_cells = maze->num_levels * (row_end - row_start) *
+			       maze->num_cols;
+
+		sbfs->workers[i].frontier = (gint *)(map + offset);
+		offset += stripe_cells * sizeof(gint);
+		sbfs->workers[i].next = (gint *)(map + offset);
+		offset += stripe_cells * sizeof(gint);
+	}
+
+	return 0;
+}
+
+/* The workers left would wait for a dead one at the next barrier */
+static void shard_bfs_kill(struct ShardBfs *sbfs)
+{
+	int i;
+
+	for (i = 0; i < sbfs->num_shards; i++)
+		if (sbfs->workers[i].pid)
+			kill(sbfs->workers[i].pid, SIGKILL);
+}
+
+/*
+ * Reap the workers which were forked, forwarding a cancel request from the
+ * GUI. When one of them fails, the others are killed. Any worker may be
+ * the first to die, so none of them is waited for in a blocking call.
+ */
+static int shard_bfs_wait(struct ShardBfs *sbfs, gboolean interactive)
+{
+	int num_running = 0;
+	int err = 0;
+	int status;
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < sbfs->num_shards; i++)
+		if (sbfs->workers[i].pid)
+			num_running++;
+
+	while (num_running) {
+		for (i = 0; i < sbfs->num_shards; i++) {
+			if (!sbfs->workers[i].pid)
+				continue;
+
+			pid = waitpid(sbfs->workers[i].pid, &status, WNOHANG);
+			if (pid == 0 || (pid < 0 && errno == EINTR))
+				continue;
+
+			sbfs->workers[i].pid = 0;
+			num_running--;
+
+			if (pid > 0 && WIFEXITED(status) &&
+			    !WEXITSTATUS(status))
+				continue;
+
+			if (!err) {
+				g_fprintf(stderr, "Shard worker %d failed\n", i);
+				shard_bfs_kill(sbfs);
+				err = -1;
+			}
+		}
+
+		if (!num_running)
+			break;
+
+		if (interactive && sbfs->maze->solver_status == CANCELED)
+			g_atomic_int_set(&sbfs->shared->cancel, 1);
+
+		g_usleep(interactive ? 1000 : 100);
+	}
+
+	return err;
+}
+
+static int maze_solve_sharded_bfs_run(struct Maze *maze, gboolean interactive)
+{
+	struct ShardBfs sbfs = { 0 };
+	struct ShardWorker *worker;
+	struct Cell *cell;
+	int row_start;
+	int row_end;
+	int row;
+	int err = 0;
+	int i;
+
+	sbfs.maze = maze;
+	sbfs.expand = shard_bfs_expand_funcs[FALSE][maze->topology];
+	sbfs.num_shards = maze_get_num_stripes(maze);
+	sbfs.workers = g_new0(struct ShardWorker, sbfs.num_shards);
+	sbfs.row_owner = g_new(int, maze->num_rows);
+
+	for (i = 0; i < sbfs.num_shards; i++) {
+		sbfs.workers[i].sbfs = &sbfs;
+		sbfs.workers[i].index = i;
+
+		maze_get_stripe_rows(maze, sbfs.num_shards, i, &row_start,
+				     &row_end);
+		for (row = row_start; row < row_end; row++)
+			sbfs.row_owner[row] = i;
+	}
+
+	if (shard_bfs_map(&sbfs)) {
+		err = -1;
+		goto exit;
+	}
+
+	worker = &sbfs.workers[sbfs.row_owner[maze->start_cell->row]];
+	sbfs.dist[maze->start_cell - maze->board] = 1;
+	worker->frontier[worker->frontier_len++] = maze->start_cell - maze->board;
+
+	for (i = 0; i < sbfs.num_shards; i++) {
+		worker = &sbfs.workers[i];
+		worker->cpu = maze->pin_threads ?
+			      i % g_get_num_processors() : -1;
+
+		worker->pid = fork();
+		if (worker->pid == 0) {
+			shard_bfs_worker(worker);
+			_exit(0);
+		}
+
+		if (worker->pid < 0) {
+			g_fprintf(stderr, "Can't fork shard worker %d\n", i);
+			worker->pid = 0;
+			shard_bfs_kill(&sbfs);
+			err = -1;
+			break;
+		}
+	}
+
+	if (shard_bfs_wait(&sbfs, interactive))
+		err = -1;
+
+	maze->num_expanded = sbfs.shared->expanded;
+	if (sbfs.shared->limited)
+		maze->solver_status = LIMITED;
+
+	if (err || sbfs.shared->canceled) {
+		err = -1;
+		goto exit;
+	}
+
+	if (sbfs.shared->overflow) {
+		g_fprintf(stderr, "Shard outbox overflow\n");
+		err = -1;
+		goto exit;
+	}
+
+	/* Bring the shared distance field back into the board */
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		cell->value = sbfs.dist[i];
+		if (cell->value && cell->type == CELL_TYPE_EMPTY)
+			cell->type = CELL_TYPE_PATH_VISITED;
+	}
+
+	maze_set_solution_path(maze);
+
+exit:
+	if (sbfs.map)
+		munmap(sbfs.map, sbfs.map_size);
+
+	g_free(sbfs.row_owner);
+	g_free(sbfs.workers);
+
+	return err;
+}
+#else
+static int maze_solve_sharded_bfs_run(struct Maze *maze, gboolean interactive)
+{
+	g_fprintf(stderr, "Sharded BFS is only supported on Linux\n");
+
+	return -1;
+}
+#endif
+
+static int maze_solve_sharded_bfs(struct Maze *maze)
+{
+	return maze_solve_sharded_bfs_run(maze, TRUE);
+}
+
+static int maze_solve_sharded_bfs_headless(struct Maze *maze)
+{
+	return maze_solve_sharded_bfs_run(maze, FALSE);
+}
+
+/*
+ * Parallel validator
+ *
+ * Checks the walls as the generator lays them, on the square grid with
+ * stairs and whatever the topology. Each stripe thread counts the open
+ * cells and the passages between them and links them in a union-find
+ * forest, only through cells of its own stripe. The passages crossing
+ * the stripe boundaries are then merged by the calling thread, which only
+ * has a few rows worth of cells to look at.
+ */
+struct MazeValidator;
+
+struct MazeValidatorStripe {
+	struct MazeValidator *val;
+	int index;
+	GThread *thread;
+
+	int row_start;
+	int row_end;
+
+	/* Counts of this stripe, num_components before the merge */
+	struct MazeReport report;
+};
+
+struct MazeValidator {
+	struct Maze *maze;
+
+	/* Union-find parent of each cell, indexed like the board */
+	guint32 *parent;
+};
+
+static guint32 maze_validator_find(guint32 *parent, guint32 i)
+{
+	while (parent[i] != i) {
+		/* Path halving */
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+/* Link the sets of cells a and b, FALSE if they were already linked */
+static gboolean maze_validator_union(guint32 *parent, guint32 a, guint32 b)
+{
+	a = maze_validator_find(parent, a);
+	b = maze_validator_find(parent, b);
+	if (a == b)
+		return FALSE;
+
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+
+	return TRUE;
+}
+
+/* A perimeter cell may only be open as an endpoint or a torus portal */
+static gboolean maze_validator_bad_opening(struct Maze *maze,
+					   struct Cell *cell)
+{
+	struct Cell *o_cell;
+	int row = cell->row;
+	int col = cell->col;
+
+	if (cell->type == CELL_TYPE_START || cell->type == CELL_TYPE_END ||
+	    !maze_cell_is_perimeter(maze, cell))
+		return FALSE;
+
+	if (maze->topology != TOPOLOGY_TORUS)
+		return TRUE;
+
+	/* The cell facing this one across the edges */
+	if (row == 0 || row == maze->num_rows - 1)
+		row = maze->num_rows - 1 - row;
+	if (col == 0 || col == maze->num_cols - 1)
+		col = maze->num_cols - 1 - col;
+
+	o_cell = maze_get_cell(maze, cell->level, row, col);
+
+	return o_cell->type == CELL_TYPE_WALL;
+}
+
+static gpointer maze_validator_worker(struct MazeValidatorStripe *stripe)
+{
+	struct MazeValidator *val = stripe->val;
+	struct Maze *maze = val->maze;
+	struct MazeReport *report = &stripe->report;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	guint32 i;
+	int level;
+	int row;
+	int col;
+
+	maze_pin_thread(maze, stripe->index);
+
+	for (level = 0; level < maze->num_levels; level++) {
+		for (row = stripe->row_start; row < stripe->row_end; row++) {
+			cell = maze_get_cell(maze, level, row, 0);
+			i = cell - maze->board;
+			for (col = 0; col < maze->num_cols; col++)
+				val->parent[i + col] = i + col;
+		}
+	}
+
+	for (level = 0; level < maze->num_levels; level++) {
+		for (row = stripe->row_start; row < stripe->row_end; row++) {
+			for (col = 0; col < maze->num_cols; col++) {
+				cell = maze_get_cell(maze, level, row, col);
+				if (cell->type == CELL_TYPE_WALL) {
+					if (cell->stairs)
+						report->num_bad_stairs++;
+					continue;
+				}
+
+				report->num_open++;
+				report->num_components++;
+
+				if (maze_validator_bad_opening(maze, cell))
+					report->num_openings++;
+
+				if (cell->stairs & CELL_STAIRS_DOWN) {
+					n_cell = maze_get_cell(maze, level - 1,
+							       row, col);
+					if (!n_cell ||
+					    !(n_cell->stairs & CELL_STAIRS_UP))
+						report->num_bad_stairs++;
+				}
+
+				/* Look right, down and up the stairs */
+				n_cell = maze_get_cell(maze, level, row, col + 1);
+				if (n_cell && n_cell->type != CELL_TYPE_WALL) {
+					report->num_passages++;
+					report->num_components -=
+						maze_validator_union(val->parent,
+							cell - maze->board,
+							n_cell - maze->board);
+				}
+
+				n_cell = maze_get_cell(maze, level, row + 1, col);
+				if (row + 1 < stripe->row_end &&
+				    n_cell->type != CELL_TYPE_WALL) {
+					report->num_passages++;
+					report->num_components -=
+						maze_validator_union(val->parent,
+							cell - maze->board,
+							n_cell - maze->board);
+				}
+
+				if (!(cell->stairs & CELL_STAIRS_UP))
+					continue;
+
+				n_cell = maze_get_cell(maze, level + 1, row, col);
+				if (!n_cell || n_cell->type == CELL_TYPE_WALL ||
+				    !(n_cell->stairs & CELL_STAIRS_DOWN)) {
+					report->num_bad_stairs++;
+					continue;
+				}
+
+				report->num_passages++;
+				report->num_components -=
+					maze_validator_union(val->parent,
+							     cell - maze->board,
+							     n_cell - maze->board);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Check that the maze is well formed and fill report. The open cells must
+ * be connected, the perimeter closed except for the endpoints and the
+ * stairs paired, and a maze generated without the complex option can't
+ * have any cycle.
+ */
+int maze_validate(struct Maze *maze, struct MazeReport *report)
+{
+	struct MazeValidator val;
+	struct MazeValidatorStripe *stripes;
+	struct MazeValidatorStripe *stripe;
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int num_stripes;
+	int level;
+	int col;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	maze_expand(maze);
+	if (!maze->board)
+		return -1;
+
+	memset(report, 0, sizeof(*report));
+
+	val.maze = maze;
+	val.parent = g_new(guint32, maze_num_cells(maze));
+
+	num_stripes = maze_get_num_stripes(maze);
+	stripes = g_new0(struct MazeValidatorStripe, num_stripes);
+
+	for (i = 0; i < num_stripes; i++) {
+		stripe = &stripes[i];
+		stripe->val = &val;
+		stripe->index = i;
+		maze_get_stripe_rows(maze, num_stripes, i, &stripe->row_start,
+				     &stripe->row_end);
+		stripe->thread = g_thread_new("validator-stripe",
+					      (GThreadFunc)maze_validator_worker,
+					      stripe);
+	}
+
+	for (i = 0; i < num_stripes; i++) {
+		stripe = &stripes[i];
+		g_thread_join(stripe->thread);
+
+		report->num_open += stripe->report.num_open;
+		report->num_passages += stripe->report.num_passages;
+		report->num_components += stripe->report.num_components;
+		report->num_openings += stripe->report.num_openings;
+		report->num_bad_stairs += stripe->report.num_bad_stairs;
+	}
+
+	/* Passages between the last row of a stripe and the next one */
+	for (i = 1; i < num_stripes; i++) {
+		for (level = 0; level < maze->num_levels; level++) {
+			for (col = 0; col < maze->num_cols; col++) {
+				cell = maze_get_cell(maze, level,
+						     stripes[i].row_start - 1, col);
+				n_cell = maze_get_cell(maze, level,
+						       stripes[i].row_start, col);
+				if (cell->type == CELL_TYPE_WALL ||
+				    n_cell->type == CELL_TYPE_WALL)
+					continue;
+
+				report->num_passages++;
+				report->num_components -=
+					maze_validator_union(val.parent,
+							     cell - maze->board,
+							     n_cell - maze->board);
+			}
+		}
+	}
+
+	report->num_cycles = report->num_passages - report->num_open +
+			     report->num_components;
+	report->valid = report->num_components == 1 &&
+			!report->num_openings && !report->num_bad_stairs &&
+			(maze->complex || !report->num_cycles);
+
+	g_free(stripes);
+	g_free(val.parent);
+
+	return 0;
+}
+
+#ifdef MAZE_DEBUG
+/* Complain about any malformed maze coming out of the generator */
+static void maze_debug_validate(struct Maze *maze)
+{
+	struct MazeReport report;
+
+	if (maze_validate(maze, &report) || report.valid)
+		return;
+
+	g_fprintf(stderr,
+		  "Invalid maze: %d open cells, %d passages, %d components, "
+		  "%d cycles, %d openings, %d bad stairs\n",
+		  report.num_open, report.num_passages, report.num_components,
+		  report.num_cycles, report.num_openings,
+		  report.num_bad_stairs);
+}
+#endif
+
+static void maze_solve_thread_join(struct Maze *maze)
+{
+	if (!maze->solver_thread)
+		return;
+
+	g_thread_join(maze->solver_thread);
+	maze->solver_thread = NULL;
+}
+
+guint maze_get_changes(struct Maze *maze)
+{
+	return g_atomic_int_get(&maze->changes);
+}
+
+static int maze_solver_reason(struct Maze *maze)
+{
+	int reason = SOLVER_CB_REASON_RUNNING;
+
+	switch (maze->solver_status) {
+	case RUNNING:
+		reason = SOLVER_CB_REASON_RUNNING;
+		break;
+	case CANCELED:
+		reason = SOLVER_CB_REASON_CANCELED;
+		break;
+	case SOLVED:
+		reason = SOLVER_CB_REASON_SOLVED;
+		break;
+	case UNSOLVABLE:
+		reason = SOLVER_CB_REASON_INFLOOP;
+		break;
+	case LIMITED:
+		reason = SOLVER_CB_REASON_LIMITED;
+		break;
+	case STOPPED:
+		break;
+	}
+
+	return reason;
+}
+
+int maze_solve_poll(struct Maze *maze)
+{
+	int reason;
+
+	reason = maze_solver_reason(maze);
+	if (reason != SOLVER_CB_REASON_RUNNING)
+		maze_solve_thread_join(maze);
+
+	return reason;
+}
+
+static gboolean maze_solve_monitor(struct Maze *maze)
+{
+	int reason;
+
+	reason = maze_solve_poll(maze);
+
+	if (maze->solver_cb)
+		maze->solver_cb(reason, maze->solver_cb_userdata);
+
+	return (reason == SOLVER_CB_REASON_RUNNING);
+}
+
+void maze_solve_thread_cancel(struct Maze *maze)
+{
+	maze->solver_status = CANCELED;
+
+	maze_solve_thread_join(maze);
+}
+
+/* Memory held by each cell of the frontier of a solver */
+static gsize maze_solver_frontier_entry(SolverAlgorithm algo)
+{
+	switch (algo) {
+	case SOLVER_A_STAR:
+		/* A list node and a copy of the cell */
+		return sizeof(GList) + sizeof(struct Cell);
+	case SOLVER_DFS:
+	case SOLVER_DIJKSTRA:
+	case SOLVER_WEIGHTED_A_STAR:
+		return sizeof(GList);
+	case SOLVER_ALWAYS_TURN_LEFT:
+	case SOLVER_ALWAYS_TURN_RIGHT:
+		return 0;
+	default:
+		/* Cell pointers in the work list or a stripe frontier */
+		return sizeof(struct Cell *);
+	}
+}
+
+void maze_set_solve_limits(struct Maze *maze,
+			   const struct MazeSolveLimits *limits)
+{
+	maze->limits = *limits;
+}
+
+static int _maze_solve(struct Maze *maze, gboolean interactive)
+{
+	gint64 start;
+	SolverFunc solver_func;
+	int result;
+
+	if (maze->generating)
+		return -1;
+
+	maze_expand(maze);
+
+	switch (maze->solver_algorithm) {
+	case SOLVER_A_STAR:
+		solver_func = maze_solve_a_star_funcs[interactive][maze->topology];
+		break;
+	case SOLVER_ALWAYS_TURN_LEFT:
+	case SOLVER_ALWAYS_TURN_RIGHT:
+		solver_func = interactive ? maze_solve_always_turn :
+					    maze_solve_always_turn_headless;
+		break;
+	case SOLVER_DFS:
+		solver_func = maze_solve_dfs_funcs[interactive][maze->topology];
+		break;
+	case SOLVER_BFS:
+		solver_func = maze_solve_bfs_funcs[interactive][maze->topology];
+		break;
+	case SOLVER_DIJKSTRA:
+	case SOLVER_WEIGHTED_A_STAR:
+		solver_func = maze_solve_dijkstra_funcs[interactive][maze->topology];
+		break;
+	case SOLVER_NEAREST_EXIT:
+		solver_func = maze_solve_nearest_exit_funcs[interactive][maze->topology];
+		break;
+	case SOLVER_PARALLEL_BFS:
+		solver_func = interactive ? maze_solve_parallel_bfs :
+					    maze_solve_parallel_bfs_headless;
+		break;
+	case SOLVER_SHARDED_BFS:
+		solver_func = interactive ? maze_solve_sharded_bfs :
+					    maze_solve_sharded_bfs_headless;
+		break;
+	default:
+		g_fprintf(stderr, "Invalid solver enum %d\n",
+			  maze->solver_algorithm);
+		return -1;
+	}
+
+	_maze_clear_board(maze);
+
+	start = g_get_monotonic_time();
+
+	maze->changes_start = g_atomic_int_get(&maze->changes);
+	g_atomic_int_set(&maze->frontier, 0);
+	maze->solve_start = start;
+
+	maze->num_expanded = 0;
+	maze->frontier_entry = maze_solver_frontier_entry(maze->solver_algorithm);
+	maze_solver_next_limit_check(maze);
+
+	result = solver_func(maze);
+
+	maze->solve_time = g_get_monotonic_time() - start;
+
+	if (!result)
+		maze->solver_status = SOLVED;
+
+	return result;
+}
+
+int maze_solve(struct Maze *maze)
+{
+	return _maze_solve(maze, TRUE);
+}
+
+/*
+ * Same result as maze_solve() but runs the headless solver copies: no
+ * animation delay and no cancellation, so it must not be used from
+ * maze_solve_thread().
+ */
+int maze_solve_headless(struct Maze *maze)
+{
+	if (maze->solver_status == RUNNING)
+		return -1;
+
+	return _maze_solve(maze, FALSE);
+}
+
+int maze_solve_thread(struct Maze *maze, MazeSolverFunc cb, void *userdata)
+{
+	/* The solver would return at once, leaving the status RUNNING */
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	/* The previous solver is done but its thread may not be joined yet */
+	maze_solve_thread_join(maze);
+
+	/* The GUI reads the cells while the solver runs */
+	maze_expand(maze);
+
+	maze->solver_status = RUNNING;
+	maze->solver_cb = cb;
+	maze->solver_cb_userdata = userdata;
+
+	maze->solver_thread = g_thread_new("solver",
+			      (GThreadFunc)maze_solve, maze);
+
+	if (cb)
+		g_timeout_add(40, (GSourceFunc)maze_solve_monitor, maze);
+
+	return 0;
+}
+
+static int maze_async_open(struct Maze *maze)
+{
+	if (maze->async_fd[0] >= 0)
+		return 0;
+
+#ifdef __linux__
+	maze->async_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	maze->async_fd[1] = maze->async_fd[0];
+	if (maze->async_fd[0] < 0)
+		return -1;
+#else
+	if (pipe(maze->async_fd)) {
+		maze->async_fd[0] = -1;
+		maze->async_fd[1] = -1;
+		return -1;
+	}
+
+	fcntl(maze->async_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(maze->async_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	return 0;
+}
+
+static void maze_async_close(struct Maze *maze)
+{
+	if (maze->async_fd[0] < 0)
+		return;
+
+	close(maze->async_fd[0]);
+	if (maze->async_fd[1] != maze->async_fd[0])
+		close(maze->async_fd[1]);
+}
+
+static gpointer maze_solve_async_thread(struct Maze *maze)
+{
+	maze_solve(maze);
+	maze->async_interval = 0;
+	maze->async = FALSE;
+
+	/* Failed before the solver could start */
+	if (maze->solver_status == RUNNING)
+		maze->solver_status = CANCELED;
+
+	g_atomic_int_set(&maze->async_reason, maze_solver_reason(maze));
+	maze_async_notify(maze);
+
+	return NULL;
+}
+
+/*
+ * Start solving in a thread, like maze_solve_thread() but without a main
+ * loop. Returns a file descriptor to poll for reading, the same for every
+ * solve of the maze, or -1. It becomes readable once the solver is done
+ * and, if progress_interval (in microseconds) isn't 0, about that often
+ * while it runs. maze_solve_async_result() tells which.
+ */
+int maze_solve_async(struct Maze *maze, gint64 progress_interval)
+{
+	if (maze->solver_status == RUNNING || maze->generating ||
+	    maze_async_open(maze))
+		return -1;
+
+	maze_solve_thread_join(maze);
+	maze_expand(maze);
+
+	maze->solver_status = RUNNING;
+	maze->solver_cb = NULL;
+	maze->async = TRUE;
+	maze->async_interval = progress_interval;
+	maze->async_progress = g_get_monotonic_time();
+	g_atomic_int_set(&maze->async_reason, SOLVER_CB_REASON_RUNNING);
+
+	maze->solver_thread = g_thread_new("solver",
+			      (GThreadFunc)maze_solve_async_thread, maze);
+
+	return maze->async_fd[0];
+}
+
+/*
+ * Clear the readiness of the async fd and fill result. Returns
+ * SOLVER_CB_REASON_RUNNING with the current solver stats while the solver
+ * runs, then its final reason, stats and path.
+ */
+int maze_solve_async_result(struct Maze *maze, struct MazeSolveResult *result)
+{
+	char buf[64];
+
+	if (maze->async_fd[0] < 0)
+		return -1;
+
+	while (read(maze->async_fd[0], buf, sizeof(buf)) > 0)
+		;
+
+	result->reason = g_atomic_int_get(&maze->async_reason);
+	if (result->reason != SOLVER_CB_REASON_RUNNING)
+		maze_solve_thread_join(maze);
+
+	maze_get_solver_stats(maze, &result->stats);
+	result->path_len = 0;
+	result->path_cost = 0;
+	if (result->reason == SOLVER_CB_REASON_SOLVED) {
+		result->path_len = maze->path_len;
+		result->path_cost = maze->path_cost;
+	}
+
+	return result->reason;
+}
+
+CellType maze_get_cell_type(struct Maze *maze, int level, int row, int col)
+{
+	struct Cell *cell;
+
+	if (maze->compact)
+		return maze_compact_get_type(maze, level, row, col);
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (cell)
+		return cell->type;
+
+	return 0;
+}
+
+int maze_get_cell_cost(struct Maze *maze, int level, int row, int col)
+{
+	struct Cell *cell;
+	int index;
+
+	if (maze->compact) {
+		index = maze_compact_cell_index(maze, level, row, col);
+		if (index < 0)
+			return 0;
+
+		return maze->costs ? maze->costs[index] : 1;
+	}
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (cell)
+		return maze_cell_cost(maze, cell);
+
+	return 0;
+}
+
+int maze_get_cell_stairs(struct Maze *maze, int level, int row, int col)
+{
+	struct Cell *cell;
+
+	if (maze->compact)
+		return maze_compact_get_stairs(maze, level, row, col);
+
+	cell = maze_get_cell(maze, level, row, col);
+	if (cell)
+		return cell->stairs;
+
+	return 0;
+}
+
+void maze_print_board(struct Maze *maze)
+{
+	int level;
+	int row;
+	int col;
+	struct Cell *cell;
+
+	maze_expand(maze);
+
+	for (level = 0; level < maze->num_levels; level++) {
+		if (level)
+			g_printf("\n");
+
+		for (row = 0; row < maze->num_rows; row++) {
+			for (col = 0; col < maze->num_cols; col++) {
+				cell = maze_get_cell(maze, level, row, col);
+
+				if (cell->type == CELL_TYPE_PATH_SOLUTION)
+					g_printf("O");
+				else if (cell->type == CELL_TYPE_WALL)
+					g_printf("X");
+				else if (cell->stairs)
+					g_printf("%c", cell->stairs ==
+						 CELL_STAIRS_UP ? '/' :
+						 cell->stairs == CELL_STAIRS_DOWN ?
+						 '\\' : '#');
+				else
+					g_printf(" ");
+			}
+
+			g_printf("\n");
+		}
+	}
+}
+
+static long maze_random(struct Maze *maze)
+{
+	if (maze->rand)
+		return g_rand_int(maze->rand) >> 1;
+
+	return random();
+}
+
+/*
+ * Give the maze its own random sequence so mazes can be generated from
+ * several threads and each one is reproducible from its seed alone.
+ */
+void maze_set_seed(struct Maze *maze, guint32 seed)
+{
+	if (maze->rand)
+		g_rand_set_seed(maze->rand, seed);
+	else
+		maze->rand = g_rand_new_with_seed(seed);
+}
+
+/* Only draw a level when there's a choice, so 2D mazes keep their seeds */
+static int maze_random_level(struct Maze *maze)
+{
+	if (maze->num_levels == 1)
+		return 0;
+
+	return maze_random(maze) % maze->num_levels;
+}
+
+/*
+ * Scatter diamond shaped patches of rough terrain over the board. Patches
+ * may overlap, in which case the most expensive one wins.
+ */
+static void maze_create_terrain(struct Maze *maze)
+{
+	struct Cell *cell;
+	int num_patches;
+	int radius;
+	int cost;
+	int level;
+	int row;
+	int col;
+	int r;
+	int c;
+	int i;
+
+	num_patches = maze_num_cells(maze) / 64;
+	for (i = 0; i < num_patches; i++) {
+		level = maze_random_level(maze);
+		row = maze_random(maze) % maze->num_rows;
+		col = maze_random(maze) % maze->num_cols;
+		radius = 1 + maze_random(maze) % 4;
+		cost = 2 + maze_random(maze) % (maze->max_cost - 1);
+
+		for (r = row - radius; r <= row + radius; r++) {
+			for (c = col - radius; c <= col + radius; c++) {
+				cell = maze_get_cell(maze, level, r, c);
+				if (!cell ||
+				    abs(r - row) + abs(c - col) > radius)
+					continue;
+
+				if (maze->costs[cell - maze->board] < cost)
+					maze->costs[cell - maze->board] = cost;
+			}
+		}
+	}
+}
+
+/*
+ * On a torus the perimeter walls face each other across the edges. Open a
+ * few matching pairs so the wrap around moves lead somewhere. Rows next to
+ * the default start and end cells are left alone.
+ */
+static void maze_create_portals(struct Maze *maze)
+{
+	struct Cell *cell;
+	int num_portals;
+	int level;
+	int row;
+	int col;
+	int i;
+
+	for (level = 0; level < maze->num_levels; level++) {
+		num_portals = MAX(maze->num_rows / 16, 1);
+		for (i = 0; i < num_portals; i++) {
+			row = (maze_random(maze) % (maze->num_rows - 6)) / 2 * 2 + 3;
+
+			cell = maze_get_cell(maze, level, row, 0);
+			cell->type = CELL_TYPE_EMPTY;
+			cell = maze_get_cell(maze, level, row, maze->num_cols - 1);
+			cell->type = CELL_TYPE_EMPTY;
+		}
+
+		num_portals = MAX(maze->num_cols / 16, 1);
+		for (i = 0; i < num_portals; i++) {
+			col = (maze_random(maze) % (maze->num_cols - 2)) / 2 * 2 + 1;
+
+			cell = maze_get_cell(maze, level, 0, col);
+			cell->type = CELL_TYPE_EMPTY;
+			cell = maze_get_cell(maze, level, maze->num_rows - 1, col);
+			cell->type = CELL_TYPE_EMPTY;
+		}
+	}
+}
+
+/*
+ * Rooms are 2 cells apart in a level, and right on top of each other
+ * across levels.
+ */
+static struct Cell *maze_get_neighbour_room(struct Maze *maze,
+					    struct Cell *cell, Direction dir)
+{
+	return maze_get_neighbour_cell_offset(maze, cell, dir,
+					      dir < DIR_NUM_PLANAR_DIRS ? 2 : 1);
+}
+
+/* Open the way from a room to its neighbour room in direction dir */
+static void maze_link_rooms(struct Maze *maze, struct Cell *cell,
+			    struct Cell *n_cell, Direction dir)
+{
+	if (dir == DIR_ABOVE) {
+		/* Link both rooms with stairs */
+		cell->stairs |= CELL_STAIRS_UP;
+		n_cell->stairs |= CELL_STAIRS_DOWN;
+	} else if (dir == DIR_BELOW) {
+		cell->stairs |= CELL_STAIRS_DOWN;
+		n_cell->stairs |= CELL_STAIRS_UP;
+	} else {
+		/* Remove wall between cells */
+		n_cell = maze_get_neighbour_cell(maze, cell, dir);
+		n_cell->value = 1;
+		n_cell->type = CELL_TYPE_EMPTY;
+	}
+}
+
+static int maze_backtracker_begin(struct Maze *maze)
+{
+	struct Cell *cell;
+	int level;
+	int row;
+	int col;
+
+	level = maze_random_level(maze);
+	row = (maze_random(maze) % (maze->num_rows - 2)) / 2 * 2 + 1;
+	col = (maze_random(maze) % (maze->num_cols - 2)) / 2 * 2 + 1;
+	cell = maze_get_cell(maze, level, row, col);
+	if (!cell || cell->type == CELL_TYPE_WALL)
+		return -1;
+
+	cell->value = 1;
+	maze_get_work_list(maze)[0] = cell;
+	maze->gen_stack_len = 1;
+
+	return 0;
+}
+
+/* Carve up to budget rooms, return TRUE while rooms are left */
+static gboolean maze_backtracker_step(struct Maze *maze, int budget)
+{
+	struct Cell *cell;
+	struct Cell *n_cell;
+	struct Cell **stack;
+	int stack_len;
+	int top;
+	int i;
+	Direction dir;
+
+	stack = maze_get_work_list(maze);
+	stack_len = maze->gen_stack_len;
+
+	while (stack_len && budget) {
+		top = stack_len - 1;
+		cell = stack[top];
+
+		dir = maze_random(maze) % maze->num_dirs;
+		i = DIR_FIRST;
+		while (i++ <= maze->num_dirs) {
+			n_cell = maze_get_neighbour_room(maze, cell, dir);
+			if (!n_cell || n_cell->value == 1) {
+				dir = (dir + 1) % maze->num_dirs;
+				continue;
+			}
+
+			n_cell->value = 1;
+			stack[stack_len++] = n_cell;
+
+			maze_link_rooms(maze, cell, n_cell, dir);
+			budget--;
+
+			break;
+		}
+
+		/*
+		 * No more suitable neighbour for this cell. We can remove it
+		 * from the stack
+		 */
+		if (i >= maze->num_dirs)
+			stack[top] = stack[--stack_len];
+	}
+
+	maze->gen_stack_len = stack_len;
+
+	return stack_len != 0;
+}
+
+/*
+ * Hunt-and-kill keeps no stack, only one "unvisited" bit per room in
+ * scan order (level, row, col). Rooms only ever get visited, so the first
+ * unvisited room never moves backwards: the hunt resumes from a cursor and
+ * skips 64 visited rooms per word. The first unvisited room always has a
+ * visited neighbour earlier in scan order (above it, left of it or on the
+ * level below) as long as the walk starts from room 0.
+ */
+#define ROOM_BIT(index) (G_GUINT64_CONSTANT(1) << ((index) & 63))
+
+static int maze_room_index(struct Maze *maze, struct Cell *cell)
+{
+	return (cell->level * (maze->num_rows / 2) + cell->row / 2) *
+	       (maze->num_cols / 2) + cell->col / 2;
+}
+
+static struct Cell *maze_room_cell(struct Maze *maze, int index)
+{
+	int room_rows = maze->num_rows / 2;
+	int room_cols = maze->num_cols / 2;
+
+	return maze_get_cell(maze, index / (room_rows * room_cols),
+			     (index / room_cols) % room_rows * 2 + 1,
+			     index % room_cols * 2 + 1);
+}
+
+static gboolean maze_room_unvisited(struct Maze *maze, guint64 *unvisited,
+				    struct Cell *cell)
+{
+	int index = maze_room_index(maze, cell);
+
+	return !!(unvisited[index / 64] & ROOM_BIT(index));
+}
+
+static void maze_room_visit(struct Maze *maze, guint64 *unvisited,
+			    struct Cell *cell)
+{
+	int index = maze_room_index(maze, cell);
+
+	unvisited[index / 64] &= ~ROOM_BIT(index);
+}
+
+static void maze_hunt_and_kill_begin(struct Maze *maze)
+{
+	guint64 *unvisited;
+	int num_rooms;
+	int num_words;
+
+	num_rooms = maze->num_levels * (maze->num_rows / 2) *
+		    (maze->num_cols / 2);
+	num_words = (num_rooms + 63) / 64;
+
+	unvisited = g_new(guint64, num_words);
+	memset(unvisited, 0xff, num_words * sizeof(guint64));
+	if (num_rooms & 63)
+		unvisited[num_words - 1] = ROOM_BIT(num_rooms) - 1;
+
+	g_free(maze->gen_unvisited);
+	maze->gen_unvisited = unvisited;
+	maze->gen_num_words = num_words;
+	maze->gen_cursor = 0;
+
+	maze->gen_cell = maze_room_cell(maze, 0);
+	maze_room_visit(maze, unvisited, maze->gen_cell);
+}
+
+/* Carve up to budget rooms, return TRUE while rooms are left */
+static gboolean maze_hunt_and_kill_step(struct Maze *maze, int budget)
+{
+	guint64 *unvisited = maze->gen_unvisited;
+	struct Cell *cell = maze->gen_cell;
+	struct Cell *n_cell = NULL;
+	int cursor = maze->gen_cursor;
+	int index;
+	int i;
+	Direction dir;
+
+	for (; budget; budget--) {
+		/* Kill: walk to a random unvisited neighbour room */
+		dir = maze_random(maze) % maze->num_dirs;
+		for (i = 0; i < maze->num_dirs; i++) {
+			n_cell = maze_get_neighbour_room(maze, cell, dir);
+			if (n_cell && maze_room_unvisited(maze, unvisited, n_cell))
+				break;
+
+			dir = (dir + 1) % maze->num_dirs;
+		}
+
+		if (i < maze->num_dirs) {
+			maze_link_rooms(maze, cell, n_cell, dir);
+			maze_room_visit(maze, unvisited, n_cell);
+			cell = n_cell;
+			continue;
+		}
+
+		/* Hunt: first unvisited room, linked to a visited neighbour */
+		while (cursor < maze->gen_num_words && !unvisited[cursor])
+			cursor++;
+
+		if (cursor == maze->gen_num_words) {
+			g_free(maze->gen_unvisited);
+			maze->gen_unvisited = NULL;
+
+			return FALSE;
+		}
+
+		index = cursor * 64 + __builtin_ctzll(unvisited[cursor]);
+		cell = maze_room_cell(maze, index);
+
+		dir = maze_random(maze) % maze->num_dirs;
+		for (i = 0; i < maze->num_dirs; i++) {
+			n_cell = maze_get_neighbour_room(maze, cell, dir);
+			if (n_cell && !maze_room_unvisited(maze, unvisited, n_cell))
+				break;
+
+			dir = (dir + 1) % maze->num_dirs;
+		}
+
+		maze_link_rooms(maze, cell, n_cell, dir);
+		maze_room_visit(maze, unvisited, cell);
+	}
+
+	maze->gen_cell = cell;
+	maze->gen_cursor = cursor;
+
+	return TRUE;
+}
+
+/*
+ * Below that, starting threads costs more than filling the board. The
+ * largest single level boards are a few MiB, well above it.
+ */
+#define MAZE_PARALLEL_INIT_MIN_BYTES (2 << 20)
+
+struct BoardInit {
+	struct Maze *maze;
+	int index;
+	int num_stripes;
+	GThread *thread;
+};
+
+/* Reset the rows [row_start, row_end) of every level to rooms and walls */
+static void maze_init_rows(struct Maze *maze, int row_start, int row_end)
+{
+	struct Cell *cell;
+	int level;
+	int row;
+	int col;
+
+	for (level = 0; level < maze->num_levels; level++) {
+		cell = maze_get_cell(maze, level, row_start, 0);
+		memset(cell, 0, (row_end - row_start) * maze->num_cols *
+				sizeof(struct Cell));
+
+		if (maze->costs)
+			memset(&maze->costs[cell - maze->board], 1,
+			       (row_end - row_start) * maze->num_cols);
+
+		for (row = row_start; row < row_end; row++) {
+			for (col = 0; col < maze->num_cols; col++, cell++) {
+				cell->level = level;
+				cell->row = row;
+				cell->col = col;
+				if ((row & 1) && (col & 1))
+					cell->type = CELL_TYPE_EMPTY;
+				else
+					cell->type = CELL_TYPE_WALL;
+			}
+		}
+	}
+}
+
+static gpointer maze_init_worker(struct BoardInit *init)
+{
+	int row_start;
+	int row_end;
+
+	maze_pin_thread(init->maze, init->index);
+
+	maze_get_stripe_rows(init->maze, init->num_stripes, init->index,
+			     &row_start, &row_end);
+	maze_init_rows(init->maze, row_start, row_end);
+
+	return NULL;
+}
+
+static gboolean maze_init_in_parallel(struct Maze *maze, int num_stripes)
+{
+	return num_stripes > 1 &&
+	       (gsize)maze_num_cells(maze) * sizeof(struct Cell) >=
+	       MAZE_PARALLEL_INIT_MIN_BYTES;
+}
+
+/*
+ * First touch: each stripe of a large board is initialized by its own
+ * thread, so on NUMA machines its pages end up on the node of the thread
+ * that will solve it.
+ */
+static void maze_init_board(struct Maze *maze)
+{
+	struct BoardInit *inits;
+	int num_stripes;
+	int i;
+
+	num_stripes = maze_get_num_stripes(maze);
+	if (!maze_init_in_parallel(maze, num_stripes)) {
+		maze_init_rows(maze, 0, maze->num_rows);
+		return;
+	}
+
+	inits = g_new(struct BoardInit, num_stripes);
+	for (i = 0; i < num_stripes; i++) {
+		inits[i].maze = maze;
+		inits[i].index = i;
+		inits[i].num_stripes = num_stripes;
+		inits[i].thread = g_thread_new("board-init",
+					       (GThreadFunc)maze_init_worker,
+					       &inits[i]);
+	}
+
+	for (i = 0; i < num_stripes; i++)
+		g_thread_join(inits[i].thread);
+
+	g_free(inits);
+}
+
+/* Print how the board pages are spread over the NUMA nodes */
+void maze_print_numa_report(struct Maze *maze)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+	int pages_per_node[MAZE_MAX_NUMA_NODES] = { 0 };
+	int num_unplaced = 0;
+	long page_size;
+	void **pages;
+	int *status;
+	char *start;
+	char *end;
+	long num_pages;
+	long i;
+
+	if (!maze->board)
+		return;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	start = (char *)((guintptr)maze->board & ~(page_size - 1));
+	end = (char *)(maze->board + maze_num_cells(maze));
+	num_pages = (end - start + page_size - 1) / page_size;
+
+	pages = g_new(void *, num_pages);
+	status = g_new(int, num_pages);
+	for (i = 0; i < num_pages; i++)
+		pages[i] = start + i * page_size;
+
+	/* With no target nodes, move_pages() only reports where pages are */
+	if (syscall(SYS_move_pages, 0, num_pages, pages, NULL, status, 0)) {
+		g_fprintf(stderr, "move_pages failed\n");
+		goto exit;
+	}
+
+	for (i = 0; i < num_pages; i++) {
+		if (status[i] >= 0 && status[i] < MAZE_MAX_NUMA_NODES)
+			pages_per_node[status[i]]++;
+		else
+			num_unplaced++;
+	}
+
+	g_printf("Board: %ld pages of %ld bytes\n", num_pages, page_size);
+	for (i = 0; i < MAZE_MAX_NUMA_NODES; i++) {
+		if (pages_per_node[i])
+			g_printf("  node %ld: %d pages (%.01f%%)\n", i,
+				 pages_per_node[i],
+				 100.0 * pages_per_node[i] / num_pages);
+	}
+
+	if (num_unplaced)
+		g_printf("  not placed: %d pages\n", num_unplaced);
+
+exit:
+	g_free(pages);
+	g_free(status);
+#else
+	g_fprintf(stderr, "NUMA report not supported on this platform\n");
+#endif
+}
+
+/* Exits, terrain, portals and extra openings, once every room is linked */
+static void maze_generate_finish(struct Maze *maze)
+{
+	struct Cell *cell;
+	struct Cell *n_cell;
+	int level;
+	int row;
+	int col;
+	int r;
+	int i;
+
+	maze->start_cell = maze_get_cell(maze, 0, 1, 0);
+	maze->end_cell = maze_get_cell(maze, maze->num_levels - 1,
+				       maze->num_rows - 2, maze->num_cols - 1);
+	maze_mark_endpoints(maze);
+
+	if (maze->costs)
+		maze_create_terrain(maze);
+
+	if (maze->topology == TOPOLOGY_TORUS)
+		maze_create_portals(maze);
+
+	if (!maze->complex)
+		return;
+
+	for (i = 0; i < MAX(maze->num_rows, maze->num_cols) * maze->num_levels; i++) {
+		while (1) {
+			level = maze_random_level(maze);
+			row = (maze_random(maze) % (maze->num_rows - 2)) + 1;
+			col = (maze_random(maze) % (maze->num_cols - 2)) + 1;
+			cell = maze_get_cell(maze, level, row, col);
+
+			if (cell->type != CELL_TYPE_WALL)
+				continue;
+
+			r = 0;
+			n_cell = maze_get_neighbour_cell(maze, cell, DIR_UP);
+			if (n_cell && n_cell->type == CELL_TYPE_WALL)
+				r++;
+			n_cell = maze_get_neighbour_cell(maze, cell, DIR_DOWN);
+			if (n_cell && n_cell->type == CELL_TYPE_WALL)
+				r++;
+			/*
+			 * Only 1 wall up or down means we're on a wall end or
+			 * at the top of a T. Try with another wall.
+			 */
+			if (r == 1)
+				continue;
+
+			n_cell = maze_get_neighbour_cell(maze, cell, DIR_LEFT);
+			if (n_cell && n_cell->type == CELL_TYPE_WALL)
+				r++;
+			n_cell = maze_get_neighbour_cell(maze, cell, DIR_RIGHT);
+			if (n_cell && n_cell->type == CELL_TYPE_WALL)
+				r++;
+
+			/*
+			 * We're surounded by 2 walls verticaly or horizontaly.
+			 * It's a match.
+			 */
+			if (r == 2)
+				break;
+		}
+
+		/* Remove that wall */
+		cell->type = CELL_TYPE_EMPTY;
+	}
+}
+
+/*
+ * Size the board and the cost plane for the given dimensions, keeping the
+ * buffers when they are large enough. Cells are left uninitialized and
+ * snapshot pages of the previous layout are dropped.
+ */
+static void maze_resize_board(struct Maze *maze, int num_levels, int num_rows,
+			      int num_cols)
+{
+	int num_cells;
+
+	num_cells = num_levels * num_rows * num_cols;
+
+	/* The cost plane has the size of the board, even a compact one */
+	if (maze->board_size < num_cells) {
+		g_free(maze->board);
+		g_free(maze->cost_plane);
+		maze->board = NULL;
+		maze->cost_plane = NULL;
+	}
+
+	maze->num_levels = num_levels;
+	maze->num_rows = num_rows;
+	maze->num_cols = num_cols;
+	maze_init_strides(maze);
+
+	if (!maze->board) {
+		maze->board_size = MAX(maze->board_size, num_cells);
+		maze->board = g_malloc(maze->board_size * sizeof(struct Cell));
+	}
+
+	maze->costs = NULL;
+	if (maze->max_cost > 1) {
+		if (!maze->cost_plane)
+			maze->cost_plane = g_malloc(maze->board_size);
+
+		maze->costs = maze->cost_plane;
+	}
+
+	maze_drop_pages(maze);
+}
+
+int maze_generate_begin(struct Maze *maze, int num_levels, int num_rows,
+			int num_cols, gboolean complex)
+{
+	int err = 0;
+
+	if (maze->solver_status == RUNNING)
+		return -1;
+
+	num_levels = CLAMP(num_levels, MAZE_MIN_LEVELS, MAZE_MAX_LEVELS);
+
+	if (num_rows < MAZE_MIN_ROWS)
+		num_rows = MAZE_MIN_ROWS;
+	else if (num_rows > MAZE_MAX_ROWS)
+		num_rows = MAZE_MAX_ROWS;
+	else if ((num_rows & 1) == 0)
+		num_rows++;
+
+	if (num_cols < MAZE_MIN_COLS)
+		num_cols = MAZE_MIN_COLS;
+	else if (num_cols > MAZE_MAX_COLS)
+		num_cols = MAZE_MAX_COLS;
+	else if ((num_cols & 1) == 0)
+		num_cols++;
+
+	maze->complex = complex;
+	maze_compact_free(maze);
+	maze_resize_board(maze, num_levels, num_rows, num_cols);
+	maze_init_board(maze);
+
+	maze->layout_version++;
+	maze_journal_clear(maze);
+
+	/* No start, end or exits until the generation is finished */
+	g_list_free(maze->exits);
+	maze->exits = NULL;
+	maze->start_cell = NULL;
+	maze->end_cell = NULL;
+
+	if (maze->generator == GENERATOR_HUNT_AND_KILL)
+		maze_hunt_and_kill_begin(maze);
+	else
+		err = maze_backtracker_begin(maze);
+
+	maze->generating = !err;
+
+	return err;
+}
+
+/*
+ * Carve up to budget more rooms of the maze set up by maze_generate_begin().
+ * Return 1 while the generation is in progress, 0 once the maze is complete
+ * and -1 if no generation was started.
+ */
+int maze_generate_step(struct Maze *maze, int budget)
+{
+	gboolean more;
+
+	if (!maze->generating)
+		return -1;
+
+	if (maze->generator == GENERATOR_HUNT_AND_KILL)
+		more = maze_hunt_and_kill_step(maze, budget);
+	else
+		more = maze_backtracker_step(maze, budget);
+
+	if (more)
+		return 1;
+
+	maze->generating = FALSE;
+	maze_generate_finish(maze);
+
+#ifdef MAZE_DEBUG
+	maze_debug_validate(maze);
+#endif
+
+	return 0;
+}
+
+gboolean maze_generating(struct Maze *maze)
+{
+	return maze->generating;
+}
+
+int maze_create(struct Maze *maze, int num_levels, int num_rows, int num_cols,
+		gboolean complex)
+{
+	int err;
+
+	err = maze_generate_begin(maze, num_levels, num_rows, num_cols, complex);
+	if (err)
+		return err;
+
+	return maze_generate_step(maze, G_MAXINT);
+}
+
+/* Cell k of the perimeter of level 0, clockwise from the top left corner */
+static struct Cell *maze_perimeter_cell(struct Maze *maze, int k)
+{
+	int num_rows = maze->num_rows;
+	int num_cols = maze->num_cols;
+
+	if (k < num_cols)
+		return maze_get_cell(maze, 0, 0, k);
+	k -= num_cols;
+
+	if (k < num_rows - 1)
+		return maze_get_cell(maze, 0, k + 1, num_cols - 1);
+	k -= num_rows - 1;
+
+	if (k < num_cols - 1)
+		return maze_get_cell(maze, 0, num_rows - 1, num_cols - 2 - k);
+	k -= num_cols - 1;
+
+	return maze_get_cell(maze, 0, num_rows - 2 - k, 0);
+}
+
+/*
+ * Close the perimeter and return the middle cell of each of its openings
+ * in openings, which must hold the whole perimeter.
+ */
+static int maze_close_perimeter(struct Maze *maze, struct Cell **openings)
+{
+	struct Cell *cell;
+	int num_openings = 0;
+	int perimeter;
+	int first = -1;
+	int k;
+
+	perimeter = 2 * (maze->num_rows + maze->num_cols) - 4;
+
+	for (k = 0; k <= perimeter; k++) {
+		cell = k < perimeter ? maze_perimeter_cell(maze, k) : NULL;
+
+		if (cell && cell->type != CELL_TYPE_WALL) {
+			if (first < 0)
+				first = k;
+			cell->type = CELL_TYPE_WALL;
+		} else if (first >= 0) {
+			openings[num_openings++] =
+				maze_perimeter_cell(maze, (first + k - 1) / 2);
+			first = -1;
+		}
+	}
+
+	return num_openings;
+}
+
+/*
+ * Replace the maze with a single level of num_rows x num_cols cells, the
+ * non zero bytes of layout being walls. The perimeter is closed except
+ * for its openings: the first one clockwise from the top left corner
+ * becomes the start, the next one the end and the others exits. Missing
+ * endpoints go to the first and last empty inner cells.
+ */
+int maze_set_layout(struct Maze *maze, int num_rows, int num_cols,
+		    const guint8 *layout)
+{
+	struct Cell **openings;
+	struct Cell *cell;
+	int num_openings;
+	int num_empty = 0;
+	int row;
+	int col;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
 
-		cell = g_queue_pop_head(queue);
+	if (num_rows < MAZE_MIN_ROWS || num_rows > MAZE_MAX_ROWS ||
+	    num_cols < MAZE_MIN_COLS || num_cols > MAZE_MAX_COLS)
+		return -1;
 
-		if (cell == maze->end_cell)
-			break;
+	for (row = 1; row < num_rows - 1; row++)
+		for (col = 1; col < num_cols - 1; col++)
+			if (!layout[row * num_cols + col])
+				num_empty++;
 
-		cell->type = CELL_TYPE_PATH_VISITED;
+	/* Room for both endpoints, whatever the perimeter looks like */
+	if (num_empty < 2)
+		return -1;
+
+	maze_compact_free(maze);
+	maze_resize_board(maze, 1, num_rows, num_cols);
+	maze_init_board(maze);
+
+	/* Nothing says a drawn maze has a single path */
+	maze->complex = TRUE;
+
+	for (i = 0; i < num_rows * num_cols; i++)
+		maze->board[i].type = layout[i] ? CELL_TYPE_WALL :
+						  CELL_TYPE_EMPTY;
+
+	g_list_free(maze->exits);
+	maze->exits = NULL;
+
+	openings = maze_get_work_list(maze);
+	num_openings = maze_close_perimeter(maze, openings);
+
+	maze->start_cell = NULL;
+	maze->end_cell = NULL;
+	if (num_openings > 0)
+		maze->start_cell = openings[0];
+	if (num_openings > 1)
+		maze->end_cell = openings[1];
+	for (i = num_openings - 1; i > 1; i--)
+		maze->exits = g_list_prepend(maze->exits, openings[i]);
+
+	for (row = 1; row < num_rows - 1; row++) {
+		for (col = 1; col < num_cols - 1; col++) {
+			cell = maze_get_cell(maze, 0, row, col);
+			if (cell->type != CELL_TYPE_EMPTY)
+				continue;
+
+			if (!maze->start_cell)
+				maze->start_cell = cell;
+			else if (!maze->end_cell || num_openings < 2)
+				maze->end_cell = cell;
+		}
+	}
+	maze_mark_endpoints(maze);
+
+	maze->layout_version++;
+	maze_journal_clear(maze);
+
+	return 0;
+}
+
+struct Maze *maze_alloc(void)
+{
+	struct Maze *maze;
+
+	maze = g_malloc0(sizeof(*maze));
+	maze->async_fd[0] = -1;
+	maze->async_fd[1] = -1;
+
+	return maze;
+}
+
+/*
+ * Bytes held by the board and the solver and generator scratch buffers.
+ * The lists of the A Star and DFS solvers are not accounted.
+ */
+gsize maze_get_memory_usage(struct Maze *maze)
+{
+	gsize size;
+
+	size = 0;
+	if (maze->board)
+		size += (gsize)maze->board_size * sizeof(struct Cell);
+	if (maze->compact)
+		size += maze_compact_size(maze->compact);
+	if (maze->cost_plane)
+		size += maze->board_size;
+	size += (gsize)maze->work_size * sizeof(struct Cell *);
+	size += (gsize)maze->goal_dist_size * sizeof(guint32);
+	if (maze->gen_unvisited)
+		size += (gsize)maze->gen_num_words * sizeof(guint64);
+
+	return size;
+}
+
+/*
+ * Independent copy of the maze layout, endpoints and settings, with an
+ * idle solver. The random generator is not copied.
+ */
+struct Maze *maze_dup(struct Maze *maze)
+{
+	struct Maze *dup;
+	GList *elem;
+	int num_cells;
+	int i;
+
+	if (maze->generating)
+		return NULL;
+
+	maze_expand(maze);
+	if (!maze->board)
+		return NULL;
+
+	num_cells = maze_num_cells(maze);
+
+	dup = maze_alloc();
+	dup->num_levels = maze->num_levels;
+	dup->num_rows = maze->num_rows;
+	dup->num_cols = maze->num_cols;
+	dup->complex = maze->complex;
+	dup->anim_speed = maze->anim_speed;
+	dup->topology = maze->topology;
+	dup->max_cost = maze->max_cost;
+	dup->generator = maze->generator;
+	dup->num_threads = maze->num_threads;
+	dup->pin_threads = maze->pin_threads;
+	dup->solver_algorithm = maze->solver_algorithm;
+	maze_init_strides(dup);
+
+	dup->board = g_new(struct Cell, num_cells);
+	dup->board_size = num_cells;
+	memcpy(dup->board, maze->board, num_cells * sizeof(struct Cell));
+
+	/* The solver scratch in the cells points into the original board */
+	for (i = 0; i < num_cells; i++)
+		dup->board[i].parent = NULL;
+
+	if (maze->costs) {
+		dup->cost_plane = g_malloc(num_cells);
+		dup->costs = dup->cost_plane;
+		memcpy(dup->costs, maze->costs, num_cells);
+	}
+
+	dup->start_cell = dup->board + (maze->start_cell - maze->board);
+	dup->end_cell = dup->board + (maze->end_cell - maze->board);
+	for (elem = maze->exits; elem; elem = elem->next)
+		dup->exits = g_list_append(dup->exits, dup->board +
+					   ((struct Cell *)elem->data - maze->board));
+
+	return dup;
+}
+
+struct MazeSnapshot {
+	gint refcount;
+
+	int num_levels;
+	int num_rows;
+	int num_cols;
+	gboolean complex;
+	MazeTopology topology;
+	uint max_cost;
+
+	/* Board indexes of the endpoints */
+	int start;
+	int end;
+	int *exits;
+	int num_exits;
+
+	struct MazePage **pages;
+	int num_pages;
+};
+
+static struct MazePage *maze_page_capture(struct Maze *maze, int index)
+{
+	struct MazePage *page;
+	struct Cell *cell;
+	int first;
+	int num;
+	int i;
+
+	first = index << MAZE_PAGE_SHIFT;
+	num = MIN(MAZE_PAGE_CELLS, maze_num_cells(maze) - first);
+
+	page = g_new(struct MazePage, 1);
+	page->refcount = 1;
+
+	for (i = 0; i < num; i++) {
+		cell = &maze->board[first + i];
+		page->layout[i] = maze_cell_layout(cell);
+		page->costs[i] = maze->costs ? maze->costs[first + i] : 1;
+	}
+
+	return page;
+}
+
+/* Rebuild the board cells of a page, with no solver state */
+static void maze_page_apply(struct Maze *maze, int index, struct MazePage *page)
+{
+	struct Cell *cell;
+	int first;
+	int num;
+	int level;
+	int row;
+	int col;
+	int i;
+
+	first = index << MAZE_PAGE_SHIFT;
+	num = MIN(MAZE_PAGE_CELLS, maze_num_cells(maze) - first);
+
+	col = first % maze->num_cols;
+	row = first / maze->num_cols % maze->num_rows;
+	level = first / (maze->num_cols * maze->num_rows);
+
+	for (i = 0; i < num; i++) {
+		cell = &maze->board[first + i];
+		cell->level = level;
+		cell->row = row;
+		cell->col = col;
+		maze_cell_set_layout(cell, page->layout[i]);
+
+		if (maze->costs)
+			maze->costs[first + i] = page->costs[i];
+
+		if (++col == maze->num_cols) {
+			col = 0;
+			if (++row == maze->num_rows) {
+				row = 0;
+				level++;
+			}
+		}
+	}
+}
+
+/*
+ * Capture the layout and endpoints of the maze. Pages left untouched since
+ * the previous snapshot are shared with it, so taking a snapshot costs a
+ * pointer per page plus a copy of the edited pages only.
+ */
+struct MazeSnapshot *maze_snapshot(struct Maze *maze)
+{
+	struct MazeSnapshot *snap;
+	GList *elem;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return NULL;
+
+	maze_expand(maze);
+	if (!maze->board)
+		return NULL;
+
+	if (!maze->pages) {
+		maze->num_pages = (maze_num_cells(maze) + MAZE_PAGE_CELLS - 1) >>
+				  MAZE_PAGE_SHIFT;
+		maze->pages = g_new0(struct MazePage *, maze->num_pages);
+		maze->page_dirty = g_new0(guint8, maze->num_pages);
+	}
+
+	snap = g_new0(struct MazeSnapshot, 1);
+	snap->refcount = 1;
+	snap->num_levels = maze->num_levels;
+	snap->num_rows = maze->num_rows;
+	snap->num_cols = maze->num_cols;
+	snap->complex = maze->complex;
+	snap->topology = maze->topology;
+	snap->max_cost = maze->max_cost;
+
+	snap->num_pages = maze->num_pages;
+	snap->pages = g_new(struct MazePage *, snap->num_pages);
+	for (i = 0; i < maze->num_pages; i++) {
+		if (!maze->pages[i] || maze->page_dirty[i]) {
+			maze_page_unref(maze->pages[i]);
+			maze->pages[i] = maze_page_capture(maze, i);
+			maze->page_dirty[i] = 0;
+		}
+
+		snap->pages[i] = maze_page_ref(maze->pages[i]);
+	}
+
+	snap->start = maze->start_cell - maze->board;
+	snap->end = maze->end_cell - maze->board;
+	snap->num_exits = g_list_length(maze->exits);
+	snap->exits = g_new(int, snap->num_exits);
+	for (elem = maze->exits, i = 0; elem; elem = elem->next, i++)
+		snap->exits[i] = (struct Cell *)elem->data - maze->board;
+
+	return snap;
+}
+
+struct MazeSnapshot *maze_snapshot_ref(struct MazeSnapshot *snap)
+{
+	g_atomic_int_inc(&snap->refcount);
+
+	return snap;
+}
+
+void maze_snapshot_unref(struct MazeSnapshot *snap)
+{
+	int i;
+
+	if (!snap || !g_atomic_int_dec_and_test(&snap->refcount))
+		return;
+
+	for (i = 0; i < snap->num_pages; i++)
+		maze_page_unref(snap->pages[i]);
+
+	g_free(snap->pages);
+	g_free(snap->exits);
+	g_free(snap);
+}
+
+/*
+ * Bring the maze back to a snapshot, of this maze or of any other one.
+ * Only the pages which differ from the snapshot are copied back, and the
+ * solver state of the other cells is kept.
+ */
+int maze_restore_snapshot(struct Maze *maze, struct MazeSnapshot *snap)
+{
+	GList *elem;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	maze_expand(maze);
+
+	/* The old endpoints go back to walls or empty cells */
+	if (maze->board) {
+		maze_cell_reset(maze, maze->start_cell);
+		maze_touch_cell(maze, maze->start_cell);
+		maze_cell_reset(maze, maze->end_cell);
+		maze_touch_cell(maze, maze->end_cell);
+		for (elem = maze->exits; elem; elem = elem->next) {
+			maze_cell_reset(maze, elem->data);
+			maze_touch_cell(maze, elem->data);
+		}
+	}
+
+	g_list_free(maze->exits);
+	maze->exits = NULL;
+
+	maze->complex = snap->complex;
+	maze->topology = snap->topology;
+
+	if (!maze->board || maze->num_levels != snap->num_levels ||
+	    maze->num_rows != snap->num_rows ||
+	    maze->num_cols != snap->num_cols ||
+	    !maze->costs != (snap->max_cost <= 1)) {
+		maze->max_cost = snap->max_cost;
+		maze_resize_board(maze, snap->num_levels, snap->num_rows,
+				  snap->num_cols);
+	}
+	maze->max_cost = snap->max_cost;
+
+	if (!maze->pages) {
+		maze->num_pages = snap->num_pages;
+		maze->pages = g_new0(struct MazePage *, maze->num_pages);
+		maze->page_dirty = g_new0(guint8, maze->num_pages);
+	}
+
+	for (i = 0; i < snap->num_pages; i++) {
+		if (maze->pages[i] == snap->pages[i] && !maze->page_dirty[i])
+			continue;
+
+		maze_page_apply(maze, i, snap->pages[i]);
+
+		maze_page_unref(maze->pages[i]);
+		maze->pages[i] = maze_page_ref(snap->pages[i]);
+		maze->page_dirty[i] = 0;
+	}
+
+	maze->start_cell = &maze->board[snap->start];
+	maze->end_cell = &maze->board[snap->end];
+	for (i = snap->num_exits - 1; i >= 0; i--)
+		maze->exits = g_list_prepend(maze->exits,
+					     &maze->board[snap->exits[i]]);
+	maze_mark_endpoints(maze);
+
+	maze->layout_version++;
+	maze_journal_clear(maze);
+
+	return 0;
+}
+
+/*
+ * Maze files are little-endian: the magic, then MAZE_FILE_HEADER_WORDS
+ * words (version, levels, rows, cols, topology, max_cost, complex, start,
+ * end, number of exits), the board index of each exit, one layout byte per
+ * cell and, when max_cost > 1, one cost byte per cell.
+ */
+#define MAZE_FILE_MAGIC		"CMAZ"
+#define MAZE_FILE_VERSION	1
+#define MAZE_FILE_HEADER_WORDS	10
+
+/*
+ * Journal files hold the applied edits of a maze: the magic, the version,
+ * the maze dimensions, the number of entries and three words per entry
+ * (op and flags, from, to).
+ */
+#define MAZE_JOURNAL_MAGIC		"CMZJ"
+#define MAZE_JOURNAL_VERSION		1
+#define MAZE_JOURNAL_HEADER_WORDS	5
+#define MAZE_JOURNAL_ENTRY_WORDS	3
+#define MAZE_JOURNAL_CHUNK		1024
+
+static int maze_write_words(FILE *file, guint32 *words, int num_words)
+{
+	int i;
+
+	for (i = 0; i < num_words; i++)
+		words[i] = GUINT32_TO_LE(words[i]);
+
+	if (fwrite(words, sizeof(guint32), num_words, file) != num_words)
+		return -1;
+
+	return 0;
+}
+
+static int maze_read_words(FILE *file, guint32 *words, int num_words)
+{
+	int i;
+
+	if (fread(words, sizeof(guint32), num_words, file) != num_words)
+		return -1;
+
+	for (i = 0; i < num_words; i++)
+		words[i] = GUINT32_FROM_LE(words[i]);
+
+	return 0;
+}
+
+int maze_save(struct Maze *maze, const char *filename)
+{
+	guint32 header[MAZE_FILE_HEADER_WORDS];
+	guint32 *exits = NULL;
+	guint8 *layout = NULL;
+	GList *elem;
+	FILE *file;
+	int num_exits;
+	int num_cells;
+	int err = -1;
+	int i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	maze_expand(maze);
+	if (!maze->board)
+		return -1;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return -1;
+
+	num_cells = maze_num_cells(maze);
+	num_exits = g_list_length(maze->exits);
+
+	header[0] = MAZE_FILE_VERSION;
+	header[1] = maze->num_levels;
+	header[2] = maze->num_rows;
+	header[3] = maze->num_cols;
+	header[4] = maze->topology;
+	/* A limit raised after generation has no cost plane to go with it */
+	header[5] = maze->costs ? maze->max_cost : 0;
+	header[6] = maze->complex;
+	header[7] = maze->start_cell - maze->board;
+	header[8] = maze->end_cell - maze->board;
+	header[9] = num_exits;
+
+	exits = g_new(guint32, num_exits + 1);
+	for (elem = maze->exits, i = 0; elem; elem = elem->next, i++)
+		exits[i] = (struct Cell *)elem->data - maze->board;
+
+	layout = g_malloc(num_cells);
+	for (i = 0; i < num_cells; i++)
+		layout[i] = maze_cell_layout(&maze->board[i]);
+
+	if (fwrite(MAZE_FILE_MAGIC, 4, 1, file) != 1 ||
+	    maze_write_words(file, header, MAZE_FILE_HEADER_WORDS) ||
+	    maze_write_words(file, exits, num_exits) ||
+	    fwrite(layout, 1, num_cells, file) != num_cells)
+		goto exit;
+
+	if (maze->costs && fwrite(maze->costs, 1, num_cells, file) != num_cells)
+		goto exit;
+
+	err = 0;
+
+exit:
+	g_free(exits);
+	g_free(layout);
+	if (fclose(file))
+		err = -1;
+
+	return err;
+}
+
+/*
+ * Endpoints and exits are stored open. Like maze_set_start_cell(), one on
+ * the perimeter has to lead into the maze through an open neighbour.
+ */
+static gboolean maze_file_endpoint_valid(const guint8 *layout,
+					 guint32 num_rows, guint32 num_cols,
+					 guint32 index)
+{
+	guint32 row = index / num_cols % num_rows;
+	guint32 col = index % num_cols;
+
+	if (layout[index] & CELL_LAYOUT_WALL)
+		return FALSE;
+
+	if (row > 0 && row < num_rows - 1 && col > 0 && col < num_cols - 1)
+		return TRUE;
+
+	return (row > 0 && !(layout[index - num_cols] & CELL_LAYOUT_WALL)) ||
+	       (row < num_rows - 1 &&
+		!(layout[index + num_cols] & CELL_LAYOUT_WALL)) ||
+	       (col > 0 && !(layout[index - 1] & CELL_LAYOUT_WALL)) ||
+	       (col < num_cols - 1 && !(layout[index + 1] & CELL_LAYOUT_WALL));
+}
+
+/*
+ * Replace the maze with the one saved in filename. The maze is left
+ * untouched if the file can't be read or is invalid.
+ */
+int maze_load(struct Maze *maze, const char *filename)
+{
+	guint32 header[MAZE_FILE_HEADER_WORDS];
+	guint32 *exits = NULL;
+	guint8 *layout = NULL;
+	guint8 *costs = NULL;
+	char magic[4];
+	FILE *file;
+	guint32 num_levels;
+	guint32 num_rows;
+	guint32 num_cols;
+	guint32 num_cells;
+	guint32 num_exits;
+	guint32 level;
+	int stairs;
+	int err = -1;
+	guint32 i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return -1;
+
+	if (fread(magic, 4, 1, file) != 1 ||
+	    memcmp(magic, MAZE_FILE_MAGIC, 4) ||
+	    maze_read_words(file, header, MAZE_FILE_HEADER_WORDS) ||
+	    header[0] != MAZE_FILE_VERSION)
+		goto exit;
+
+	num_levels = header[1];
+	num_rows = header[2];
+	num_cols = header[3];
+	num_exits = header[9];
+
+	if (num_levels < MAZE_MIN_LEVELS || num_levels > MAZE_MAX_LEVELS ||
+	    num_rows < MAZE_MIN_ROWS || num_rows > MAZE_MAX_ROWS ||
+	    num_cols < MAZE_MIN_COLS || num_cols > MAZE_MAX_COLS ||
+	    header[4] >= TOPOLOGY_NUM || header[5] > MAZE_MAX_COST)
+		goto exit;
+
+	num_cells = num_levels * num_rows * num_cols;
+	if (header[7] >= num_cells || header[8] >= num_cells ||
+	    header[7] == header[8] || num_exits >= num_cells)
+		goto exit;
+
+	exits = g_new(guint32, num_exits + 1);
+	if (maze_read_words(file, exits, num_exits))
+		goto exit;
+
+	for (i = 0; i < num_exits; i++) {
+		if (exits[i] >= num_cells || exits[i] == header[7] ||
+		    exits[i] == header[8])
+			goto exit;
+	}
+
+	layout = g_malloc(num_cells);
+	if (fread(layout, 1, num_cells, file) != num_cells)
+		goto exit;
+
+	/* Stairs have to lead to another level */
+	for (i = 0; i < num_cells; i++) {
+		level = i / (num_rows * num_cols);
+		stairs = layout[i] >> CELL_LAYOUT_STAIRS_SHIFT;
+		if ((stairs & ~(CELL_STAIRS_UP | CELL_STAIRS_DOWN)) ||
+		    ((stairs & CELL_STAIRS_UP) && level == num_levels - 1) ||
+		    ((stairs & CELL_STAIRS_DOWN) && level == 0))
+			goto exit;
+	}
+
+	if (!maze_file_endpoint_valid(layout, num_rows, num_cols, header[7]) ||
+	    !maze_file_endpoint_valid(layout, num_rows, num_cols, header[8]))
+		goto exit;
+
+	for (i = 0; i < num_exits; i++) {
+		if (!maze_file_endpoint_valid(layout, num_rows, num_cols,
+					      exits[i]))
+			goto exit;
+	}
 
-		for (i = 0; i < 4; i++) {
-			n_cell = maze_get_neighbour_cell(maze, cell, i);
-			if (!n_cell || n_cell->type == CELL_TYPE_WALL || n_cell->value)
-				continue;
+	if (header[5] > 1) {
+		costs = g_malloc(num_cells);
+		if (fread(costs, 1, num_cells, file) != num_cells)
+			goto exit;
 
-			n_cell->value = cell->value + 1;
-			n_cell->type = CELL_TYPE_PATH_HEAD;
-			g_queue_push_tail(queue, n_cell);
+		/* The solver buckets are sized after max_cost */
+		for (i = 0; i < num_cells; i++) {
+			if (!(layout[i] & CELL_LAYOUT_WALL) &&
+			    (costs[i] < 1 || costs[i] > header[5]))
+				goto exit;
 		}
 	}
 
-	maze_set_solution_path(maze);
+	maze->topology = header[4];
+	maze->max_cost = header[5];
+	maze->complex = header[6];
+	maze_compact_free(maze);
+	maze_resize_board(maze, num_levels, num_rows, num_cols);
+	maze_init_board(maze);
+
+	for (i = 0; i < num_cells; i++)
+		maze_cell_set_layout(&maze->board[i], layout[i]);
+	if (costs)
+		memcpy(maze->costs, costs, num_cells);
+
+	g_list_free(maze->exits);
+	maze->exits = NULL;
+	maze->start_cell = &maze->board[header[7]];
+	maze->end_cell = &maze->board[header[8]];
+	for (i = num_exits; i > 0; i--) {
+		if (!g_list_find(maze->exits, &maze->board[exits[i - 1]]))
+			maze->exits = g_list_prepend(maze->exits,
+						     &maze->board[exits[i - 1]]);
+	}
+	maze_mark_endpoints(maze);
+
+	maze->layout_version++;
+	maze_journal_clear(maze);
+
+	err = 0;
 
 exit:
-	g_queue_free(queue);
+	g_free(exits);
+	g_free(layout);
+	g_free(costs);
+	fclose(file);
 
 	return err;
 }
 
-static void maze_solve_thread_join(struct Maze *maze)
+/* Save the applied edits, to replay them on the maze they were made on */
+int maze_journal_save(struct Maze *maze, const char *filename)
 {
-	if (!maze->solver_thread)
-		return;
+	guint32 header[MAZE_JOURNAL_HEADER_WORDS];
+	guint32 entry[MAZE_JOURNAL_ENTRY_WORDS];
+	struct MazeDelta *delta;
+	FILE *file;
+	int err = -1;
+	guint i;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return -1;
 
-	g_thread_join(maze->solver_thread);
-	maze->solver_thread = NULL;
+	header[0] = MAZE_JOURNAL_VERSION;
+	header[1] = maze->num_levels;
+	header[2] = maze->num_rows;
+	header[3] = maze->num_cols;
+	header[4] = maze->journal_pos;
+
+	if (fwrite(MAZE_JOURNAL_MAGIC, 4, 1, file) != 1 ||
+	    maze_write_words(file, header, MAZE_JOURNAL_HEADER_WORDS))
+		goto exit;
+
+	for (i = 0; i < maze->journal_pos; i++) {
+		delta = &g_array_index(maze->journal, struct MazeDelta, i);
+		entry[0] = delta->op | delta->flags << 8;
+		entry[1] = delta->from;
+		entry[2] = delta->to;
+		if (maze_write_words(file, entry, MAZE_JOURNAL_ENTRY_WORDS))
+			goto exit;
+	}
+
+	err = 0;
+
+exit:
+	if (fclose(file))
+		err = -1;
+
+	return err;
 }
 
-static gboolean maze_solve_monitor(struct Maze *maze)
+/*
+ * Apply one journal file entry through the public API, so it is checked
+ * against the maze and journaled again.
+ */
+static int maze_journal_replay_entry(struct Maze *maze, const guint32 *entry)
 {
-	int reason;
+	struct Cell *cell;
+	guint journal_pos;
+	guint8 flags;
+	int err;
 
+	if (entry[1] >= maze_num_cells(maze) || entry[2] >= maze_num_cells(maze))
+		return -1;
 
-	switch (maze->solver_status) {
-	case RUNNING:
-		reason = SOLVER_CB_REASON_RUNNING;
+	cell = &maze->board[entry[2]];
+	flags = entry[0] >> 8;
+	journal_pos = maze->journal_pos;
+
+	switch (entry[0] & 0xff) {
+	case MAZE_DELTA_START:
+		if (&maze->board[entry[1]] != maze->start_cell)
+			return -1;
+		err = maze_set_start_cell(maze, cell->level, cell->row,
+					  cell->col);
 		break;
-	case CANCELED:
-		reason = SOLVER_CB_REASON_CANCELED;
+	case MAZE_DELTA_END:
+		if (&maze->board[entry[1]] != maze->end_cell)
+			return -1;
+		err = maze_set_end_cell(maze, cell->level, cell->row,
+					cell->col);
 		break;
-	case SOLVED:
-		reason = SOLVER_CB_REASON_SOLVED;
+	case MAZE_DELTA_ADD_EXIT:
+		err = maze_add_exit(maze, cell->level, cell->row, cell->col);
 		break;
-	case UNSOLVABLE:
-		reason = SOLVER_CB_REASON_INFLOOP;
+	case MAZE_DELTA_REMOVE_EXIT:
+		err = maze_remove_exit(maze, cell->level, cell->row, cell->col);
 		break;
-	case STOPPED:
+	case MAZE_DELTA_WALL:
+		err = maze_set_wall(maze, cell->level, cell->row, cell->col,
+				    flags & MAZE_DELTA_FLAG_WALL);
 		break;
+	default:
+		return -1;
 	}
 
-	if (maze->solver_cb)
-		maze->solver_cb(reason, maze->solver_cb_userdata);
+	/* An entry which changes nothing doesn't belong to this maze */
+	if (err || maze->journal_pos == journal_pos)
+		return -1;
 
-	if (reason == SOLVER_CB_REASON_SOLVED)
-		maze_solve_thread_join(maze);
+	/* Keep the undo steps of the recorded session */
+	if (flags & MAZE_DELTA_FLAG_CHAINED)
+		g_array_index(maze->journal, struct MazeDelta,
+			      maze->journal_pos - 1).flags |=
+			MAZE_DELTA_FLAG_CHAINED;
 
-	return (maze->solver_status == RUNNING);
+	return 0;
 }
 
-void maze_solve_thread_cancel(struct Maze *maze)
+/*
+ * Replay the edits saved by maze_journal_save() on top of the current
+ * maze. They can then be undone like any other edit. Stops at the first
+ * entry which doesn't apply to the maze.
+ */
+int maze_journal_replay(struct Maze *maze, const char *filename)
 {
-	maze->solver_status = CANCELED;
+	guint32 header[MAZE_JOURNAL_HEADER_WORDS];
+	guint32 *entries;
+	char magic[4];
+	FILE *file;
+	guint32 num_left;
+	guint32 num;
+	int err = -1;
+	guint32 i;
+
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
 
-	maze_solve_thread_join(maze);
-}
+	maze_expand(maze);
+	if (!maze->board)
+		return -1;
 
-typedef int (*SolverFunc)(struct Maze *);
+	file = fopen(filename, "rb");
+	if (!file)
+		return -1;
 
-int maze_solve(struct Maze *maze)
-{
-	gint64 start;
-	SolverFunc solver_func;
-	int result;
+	entries = g_new(guint32, MAZE_JOURNAL_CHUNK * MAZE_JOURNAL_ENTRY_WORDS);
 
-	switch (maze->solver_algorithm) {
-	case SOLVER_A_STAR:
-		solver_func = maze_solve_a_star;
-		break;
-	case SOLVER_ALWAYS_TURN_LEFT:
-	case SOLVER_ALWAYS_TURN_RIGHT:
-		solver_func = maze_solve_always_turn;
-		break;
-	case SOLVER_DFS:
-		solver_func = maze_solve_dfs;
-		break;
-	case SOLVER_BFS:
-		solver_func = maze_solve_bfs;
-		break;
-	default:
-		g_fprintf(stderr, "Invalid solver enum %d\n",
-			  maze->solver_algorithm);
-		return -1;
+	if (fread(magic, 4, 1, file) != 1 ||
+	    memcmp(magic, MAZE_JOURNAL_MAGIC, 4) ||
+	    maze_read_words(file, header, MAZE_JOURNAL_HEADER_WORDS) ||
+	    header[0] != MAZE_JOURNAL_VERSION ||
+	    header[1] != maze->num_levels || header[2] != maze->num_rows ||
+	    header[3] != maze->num_cols)
+		goto exit;
+
+	for (num_left = header[4]; num_left > 0; num_left -= num) {
+		num = MIN(num_left, MAZE_JOURNAL_CHUNK);
+		if (maze_read_words(file, entries,
+				    num * MAZE_JOURNAL_ENTRY_WORDS))
+			goto exit;
+
+		for (i = 0; i < num; i++) {
+			if (maze_journal_replay_entry(maze,
+					&entries[i * MAZE_JOURNAL_ENTRY_WORDS]))
+				goto exit;
+		}
 	}
 
-	_maze_clear_board(maze);
+	err = 0;
 
-	start = g_get_monotonic_time();
+exit:
+	g_free(entries);
+	fclose(file);
 
-	result = solver_func(maze);
+	return err;
+}
 
-	maze->solve_time = g_get_monotonic_time() - start;
+/*
+ * Junction graph
+ *
+ * The nodes are the open cells which are not plain corridor cells: dead
+ * ends, junctions and endpoints. Corridors are contracted into arcs, each
+ * one with its number of steps and the cost of the cells it enters, in
+ * both directions. Node ids follow the board order and are kept in the
+ * value of the cells, so the export streams with no other memory than the
+ * board.
+ */
+#define MAZE_GRAPH_MAGIC	"CMZG"
+#define MAZE_GRAPH_VERSION	1
 
-	if (!result)
-		maze->solver_status = SOLVED;
+static void maze_graph_number_nodes(struct Maze *maze, int *num_nodes,
+				    int *num_arcs)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	int num;
+	int i;
 
-	return result;
+	*num_nodes = 0;
+	*num_arcs = 0;
+
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		cell->value = -1;
+		if (cell->type == CELL_TYPE_WALL)
+			continue;
+
+		num = maze_topology_neighbours(maze, maze->topology, cell,
+					       neighbours);
+		if (num == 2 && cell->type != CELL_TYPE_START &&
+		    cell->type != CELL_TYPE_END)
+			continue;
+
+		cell->value = (*num_nodes)++;
+		*num_arcs += num;
+	}
 }
 
-int maze_solve_thread(struct Maze *maze, MazeSolverFunc cb, void *userdata)
+/*
+ * Follow the corridor leaving node through next, up to the node at its
+ * other end. Returns NULL if the corridor never ends, which only happens
+ * with one-way stairs.
+ */
+static struct Cell *maze_graph_follow(struct Maze *maze, struct Cell *node,
+				      struct Cell *next, int *length,
+				      int *cost)
 {
-	maze->solver_status = RUNNING;
-	maze->solver_cb = cb;
-	maze->solver_cb_userdata = userdata;
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *prev = node;
+	struct Cell *cell = next;
 
-	maze->solver_thread = g_thread_new("solver",
-			      (GThreadFunc)maze_solve, maze);
+	*length = 1;
+	*cost = maze_cell_cost(maze, cell);
+
+	while (cell->value < 0) {
+		if (*length > maze_num_cells(maze))
+			return NULL;
 
-	g_timeout_add(40, (GSourceFunc)maze_solve_monitor, maze);
+		maze_topology_neighbours(maze, maze->topology, cell,
+					 neighbours);
+		next = neighbours[0] == prev ? neighbours[1] : neighbours[0];
+		prev = cell;
+		cell = next;
 
-	return 0;
+		(*length)++;
+		*cost += maze_cell_cost(maze, cell);
+	}
+
+	return cell;
+}
+
+static const char *maze_graph_node_type(struct Cell *cell, int num_arcs)
+{
+	if (cell->type == CELL_TYPE_START)
+		return "start";
+	if (cell->type == CELL_TYPE_END)
+		return "end";
+	if (num_arcs < 2)
+		return "dead-end";
+
+	return "junction";
 }
 
-CellType maze_get_cell_type(struct Maze *maze, int row, int col)
+/* Write the arcs of every node, through write_arc, in node order */
+static int maze_graph_write_arcs(struct Maze *maze, FILE *file,
+				 int (*write_arc)(FILE *file, int source,
+						  int target, int length,
+						  int cost))
 {
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
 	struct Cell *cell;
+	struct Cell *target;
+	int length;
+	int cost;
+	int num;
+	int i;
+	int j;
 
-	cell = maze_get_cell(maze, row, col);
-	if (cell)
-		return cell->type;
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		if (cell->value < 0)
+			continue;
+
+		num = maze_topology_neighbours(maze, maze->topology, cell,
+					       neighbours);
+		for (j = 0; j < num; j++) {
+			target = maze_graph_follow(maze, cell, neighbours[j],
+						   &length, &cost);
+			if (!target ||
+			    write_arc(file, cell->value, target->value, length,
+				      cost))
+				return -1;
+		}
+	}
 
 	return 0;
 }
 
-void maze_print_board(struct Maze *maze)
+static int maze_graph_write_csr_arc(FILE *file, int source, int target,
+				    int length, int cost)
 {
-	int row;
-	int col;
-	struct Cell *cell;
-
-	for (row = 0; row < maze->num_rows; row++) {
-		for (col = 0; col < maze->num_cols; col++) {
-			cell = &maze->board[row * maze->num_cols + col];
-
-			if (cell->type == CELL_TYPE_PATH_SOLUTION)
-				g_printf("O");
-			else
-				g_printf("%c", (cell->type == CELL_TYPE_WALL) ?
-					       'X' : ' ');
-		}
+	guint32 arc[3] = { target, length, cost };
 
-		g_printf("\n");
-	}
+	return maze_write_words(file, arc, 3);
 }
 
-int maze_create(struct Maze *maze, int num_rows, int num_cols, gboolean complex)
+/*
+ * Binary CSR, little-endian words: the magic, the version, the number of
+ * nodes and arcs, the level, row and col of each node, the num_nodes + 1
+ * offsets of the arcs of each node, then the target, length and cost of
+ * each arc.
+ */
+static int maze_graph_write_csr(struct Maze *maze, FILE *file, int num_nodes,
+				int num_arcs)
 {
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	guint32 header[3] = { MAZE_GRAPH_VERSION, num_nodes, num_arcs };
+	guint32 words[3];
 	struct Cell *cell;
-	struct Cell *n_cell;
-	GList *stack = NULL;
-	GList *elem;
-	int row;
-	int col;
-	int r;
+	guint32 offset = 0;
 	int i;
-	Direction dir;
 
-	if (maze->solver_status == RUNNING)
+	if (fwrite(MAZE_GRAPH_MAGIC, 4, 1, file) != 1 ||
+	    maze_write_words(file, header, 3))
 		return -1;
 
-	if (num_rows < MAZE_MIN_ROWS)
-		num_rows = MAZE_MIN_ROWS;
-	else if (num_rows > MAZE_MAX_ROWS)
-		num_rows = MAZE_MAX_ROWS;
-	else if ((num_rows & 1) == 0)
-		num_rows++;
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		if (cell->value < 0)
+			continue;
+
+		words[0] = cell->level;
+		words[1] = cell->row;
+		words[2] = cell->col;
+		if (maze_write_words(file, words, 3))
+			return -1;
+	}
 
-	if (num_cols < MAZE_MIN_COLS)
-		num_cols = MAZE_MIN_COLS;
-	else if (num_cols > MAZE_MAX_COLS)
-		num_cols = MAZE_MAX_COLS;
-	else if ((num_cols & 1) == 0)
-		num_cols++;
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		if (cell->value < 0)
+			continue;
 
-	if (maze->board &&
-	    maze->num_rows * maze->num_cols < num_rows * num_cols) {
-		g_free(maze->board);
-		maze->board = NULL;
+		words[0] = offset;
+		if (maze_write_words(file, words, 1))
+			return -1;
+
+		offset += maze_topology_neighbours(maze, maze->topology, cell,
+						   neighbours);
 	}
 
-	maze->num_rows = num_rows;
-	maze->num_cols = num_cols;
-	maze->complex = complex;
+	words[0] = offset;
+	if (maze_write_words(file, words, 1))
+		return -1;
 
-	if (!maze->board)
-		maze->board = g_malloc(num_rows * num_cols * sizeof(struct Cell));
+	return maze_graph_write_arcs(maze, file, maze_graph_write_csr_arc);
+}
+
+static int maze_graph_write_edge(FILE *file, int source, int target,
+				 int length, int cost)
+{
+	return g_fprintf(file, "%d %d %d %d\n", source, target, length,
+			 cost) < 0 ? -1 : 0;
+}
 
-	memset(maze->board, 0, num_rows * num_cols * sizeof(struct Cell));
+static int maze_graph_write_graphml_edge(FILE *file, int source, int target,
+					 int length, int cost)
+{
+	return g_fprintf(file,
+			 "    <edge source=\"n%d\" target=\"n%d\">"
+			 "<data key=\"length\">%d</data>"
+			 "<data key=\"cost\">%d</data></edge>\n",
+			 source, target, length, cost) < 0 ? -1 : 0;
+}
 
-	for (row = 0; row < maze->num_rows; row++) {
-		for (col = 0; col < maze->num_cols; col++) {
-			cell = maze_get_cell(maze, row, col);
+static int maze_graph_write_graphml(struct Maze *maze, FILE *file)
+{
+	struct Cell *neighbours[MAZE_MAX_NEIGHBOURS];
+	struct Cell *cell;
+	int num;
+	int i;
 
-			cell->row = row;
-			cell->col = col;
-			if ((row & 1) && (col & 1))
-				cell->type = CELL_TYPE_EMPTY;
-			else
-				cell->type = CELL_TYPE_WALL;
-		}
+	g_fprintf(file,
+		  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		  "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+		  "  <key id=\"level\" for=\"node\" attr.name=\"level\" attr.type=\"int\"/>\n"
+		  "  <key id=\"row\" for=\"node\" attr.name=\"row\" attr.type=\"int\"/>\n"
+		  "  <key id=\"col\" for=\"node\" attr.name=\"col\" attr.type=\"int\"/>\n"
+		  "  <key id=\"type\" for=\"node\" attr.name=\"type\" attr.type=\"string\"/>\n"
+		  "  <key id=\"length\" for=\"edge\" attr.name=\"length\" attr.type=\"int\"/>\n"
+		  "  <key id=\"cost\" for=\"edge\" attr.name=\"cost\" attr.type=\"int\"/>\n"
+		  "  <graph id=\"maze\" edgedefault=\"directed\">\n");
+
+	for (i = 0; i < maze_num_cells(maze); i++) {
+		cell = &maze->board[i];
+		if (cell->value < 0)
+			continue;
+
+		num = maze_topology_neighbours(maze, maze->topology, cell,
+					       neighbours);
+		g_fprintf(file,
+			  "    <node id=\"n%d\"><data key=\"level\">%d</data>"
+			  "<data key=\"row\">%d</data><data key=\"col\">%d</data>"
+			  "<data key=\"type\">%s</data></node>\n",
+			  cell->value, cell->level, cell->row, cell->col,
+			  maze_graph_node_type(cell, num));
 	}
 
-	row = (random() % (maze->num_rows - 2)) / 2 * 2 + 1;
-	col = (random() % (maze->num_cols - 2)) / 2 * 2 + 1;
-	cell = maze_get_cell(maze, row, col);
-	if (!cell || cell->type == CELL_TYPE_WALL)
+	if (maze_graph_write_arcs(maze, file, maze_graph_write_graphml_edge))
 		return -1;
 
-	cell->value = 1;
-	stack = g_list_prepend(stack, cell);
+	g_fprintf(file, "  </graph>\n</graphml>\n");
 
-	while (stack != NULL) {
-		elem = g_list_first(stack);
-		cell = elem->data;
+	return 0;
+}
 
-		row = cell->row;
-		col = cell->col;
+/*
+ * Export the junction graph of the maze to file. The solver state is
+ * cleared.
+ */
+int maze_export_graph(struct Maze *maze, FILE *file, MazeGraphFormat format)
+{
+	int num_nodes;
+	int num_arcs;
+	int err;
 
-		dir = random() % DIR_NUM_DIRS;
-		i = DIR_FIRST;
-		while (i++ <= DIR_NUM_DIRS) {
-			n_cell = maze_get_neighbour_cell_offset(maze, cell,
-								dir, 2);
-			if (!n_cell || n_cell->value == 1) {
-				dir = (dir + 1) % DIR_NUM_DIRS;
-				continue;
-			}
+	if (maze->solver_status == RUNNING || maze->generating)
+		return -1;
 
-			n_cell->value = 1;
-			stack = g_list_prepend(stack, n_cell);
+	maze_expand(maze);
+	if (!maze->board)
+		return -1;
 
-			/* Remove wall between cells */
-			n_cell = maze_get_neighbour_cell(maze, cell, dir);
-			n_cell->value = 1;
-			n_cell->type = CELL_TYPE_EMPTY;
+	_maze_clear_board(maze);
+	maze->solver_status = STOPPED;
 
-			break;
-		}
+	maze_graph_number_nodes(maze, &num_nodes, &num_arcs);
 
-		/*
-		 * No more suitable neighbour for this cell. We can remove it
-		 * from the stack
-		 */
-		if (i >= DIR_NUM_DIRS)
-			stack = g_list_delete_link(stack, elem);
+	switch (format) {
+	case GRAPH_FORMAT_CSR:
+		err = maze_graph_write_csr(maze, file, num_nodes, num_arcs);
+		break;
+	case GRAPH_FORMAT_EDGE_LIST:
+		g_fprintf(file, "# %d nodes, %d arcs\n"
+				"# source target length cost\n",
+			  num_nodes, num_arcs);
+		err = maze_graph_write_arcs(maze, file, maze_graph_write_edge);
+		break;
+	case GRAPH_FORMAT_GRAPHML:
+		err = maze_graph_write_graphml(maze, file);
+		break;
+	default:
+		err = -1;
+		break;
 	}
 
-	maze->start_cell = maze_get_cell(maze, 1, 0);
-	maze->start_cell->type = CELL_TYPE_START;
-	maze->end_cell = maze_get_cell(maze, maze->num_rows - 2, maze->num_cols - 1);
-	maze->end_cell->type = CELL_TYPE_END;
+	if (ferror(file))
+		err = -1;
 
-	if (!complex)
-		return 0;
+	return err;
+}
 
-	for (i = 0; i < MAX(maze->num_rows, maze->num_cols); i++) {
-		while (1) {
-			row = (random() % (maze->num_rows - 2)) + 1;
-			col = (random() % (maze->num_cols - 2)) + 1;
-			cell = maze_get_cell(maze, row, col);
+/*
+ * Board comparison
+ *
+ * Comparing two mazes is a vectorized XOR of their wall planes.
+ */
 
-			if (cell->type != CELL_TYPE_WALL)
-				continue;
+/* Wall planes of a and b, NULL unless both can be compared */
+static gboolean maze_get_wall_planes(struct Maze *a, struct Maze *b,
+				     const guint64 **plane_a,
+				     const guint64 **plane_b)
+{
+	if (a->generating || b->generating ||
+	    a->num_levels != b->num_levels || a->num_rows != b->num_rows ||
+	    a->num_cols != b->num_cols)
+		return FALSE;
 
-			r = 0;
-			n_cell = maze_get_neighbour_cell(maze, cell, DIR_UP);
-			if (n_cell && n_cell->type == CELL_TYPE_WALL)
-				r++;
-			n_cell = maze_get_neighbour_cell(maze, cell, DIR_DOWN);
-			if (n_cell && n_cell->type == CELL_TYPE_WALL)
-				r++;
-			/*
-			 * Only 1 wall up or down means we're on a wall end or
-			 * at the top of a T. Try with another wall.
-			 */
-			if (r == 1)
-				continue;
+	maze_expand(a);
+	maze_expand(b);
+	if (!a->board || !b->board)
+		return FALSE;
 
-			n_cell = maze_get_neighbour_cell(maze, cell, DIR_LEFT);
-			if (n_cell && n_cell->type == CELL_TYPE_WALL)
-				r++;
-			n_cell = maze_get_neighbour_cell(maze, cell, DIR_RIGHT);
-			if (n_cell && n_cell->type == CELL_TYPE_WALL)
-				r++;
+	*plane_a = maze_get_wall_plane(a);
+	*plane_b = maze_get_wall_plane(b);
 
-			/*
-			 * We're surounded by 2 walls verticaly or horizontaly.
-			 * It's a match.
-			 */
-			if (r == 2)
-				break;
-		}
+	return TRUE;
+}
 
-		/* Remove that wall */
-		cell->type = CELL_TYPE_EMPTY;
+/* TRUE if both mazes have the same size and walls */
+gboolean maze_equal(struct Maze *a, struct Maze *b)
+{
+	const guint64 *plane_a;
+	const guint64 *plane_b;
+	WallVec diff;
+	int num_words;
+	int i;
+
+	if (!maze_get_wall_planes(a, b, &plane_a, &plane_b))
+		return FALSE;
+
+	num_words = maze_wall_plane_words(a);
+	for (i = 0; i < num_words; i += WALL_VEC_WORDS) {
+		diff = *(const WallVec *)&plane_a[i] ^
+		       *(const WallVec *)&plane_b[i];
+		if (diff[0] | diff[1] | diff[2] | diff[3])
+			return FALSE;
 	}
 
-	return 0;
+	return TRUE;
 }
 
-struct Maze *maze_alloc(void)
+/*
+ * Return the number of cells which are a wall in only one of the mazes,
+ * -1 if they can't be compared. The first max_diffs of them are stored in
+ * diffs, in board order.
+ */
+int maze_diff(struct Maze *a, struct Maze *b, struct MazePos *diffs,
+	      int max_diffs)
 {
-	struct Maze *maze;
+	const guint64 *plane_a;
+	const guint64 *plane_b;
+	WallVec diff;
+	guint64 word;
+	int num_diffs = 0;
+	int num_words;
+	int index;
+	int i;
+	int j;
 
-	maze = g_malloc0(sizeof(*maze));
+	if (!maze_get_wall_planes(a, b, &plane_a, &plane_b))
+		return -1;
 
-	return maze;
+	num_words = maze_wall_plane_words(a);
+	for (i = 0; i < num_words; i += WALL_VEC_WORDS) {
+		diff = *(const WallVec *)&plane_a[i] ^
+		       *(const WallVec *)&plane_b[i];
+
+		for (j = 0; j < WALL_VEC_WORDS; j++) {
+			for (word = diff[j]; word; word &= word - 1) {
+				if (num_diffs >= max_diffs) {
+					num_diffs += __builtin_popcountll(word);
+					break;
+				}
+
+				index = (i + j) * 64 + __builtin_ctzll(word);
+				diffs[num_diffs].level = a->board[index].level;
+				diffs[num_diffs].row = a->board[index].row;
+				diffs[num_diffs].col = a->board[index].col;
+				num_diffs++;
+			}
+		}
+	}
+
+	return num_diffs;
 }
 
 void maze_free(struct Maze *maze)
@@ -907,6 +7008,21 @@ void maze_free(struct Maze *maze)
 		return;
 
 	g_free(maze->board);
+	g_free(maze->cost_plane);
+	g_free(maze->work);
+	g_free(maze->gen_unvisited);
+	g_free(maze->goal_dist);
+	g_free(maze->wall_plane);
+	maze_async_close(maze);
+	maze_drop_pages(maze);
+	maze_compact_free(maze);
+	g_list_free(maze->exits);
+
+	if (maze->journal)
+		g_array_free(maze->journal, TRUE);
+
+	if (maze->rand)
+		g_rand_free(maze->rand);
 
 	g_free(maze);
 }
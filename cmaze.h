@@ -5,15 +5,28 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 
+G_BEGIN_DECLS
+
 #define MAZE_MIN_ROWS 21
 #define MAZE_MIN_COLS 21
 #define MAZE_MAX_ROWS 499
 #define MAZE_MAX_COLS 499
+#define MAZE_MIN_LEVELS 1
+#define MAZE_MAX_LEVELS 16
+
+#define MAZE_MAX_NUMA_NODES 64
+
+#define MAZE_MAX_COST 255
+#define MAZE_DEFAULT_MAX_COST 9
+
+#define MAZE_STAIRS_UP   (1 << 0)
+#define MAZE_STAIRS_DOWN (1 << 1)
 
 #define SOLVER_CB_REASON_RUNNING  0
 #define SOLVER_CB_REASON_SOLVED   1
 #define SOLVER_CB_REASON_CANCELED 2
 #define SOLVER_CB_REASON_INFLOOP  3
+#define SOLVER_CB_REASON_LIMITED  4
 
 typedef void(*MazeSolverFunc)(int, void *);
 
@@ -23,8 +36,37 @@ typedef enum {
 	SOLVER_A_STAR,
 	SOLVER_ALWAYS_TURN_LEFT,
 	SOLVER_ALWAYS_TURN_RIGHT,
+	SOLVER_DIJKSTRA,
+	SOLVER_WEIGHTED_A_STAR,
+	SOLVER_NEAREST_EXIT,
+	SOLVER_PARALLEL_BFS,
+	SOLVER_SHARDED_BFS,
 } SolverAlgorithm;
 
+/*
+ * How a solver moves between open cells. Walls are always generated on a
+ * square grid, the topology only changes the moves available on it.
+ */
+typedef enum {
+	TOPOLOGY_SQUARE = 0,	/* 4 neighbours */
+	TOPOLOGY_OCTILE,	/* 8 neighbours, no corner cutting */
+	TOPOLOGY_TORUS,		/* 4 neighbours, edges wrap around */
+	TOPOLOGY_HEX,		/* 6 neighbours, odd rows shifted right */
+	TOPOLOGY_NUM,
+} MazeTopology;
+
+typedef enum {
+	GENERATOR_BACKTRACKER = 0,	/* Recursive backtracker, long corridors */
+	GENERATOR_HUNT_AND_KILL,	/* No stack, only a room bitmap */
+} MazeGenerator;
+
+/* See maze_export_graph() */
+typedef enum {
+	GRAPH_FORMAT_CSR = 0,		/* Binary compressed sparse rows */
+	GRAPH_FORMAT_EDGE_LIST,		/* One "source target length cost" line per arc */
+	GRAPH_FORMAT_GRAPHML,
+} MazeGraphFormat;
+
 typedef enum {
 	CELL_TYPE_EMPTY = 0,
 	CELL_TYPE_WALL,
@@ -37,39 +79,254 @@ typedef enum {
 
 struct Cell;
 struct Maze;
+struct MazeSnapshot;
+
+struct MazePos {
+	int level;
+	int row;
+	int col;
+};
 
 struct Maze *maze_alloc(void);
+struct Maze *maze_dup(struct Maze *maze);
 void maze_free(struct Maze *maze);
 
-int maze_create(struct Maze *maze, int num_rows, int num_cols, gboolean complex);
+int maze_create(struct Maze *maze, int num_levels, int num_rows, int num_cols,
+		gboolean complex);
+int maze_set_layout(struct Maze *maze, int num_rows, int num_cols,
+		    const guint8 *layout);
 int maze_solve(struct Maze *maze);
+int maze_solve_headless(struct Maze *maze);
 void maze_print_board(struct Maze *maze);
 
+/*
+ * cb is called from the main loop every 40ms while the solver thread runs.
+ * Without cb, the caller polls maze_solve_poll() instead, for instance
+ * from a frame clock, and redraws only when maze_get_changes() moved.
+ */
 int maze_solve_thread(struct Maze *maze, MazeSolverFunc cb, void *userdata);
 void maze_solve_thread_cancel(struct Maze *maze);
+int maze_solve_poll(struct Maze *maze);
+guint maze_get_changes(struct Maze *maze);
 
 gboolean maze_solver_running(struct Maze *maze);
 int maze_get_path_length(struct Maze *maze);
+int maze_get_path_cost(struct Maze *maze);
 float maze_get_solve_time(struct Maze *maze);
 
+/* Live progress of the solver */
+struct MazeSolverStats {
+	int expanded;		/* Cells expanded so far */
+	int frontier;		/* Cells waiting to be expanded */
+	float elapsed;		/* Seconds since the solver started */
+};
+
+void maze_get_solver_stats(struct Maze *maze, struct MazeSolverStats *stats);
+
+/* Budget of every solve, 0 for no limit */
+struct MazeSolveLimits {
+	gint64 max_time;	/* Microseconds since the solver started */
+	int max_expanded;	/* Cells expanded */
+	gsize max_memory;	/* Bytes held by the frontier */
+};
+
+/*
+ * A solver over budget stops with SOLVER_CB_REASON_LIMITED and
+ * maze_solve() returns -1, the solver stats telling how far it went. The
+ * limits are checked every few thousand expansions, and once per BFS
+ * level by the parallel solvers, so they may be overshot by that much.
+ */
+void maze_set_solve_limits(struct Maze *maze,
+			   const struct MazeSolveLimits *limits);
+
+/* See maze_solve_async_result() */
+struct MazeSolveResult {
+	int reason;		/* SOLVER_CB_REASON_* */
+	int path_len;		/* Once solved */
+	int path_cost;
+	struct MazeSolverStats stats;
+};
+
+/*
+ * Solve from a thread and signal progress and completion through a file
+ * descriptor, for event loops other than GLib's. The solver can be
+ * canceled with maze_solve_thread_cancel().
+ */
+int maze_solve_async(struct Maze *maze, gint64 progress_interval);
+int maze_solve_async_result(struct Maze *maze, struct MazeSolveResult *result);
+gsize maze_get_memory_usage(struct Maze *maze);
+
 void maze_clear_board(struct Maze *maze);
 
+void maze_set_seed(struct Maze *maze, guint32 seed);
+
 void maze_set_anim_speed(struct Maze *maze, uint speed);
 uint maze_get_anim_speed(struct Maze *maze);
 
+int maze_get_num_levels(struct Maze *maze);
 int maze_get_num_rows(struct Maze *maze);
 int maze_get_num_cols(struct Maze *maze);
 
-int maze_set_start_cell(struct Maze *maze, int row, int col);
-int maze_set_end_cell(struct Maze *maze, int row, int col);
+int maze_set_start_cell(struct Maze *maze, int level, int row, int col);
+int maze_set_end_cell(struct Maze *maze, int level, int row, int col);
+
+/* -1 while the maze has no endpoints, before it is generated */
+int maze_get_start_cell(struct Maze *maze, struct MazePos *pos);
+int maze_get_end_cell(struct Maze *maze, struct MazePos *pos);
+
+int maze_add_exit(struct Maze *maze, int level, int row, int col);
+int maze_remove_exit(struct Maze *maze, int level, int row, int col);
+int maze_get_num_exits(struct Maze *maze);
+int maze_get_exit_distance(struct Maze *maze, int level, int row, int col);
+
+int maze_set_wall(struct Maze *maze, int level, int row, int col,
+		  gboolean wall);
+
+/*
+ * The edits above are journaled as small deltas, undone and redone one at
+ * a time. Generating, loading or restoring a maze clears the journal.
+ */
+int maze_undo(struct Maze *maze);
+int maze_redo(struct Maze *maze);
+
+int maze_save(struct Maze *maze, const char *filename);
+int maze_load(struct Maze *maze, const char *filename);
+int maze_journal_save(struct Maze *maze, const char *filename);
+int maze_journal_replay(struct Maze *maze, const char *filename);
+
+/*
+ * Write the junction graph of the maze: dead ends, junctions and endpoints
+ * joined by the corridors between them, as arcs weighted by their length
+ * and cost. Each corridor gives an arc in both directions.
+ */
+int maze_export_graph(struct Maze *maze, FILE *file, MazeGraphFormat format);
+
+/* Filled by maze_validate() */
+struct MazeReport {
+	int num_open;		/* Cells which aren't walls */
+	int num_passages;	/* Adjacent open cells and stairs */
+	int num_components;	/* Groups of connected open cells */
+	int num_cycles;		/* passages - open + components */
+	int num_openings;	/* Open perimeter cells besides the endpoints */
+	int num_bad_stairs;	/* Stairs without stairs back */
+	gboolean valid;
+};
+
+int maze_validate(struct Maze *maze, struct MazeReport *report);
+
+/* Compare the walls of two mazes of the same size */
+gboolean maze_equal(struct Maze *a, struct Maze *b);
+int maze_diff(struct Maze *a, struct Maze *b, struct MazePos *diffs,
+	      int max_diffs);
+
+/*
+ * Store the cheapest path from (level, row, col) to the end cell in path
+ * and return its length, or -1 if the end cell can't be reached. The
+ * distance field behind it is only rebuilt when the end cell or the walls
+ * change, so each call is a walk along the path.
+ */
+int maze_get_path_to_end(struct Maze *maze, int level, int row, int col,
+			 struct MazePos *path, int max_len);
+
+/* See maze_plan_agents() */
+struct MazeAgent {
+	struct MazePos start;
+	struct MazePos goal;
+
+	/* One position per time step, from start to goal */
+	struct MazePos *path;
+	int path_len;
+};
+
+int maze_plan_agents(struct Maze *maze, struct MazeAgent *agents,
+		     int num_agents, int max_delay);
+void maze_agents_clear(struct MazeAgent *agents, int num_agents);
 
 gboolean maze_get_difficult(struct Maze *maze);
 
+void maze_set_max_cost(struct Maze *maze, uint max_cost);
+uint maze_get_max_cost(struct Maze *maze);
+
+/*
+ * Step-wise maze_create(): maze_generate_begin() sets up an empty board,
+ * then each maze_generate_step() call carves at most budget rooms and
+ * returns 1 until the maze is complete. The maze can't be solved or edited
+ * in between.
+ */
+int maze_generate_begin(struct Maze *maze, int num_levels, int num_rows,
+			int num_cols, gboolean complex);
+int maze_generate_step(struct Maze *maze, int budget);
+gboolean maze_generating(struct Maze *maze);
+
+/*
+ * Copy-on-write captures of the maze layout and endpoints. Successive
+ * snapshots of a maze share the pages which were not edited in between,
+ * and restoring one only rewrites the pages which differ.
+ */
+struct MazeSnapshot *maze_snapshot(struct Maze *maze);
+struct MazeSnapshot *maze_snapshot_ref(struct MazeSnapshot *snap);
+void maze_snapshot_unref(struct MazeSnapshot *snap);
+int maze_restore_snapshot(struct Maze *maze, struct MazeSnapshot *snap);
+
+/*
+ * Keep only a compressed copy of the walls, stairs and endpoints. The cell
+ * getters and maze_get_path_to_end() read it directly and can be called
+ * from several threads, solving or editing the maze expands it back.
+ */
+int maze_compact(struct Maze *maze);
+
+void maze_set_generator(struct Maze *maze, MazeGenerator generator);
+MazeGenerator maze_get_generator(struct Maze *maze);
+
+void maze_set_num_threads(struct Maze *maze, int num_threads);
+int maze_get_num_threads(struct Maze *maze);
+void maze_set_pin_threads(struct Maze *maze, gboolean pin);
+void maze_print_numa_report(struct Maze *maze);
+
+MazeTopology maze_get_topology(struct Maze *maze);
+void maze_set_topology(struct Maze *maze, MazeTopology topology);
+
 SolverAlgorithm maze_get_solver_algorithm(struct Maze *maze);
 void maze_set_solver_algorithm(struct Maze *maze, SolverAlgorithm algo);
 
-CellType maze_get_cell_type(struct Maze *maze, int row, int col);
+CellType maze_get_cell_type(struct Maze *maze, int level, int row, int col);
+int maze_get_cell_cost(struct Maze *maze, int level, int row, int col);
+int maze_get_cell_stairs(struct Maze *maze, int level, int row, int col);
+
+/* Settings shared by every maze of a batch, see maze_batch_run() */
+struct MazeBatchConfig {
+	int num_mazes;
+	int num_levels;
+	int num_rows;
+	int num_cols;
+	gboolean complex;
+	uint max_cost;
+	MazeTopology topology;
+	MazeGenerator generator;
+	SolverAlgorithm algorithm;
+
+	/* Maze i is generated from seed + i */
+	guint32 seed;
+
+	int num_gen_workers;
+	int num_analyze_workers;
+	int num_solve_workers;
+	int num_export_workers;
+
+	/* Number of mazes in flight */
+	int pool_size;
+
+	/* One CSV line per maze */
+	FILE *output;
+};
+
+int maze_batch_run(const struct MazeBatchConfig *cfg);
+
+int maze_import_image(struct Maze *maze, const char *filename, int cell_size,
+		      int threshold);
 
 int gtk_maze_run(struct Maze *maze);
 
+G_END_DECLS
+
 #endif /* __MAZE_H__ */
@@ -0,0 +1,739 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef __MAZE_HPP__
+#define __MAZE_HPP__
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "cmaze.h"
+
+/*
+ * Header-only C++ layer over the C API. MazeHandle owns a struct Maze and
+ * frees it when it goes out of scope, it can be moved but not copied,
+ * dup() makes an explicit copy. Methods map one to one to the maze_*()
+ * functions and keep their return conventions.
+ *
+ * The search engine further down runs its own solvers on a copy of the
+ * board, specialized at compile time.
+ */
+namespace cmaze {
+
+class MazeHandle {
+public:
+	MazeHandle() : maze_(maze_alloc()) {}
+
+	/* Take ownership of maze */
+	explicit MazeHandle(struct ::Maze *maze) : maze_(maze) {}
+
+	~MazeHandle()
+	{
+		if (maze_)
+			maze_free(maze_);
+	}
+
+	MazeHandle(const MazeHandle &) = delete;
+	MazeHandle &operator=(const MazeHandle &) = delete;
+
+	MazeHandle(MazeHandle &&other) noexcept : maze_(other.release()) {}
+
+	MazeHandle &operator=(MazeHandle &&other) noexcept
+	{
+		if (this != &other)
+			reset(other.release());
+		return *this;
+	}
+
+	struct ::Maze *get() const { return maze_; }
+	explicit operator bool() const { return maze_ != nullptr; }
+
+	struct ::Maze *release()
+	{
+		struct ::Maze *maze = maze_;
+
+		maze_ = nullptr;
+		return maze;
+	}
+
+	void reset(struct ::Maze *maze = nullptr)
+	{
+		if (maze_)
+			maze_free(maze_);
+		maze_ = maze;
+	}
+
+	/* Empty handle while generating or before a board exists */
+	MazeHandle dup() const { return MazeHandle(maze_dup(maze_)); }
+
+	int create(int num_levels, int num_rows, int num_cols,
+		   bool complex = false)
+	{
+		return maze_create(maze_, num_levels, num_rows, num_cols,
+				   complex);
+	}
+
+	int load(const char *filename) { return maze_load(maze_, filename); }
+	int save(const char *filename) { return maze_save(maze_, filename); }
+
+	void set_seed(guint32 seed) { maze_set_seed(maze_, seed); }
+	void set_topology(MazeTopology topo) { maze_set_topology(maze_, topo); }
+	void set_max_cost(uint max_cost) { maze_set_max_cost(maze_, max_cost); }
+	void set_num_threads(int num) { maze_set_num_threads(maze_, num); }
+
+	void set_solver_algorithm(SolverAlgorithm algo)
+	{
+		maze_set_solver_algorithm(maze_, algo);
+	}
+
+	void set_solve_limits(const struct MazeSolveLimits &limits)
+	{
+		maze_set_solve_limits(maze_, &limits);
+	}
+
+	/* Synchronous, without animation nor callbacks */
+	int solve_headless() { return maze_solve_headless(maze_); }
+
+	int num_levels() const { return maze_get_num_levels(maze_); }
+	int num_rows() const { return maze_get_num_rows(maze_); }
+	int num_cols() const { return maze_get_num_cols(maze_); }
+
+	int path_length() const { return maze_get_path_length(maze_); }
+	int path_cost() const { return maze_get_path_cost(maze_); }
+	float solve_time() const { return maze_get_solve_time(maze_); }
+
+	struct MazeSolverStats solver_stats() const
+	{
+		struct MazeSolverStats stats;
+
+		maze_get_solver_stats(maze_, &stats);
+		return stats;
+	}
+
+	CellType cell_type(int level, int row, int col) const
+	{
+		return maze_get_cell_type(maze_, level, row, col);
+	}
+
+private:
+	struct ::Maze *maze_;
+};
+
+/*
+ * Search engine
+ *
+ * The solvers are templates over four policies and every combination
+ * compiles to its own kernel, like cmaze.c stamps out one copy of a solver
+ * per topology:
+ *  - Topology: the moves, Square, Octile, Torus or Hex
+ *  - Board: how the walls, stairs and costs loaded from a struct Maze are
+ *    laid out, DenseBoard or PaddedBoard
+ *  - Stats: instrumentation, NoStats or CountStats
+ *  - Animation: told about every expanded cell and may cancel the search,
+ *    NoAnimation or CallbackAnimation
+ * With NoStats and NoAnimation nothing is left in the hot loop but the
+ * search itself: no status polling, no animation delay, no callback. The
+ * working memory of a search lives in a SearchScratch, reused from one
+ * solve to the next.
+ */
+
+/* 8 planar moves plus stairs up and down */
+const int max_neighbours = 10;
+
+typedef int Move[2];
+
+/* Row and col moves, clockwise from UP as in cmaze.c */
+struct Square {
+	static const MazeTopology topology = TOPOLOGY_SQUARE;
+	static const int num_moves = 4;
+	static const bool wrap = false;
+	static const bool diagonal = false;
+
+	static const Move *moves(bool)
+	{
+		static const Move m[4] = {
+			{ -1, 0 }, { 0, 1 }, { 1, 0 }, { 0, -1 },
+		};
+
+		return m;
+	}
+};
+
+/* No cutting corners, both sides of a diagonal move are open */
+struct Octile {
+	static const MazeTopology topology = TOPOLOGY_OCTILE;
+	static const int num_moves = 8;
+	static const bool wrap = false;
+	static const bool diagonal = true;
+
+	static const Move *moves(bool)
+	{
+		static const Move m[8] = {
+			{ -1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 },
+			{ 1, 0 }, { 1, -1 }, { 0, -1 }, { -1, -1 },
+		};
+
+		return m;
+	}
+};
+
+struct Torus {
+	static const MazeTopology topology = TOPOLOGY_TORUS;
+	static const int num_moves = 4;
+	static const bool wrap = true;
+	static const bool diagonal = false;
+
+	static const Move *moves(bool odd_row) { return Square::moves(odd_row); }
+};
+
+/* "odd-r" layout: odd rows are shifted right by half a cell */
+struct Hex {
+	static const MazeTopology topology = TOPOLOGY_HEX;
+	static const int num_moves = 6;
+	static const bool wrap = false;
+	static const bool diagonal = false;
+
+	static const Move *moves(bool odd_row)
+	{
+		static const Move m[2][6] = {
+			{ { -1, -1 }, { -1, 0 }, { 0, 1 }, { 1, 0 }, { 1, -1 }, { 0, -1 } },
+			{ { -1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, -1 } },
+		};
+
+		return m[odd_row];
+	}
+};
+
+namespace detail {
+
+/* Flags of a board cell */
+enum {
+	CELL_WALL = 1 << 0,
+	CELL_UP = 1 << 1,
+	CELL_DOWN = 1 << 2,
+	CELL_ODD_ROW = 1 << 3,
+};
+
+/*
+ * Walls, stairs and costs of a maze, with pad rows and cols of walls
+ * around every level. The costs are left empty without terrain.
+ */
+class BoardBase {
+public:
+	int num_cells() const { return (int)cells_.size(); }
+	bool valid() const { return start_ >= 0 && end_ >= 0; }
+	int start() const { return start_; }
+	int end() const { return end_; }
+	bool wall(int index) const { return cells_[index] & CELL_WALL; }
+	int cost(int index) const { return costs_.empty() ? 1 : costs_[index]; }
+	int max_cost() const { return max_cost_; }
+
+	struct MazePos pos(int index) const
+	{
+		struct MazePos pos;
+
+		pos.col = index % width_ - pad_;
+		pos.row = index / width_ % height_ - pad_;
+		pos.level = index / (width_ * height_);
+
+		return pos;
+	}
+
+protected:
+	BoardBase(struct ::Maze *maze, int pad) :
+		pad_(pad), start_(-1), end_(-1), max_cost_(1)
+	{
+		struct MazePos pos;
+		int num_levels = maze_get_num_levels(maze);
+		int num_rows = maze_get_num_rows(maze);
+		int num_cols = maze_get_num_cols(maze);
+		bool terrain = maze_get_max_cost(maze) > 1;
+		int cell;
+		guint8 flags;
+		int stairs;
+		int cost;
+
+		width_ = num_cols + 2 * pad;
+		height_ = num_rows + 2 * pad;
+		level_size_ = width_ * height_;
+
+		cells_.assign((size_t)num_levels * level_size_, CELL_WALL);
+		if (terrain)
+			costs_.assign(cells_.size(), 1);
+
+		for (int level = 0; level < num_levels; level++) {
+			for (int row = 0; row < num_rows; row++) {
+				for (int col = 0; col < num_cols; col++) {
+					cell = index(level, row, col);
+
+					flags = (row & 1) ? CELL_ODD_ROW : 0;
+					if (maze_get_cell_type(maze, level, row, col) ==
+					    CELL_TYPE_WALL)
+						flags |= CELL_WALL;
+
+					stairs = maze_get_cell_stairs(maze, level, row, col);
+					if (stairs & MAZE_STAIRS_UP)
+						flags |= CELL_UP;
+					if (stairs & MAZE_STAIRS_DOWN)
+						flags |= CELL_DOWN;
+
+					cells_[cell] = flags;
+
+					if (!terrain)
+						continue;
+
+					cost = maze_get_cell_cost(maze, level, row, col);
+					costs_[cell] = cost;
+					max_cost_ = std::max(max_cost_, cost);
+				}
+			}
+		}
+
+		if (!maze_get_start_cell(maze, &pos))
+			start_ = index(pos.level, pos.row, pos.col);
+		if (!maze_get_end_cell(maze, &pos))
+			end_ = index(pos.level, pos.row, pos.col);
+	}
+
+	int index(int level, int row, int col) const
+	{
+		return (level * height_ + row + pad_) * width_ + col + pad_;
+	}
+
+	int stairs(int index, int *out) const
+	{
+		int num = 0;
+
+		if (cells_[index] & CELL_UP)
+			out[num++] = index + level_size_;
+		if (cells_[index] & CELL_DOWN)
+			out[num++] = index - level_size_;
+
+		return num;
+	}
+
+	int pad_;
+	int width_;
+	int height_;
+	int level_size_;
+	int start_;
+	int end_;
+	int max_cost_;
+	std::vector<guint8> cells_;
+	std::vector<guint8> costs_;
+};
+
+} /* namespace detail */
+
+/*
+ * One byte per cell in the order of the C board. Moves are checked against
+ * the edges of the level, which works for every topology.
+ */
+class DenseBoard : public detail::BoardBase {
+public:
+	explicit DenseBoard(struct ::Maze *maze) : BoardBase(maze, 0) {}
+	explicit DenseBoard(const MazeHandle &maze) : BoardBase(maze.get(), 0) {}
+
+	template <class Topology>
+	int neighbours(int index, int *out) const
+	{
+		const Move *moves;
+		int level_start;
+		int row;
+		int col;
+		int r;
+		int c;
+		int n;
+		int num = 0;
+
+		col = index % width_;
+		row = index / width_ % height_;
+		level_start = index - row * width_ - col;
+		moves = Topology::moves(row & 1);
+
+		for (int i = 0; i < Topology::num_moves; i++) {
+			r = row + moves[i][0];
+			c = col + moves[i][1];
+
+			if (Topology::wrap) {
+				r = (r + height_) % height_;
+				c = (c + width_) % width_;
+			} else if (r < 0 || r >= height_ || c < 0 || c >= width_) {
+				continue;
+			}
+
+			n = level_start + r * width_ + c;
+			if (wall(n))
+				continue;
+
+			if (Topology::diagonal && moves[i][0] && moves[i][1] &&
+			    (wall(level_start + row * width_ + c) ||
+			     wall(level_start + r * width_ + col)))
+				continue;
+
+			out[num++] = n;
+		}
+
+		return num + stairs(index, out + num);
+	}
+};
+
+/*
+ * Like DenseBoard with a ring of walls around each level, so a move is a
+ * constant offset without any edge check. The row parity hex moves depend
+ * on is kept in the cell. The edges of a torus wrap, it can't be padded.
+ */
+class PaddedBoard : public detail::BoardBase {
+public:
+	explicit PaddedBoard(struct ::Maze *maze) : BoardBase(maze, 1) {}
+	explicit PaddedBoard(const MazeHandle &maze) : BoardBase(maze.get(), 1) {}
+
+	template <class Topology>
+	int neighbours(int index, int *out) const
+	{
+		static_assert(!Topology::wrap, "A padded board doesn't wrap");
+		const Move *moves;
+		int n;
+		int num = 0;
+
+		moves = Topology::moves(cells_[index] & detail::CELL_ODD_ROW);
+
+		for (int i = 0; i < Topology::num_moves; i++) {
+			n = index + moves[i][0] * width_ + moves[i][1];
+			if (wall(n))
+				continue;
+
+			if (Topology::diagonal && moves[i][0] && moves[i][1] &&
+			    (wall(index + moves[i][1]) ||
+			     wall(index + moves[i][0] * width_)))
+				continue;
+
+			out[num++] = n;
+		}
+
+		return num + stairs(index, out + num);
+	}
+};
+
+/* Can Board run the moves of Topology */
+template <class Board, class Topology>
+struct BoardSupports : std::true_type {};
+
+template <>
+struct BoardSupports<PaddedBoard, Torus> : std::false_type {};
+
+/* Instrumentation, told about every expanded cell */
+struct NoStats {
+	void expand(int) {}
+};
+
+struct CountStats {
+	long expanded = 0;
+	int max_frontier = 0;
+
+	void expand(int frontier)
+	{
+		expanded++;
+		max_frontier = std::max(max_frontier, frontier);
+	}
+};
+
+/* Animation, visit() returning false cancels the search */
+struct NoAnimation {
+	bool visit(int) { return true; }
+};
+
+template <class Func>
+struct CallbackAnimation {
+	Func func;
+
+	bool visit(int index) { return func(index); }
+};
+
+template <class Func>
+CallbackAnimation<Func> animate(Func func)
+{
+	return CallbackAnimation<Func>{ func };
+}
+
+template <class Topology, class Board, class Stats, class Animation>
+class Search;
+
+/*
+ * Working memory of the solvers and the path they found. The buffers only
+ * grow, so solving boards of the same size again allocates nothing. Can
+ * be moved but not copied, like MazeHandle.
+ */
+class SearchScratch {
+public:
+	SearchScratch() : start_(-1), end_(-1), path_len_(0), path_cost_(0) {}
+
+	SearchScratch(const SearchScratch &) = delete;
+	SearchScratch &operator=(const SearchScratch &) = delete;
+
+	SearchScratch(SearchScratch &&) = default;
+	SearchScratch &operator=(SearchScratch &&) = default;
+
+	/* Cells from start to end included, 0 unless the last solve succeeded */
+	int path_length() const { return path_len_; }
+
+	/* Costs of the path cells but the start, as maze_get_path_cost() */
+	int path_cost() const { return path_cost_; }
+
+	std::vector<struct MazePos> path(const detail::BoardBase &board) const
+	{
+		std::vector<struct MazePos> path(path_len_);
+		int index = end_;
+
+		for (int i = path_len_ - 1; i >= 0; i--) {
+			path[i] = board.pos(index);
+			index = parent_[index];
+		}
+
+		return path;
+	}
+
+private:
+	template <class Topology, class Board, class Stats, class Animation>
+	friend class Search;
+
+	bool begin(const detail::BoardBase &board)
+	{
+		size_t num_cells = board.num_cells();
+
+		path_len_ = 0;
+		path_cost_ = 0;
+		if (!board.valid())
+			return false;
+
+		if (dist_.size() < num_cells) {
+			dist_.resize(num_cells);
+			parent_.resize(num_cells);
+			queue_.resize(num_cells);
+		}
+		std::fill(dist_.begin(), dist_.begin() + num_cells, G_MAXUINT32);
+
+		start_ = board.start();
+		end_ = board.end();
+		dist_[start_] = 0;
+		parent_[start_] = -1;
+
+		return true;
+	}
+
+	int finish(const detail::BoardBase &board)
+	{
+		path_len_ = 1;
+		for (int index = end_; index != start_; index = parent_[index]) {
+			path_len_++;
+			path_cost_ += board.cost(index);
+		}
+
+		return 0;
+	}
+
+	int start_;
+	int end_;
+	int path_len_;
+	int path_cost_;
+	std::vector<guint32> dist_;
+	std::vector<gint32> parent_;
+	std::vector<gint32> queue_;
+
+	/* Dijkstra buckets, as the bucket queue of cmaze.c */
+	std::vector<std::vector<gint32> > buckets_;
+};
+
+/*
+ * The solvers return 0 with the path in the scratch, or -1 when the end
+ * can't be reached or the animation canceled the search.
+ */
+template <class Topology, class Board, class Stats = NoStats,
+	  class Animation = NoAnimation>
+class Search {
+public:
+	static int bfs(const Board &board, SearchScratch &scratch,
+		       Stats &stats, Animation &anim)
+	{
+		int neighbours[max_neighbours];
+		guint32 *dist;
+		gint32 *parent;
+		gint32 *queue;
+		int num_neighbours;
+		int head = 0;
+		int tail = 0;
+		int index;
+		int n;
+
+		if (!scratch.begin(board))
+			return -1;
+
+		dist = scratch.dist_.data();
+		parent = scratch.parent_.data();
+		queue = scratch.queue_.data();
+		queue[tail++] = board.start();
+
+		while (head < tail) {
+			index = queue[head++];
+
+			stats.expand(tail - head);
+			if (!anim.visit(index))
+				return -1;
+
+			if (index == board.end())
+				return scratch.finish(board);
+
+			num_neighbours = board.template neighbours<Topology>(index,
+									  neighbours);
+			for (int i = 0; i < num_neighbours; i++) {
+				n = neighbours[i];
+				if (dist[n] != G_MAXUINT32)
+					continue;
+
+				dist[n] = dist[index] + 1;
+				parent[n] = index;
+				queue[tail++] = n;
+			}
+		}
+
+		return -1;
+	}
+
+	/* Keys grow by at most max_cost, max_cost + 1 buckets hold them all */
+	static int dijkstra(const Board &board, SearchScratch &scratch,
+			    Stats &stats, Animation &anim)
+	{
+		int neighbours[max_neighbours];
+		std::vector<std::vector<gint32> > &buckets = scratch.buckets_;
+		guint32 *dist;
+		gint32 *parent;
+		int num_buckets = board.max_cost() + 1;
+		int num_neighbours;
+		int size = 1;
+		guint32 key = 0;
+		guint32 value;
+		int index;
+		int n;
+
+		if (!scratch.begin(board))
+			return -1;
+
+		if ((int)buckets.size() < num_buckets)
+			buckets.resize(num_buckets);
+		for (int i = 0; i < num_buckets; i++)
+			buckets[i].clear();
+
+		dist = scratch.dist_.data();
+		parent = scratch.parent_.data();
+		buckets[0].push_back(board.start());
+
+		while (size) {
+			while (buckets[key % num_buckets].empty())
+				key++;
+
+			index = buckets[key % num_buckets].back();
+			buckets[key % num_buckets].pop_back();
+			size--;
+
+			/* Stale entry, the cell was queued again cheaper */
+			if (dist[index] != key)
+				continue;
+
+			stats.expand(size);
+			if (!anim.visit(index))
+				return -1;
+
+			if (index == board.end())
+				return scratch.finish(board);
+
+			num_neighbours = board.template neighbours<Topology>(index,
+									  neighbours);
+			for (int i = 0; i < num_neighbours; i++) {
+				n = neighbours[i];
+				value = key + board.cost(n);
+				if (value >= dist[n])
+					continue;
+
+				dist[n] = value;
+				parent[n] = index;
+				buckets[value % num_buckets].push_back(n);
+				size++;
+			}
+		}
+
+		return -1;
+	}
+
+	/* SOLVER_BFS and SOLVER_DIJKSTRA only, -1 for the others */
+	static int solve(SolverAlgorithm algo, const Board &board,
+			 SearchScratch &scratch, Stats &stats, Animation &anim)
+	{
+		switch (algo) {
+		case SOLVER_BFS:
+			return bfs(board, scratch, stats, anim);
+		case SOLVER_DIJKSTRA:
+			return dijkstra(board, scratch, stats, anim);
+		default:
+			return -1;
+		}
+	}
+
+	static int solve(SolverAlgorithm algo, const Board &board,
+			 SearchScratch &scratch)
+	{
+		Stats stats;
+		Animation anim;
+
+		return solve(algo, board, scratch, stats, anim);
+	}
+};
+
+namespace detail {
+
+template <class Topology, class Board>
+int solve_as(SolverAlgorithm algo, const Board &board,
+	     SearchScratch &scratch, std::true_type)
+{
+	return Search<Topology, Board>::solve(algo, board, scratch);
+}
+
+template <class Topology, class Board>
+int solve_as(SolverAlgorithm, const Board &, SearchScratch &,
+	     std::false_type)
+{
+	return -1;
+}
+
+template <class Topology, class Board>
+int solve_as(SolverAlgorithm algo, const Board &board,
+	     SearchScratch &scratch)
+{
+	return solve_as<Topology>(algo, board, scratch,
+				  BoardSupports<Board, Topology>());
+}
+
+} /* namespace detail */
+
+/*
+ * Pick the headless kernel for a topology known at runtime only, -1 if
+ * the board can't run it.
+ */
+template <class Board>
+int solve(MazeTopology topology, SolverAlgorithm algo, const Board &board,
+	  SearchScratch &scratch)
+{
+	switch (topology) {
+	case TOPOLOGY_OCTILE:
+		return detail::solve_as<Octile>(algo, board, scratch);
+	case TOPOLOGY_TORUS:
+		return detail::solve_as<Torus>(algo, board, scratch);
+	case TOPOLOGY_HEX:
+		return detail::solve_as<Hex>(algo, board, scratch);
+	case TOPOLOGY_SQUARE:
+	default:
+		return detail::solve_as<Square>(algo, board, scratch);
+	}
+}
+
+} /* namespace cmaze */
+
+#endif /* __MAZE_HPP__ */
@@ -3,19 +3,70 @@
 
 #include "cmaze.h"
 
+#define GUI_RACE_PANES 4
+
+/* One solver of the race, on its own copy of the maze */
+struct RacePane {
+	struct Maze *maze;
+	cairo_surface_t *surface;
+	guint changes;
+	int reason;
+};
+
 struct MazeGui {
 	struct Maze *maze;
 
 	GtkApplication *app;
 	GtkWidget *drawing_area;
 	GtkLabel  *info_label;
+	GtkSpinButton  *spin_num_levels;
 	GtkSpinButton  *spin_num_rows;
 	GtkSpinButton  *spin_num_cols;
+	GtkSpinButton  *spin_view_level;
 	GtkWidget *new_button;
 	GtkWidget *clear_button;
 	GtkWidget *solve_button;
 	GtkToggleButton *complex_check;
+	GtkToggleButton *terrain_check;
+	GtkToggleButton *race_check;
 	GtkComboBoxText *algo_combo;
+	GtkComboBoxText *topology_combo;
+	GtkComboBoxText *generator_combo;
+
+	/* Level of the maze being displayed */
+	int level;
+
+	/* Solver changes already drawn, see gui_solve_tick() */
+	guint changes;
+
+	/* The board surface must be rendered again before it's shown */
+	gboolean board_dirty;
+
+	/* Performance overlay, sampled by on_draw() */
+	gboolean hud;
+	gint64 hud_last_frame;
+	gint64 hud_render_time;
+	double hud_fps;
+	gint64 hud_sample_time;
+	int hud_sample_expanded;
+	double hud_cells_per_sec;
+
+	/* Race view, shown instead of the board while race[0].maze is set */
+	struct RacePane race[GUI_RACE_PANES];
+	gboolean racing;
+
+	/* Path from the cell under the pointer to the end cell */
+	int hover_row;
+	int hover_col;
+	struct MazePos *preview;
+	int preview_len;
+	int preview_size;
+
+	/* Cells whose walls changed since diff_ref was taken */
+	struct Maze *diff_ref;
+	struct MazePos *diffs;
+	int num_diffs;
+	int diffs_size;
 
 	int cell_width;
 	int cell_height;
@@ -32,6 +83,8 @@ typedef enum {
 	LIGHTBLUE,
 	LIGHTGRAY,
 	DARKGRAY,
+	ORANGE,
+	PURPLE,
 } CellColor;
 
 static void get_gdk_color(CellColor cell_color, GdkRGBA *color)
@@ -79,7 +132,51 @@ static void get_gdk_color(CellColor cell_color, GdkRGBA *color)
 		color->red =
 		color->blue = 0.5;
 		break;
+	case ORANGE:
+		color->red = 1.0;
+		color->green = 0.6;
+		color->blue = 0.0;
+		break;
+	case PURPLE:
+		color->red = 0.6;
+		color->green = 0.2;
+		color->blue = 0.8;
+		break;
+	}
+}
+
+static CellColor get_cell_color(CellType cell_type)
+{
+	switch (cell_type) {
+	case CELL_TYPE_WALL:
+		return BLACK;
+	case CELL_TYPE_START:
+		return RED;
+	case CELL_TYPE_END:
+		return LIGHTBLUE;
+	case CELL_TYPE_PATH_HEAD:
+		return DARKGRAY;
+	case CELL_TYPE_PATH_VISITED:
+		return LIGHTGRAY;
+	case CELL_TYPE_PATH_SOLUTION:
+		return GREEN;
+	case CELL_TYPE_EMPTY:
+		break;
 	}
+
+	return WHITE;
+}
+
+/* Cell color as a CAIRO_FORMAT_RGB24 pixel */
+static guint32 get_cell_pixel(CellType cell_type)
+{
+	GdkRGBA color;
+
+	get_gdk_color(get_cell_color(cell_type), &color);
+
+	return (guint32)(color.red * 255) << 16 |
+	       (guint32)(color.green * 255) << 8 |
+	       (guint32)(color.blue * 255);
 }
 
 static void label_set_text(GtkLabel *label, char *format, ...)
@@ -117,6 +214,36 @@ exit_err:
 	g_fprintf(stderr, "Can't set text label\n");
 }
 
+/* On a hex board odd rows are shifted right by half a cell */
+static double gui_cell_x(struct MazeGui *gui, int row, int col)
+{
+	double x = col * gui->cell_width;
+
+	if (maze_get_topology(gui->maze) == TOPOLOGY_HEX && (row & 1))
+		x += gui->cell_width / 2.0;
+
+	return x;
+}
+
+/* Map a drawing area position to the cell drawn under it */
+static void gui_get_cell_at(struct MazeGui *gui, GtkWidget *da,
+			    double x, double y, int *row, int *col)
+{
+	GtkAllocation rect;
+
+	gtk_widget_get_allocated_size(da, &rect, NULL);
+
+	x = x * cairo_image_surface_get_width(gui->surface) / rect.width;
+	y = y * cairo_image_surface_get_height(gui->surface) / rect.height;
+
+	*row = y / gui->cell_height;
+
+	if (maze_get_topology(gui->maze) == TOPOLOGY_HEX && (*row & 1))
+		x -= gui->cell_width / 2.0;
+
+	*col = x < 0 ? -1 : x / gui->cell_width;
+}
+
 static void cairo_surface_free(struct MazeGui *gui)
 {
 	cairo_destroy(gui->cr);
@@ -152,100 +279,529 @@ static void cairo_surface_alloc(struct MazeGui *gui)
 	gui->cell_height = (rect.height / num_rows) + 1;
 
 	surface_width = gui->cell_width * num_cols;
+	if (maze_get_topology(gui->maze) == TOPOLOGY_HEX)
+		surface_width += gui->cell_width / 2;
 	surface_height = gui->cell_height * num_rows;
 
 	gui->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
 						  surface_width,
 						  surface_height);
 	gui->cr = cairo_create(gui->surface);
+	gui->board_dirty = TRUE;
+}
+
+/* The maze changed: render the board again on the next frame */
+static void gui_queue_redraw(struct MazeGui *gui)
+{
+	gui->board_dirty = TRUE;
+	gtk_widget_queue_draw(gui->drawing_area);
+}
+
+static void gui_update_preview(struct MazeGui *gui, int row, int col)
+{
+	struct Maze *maze = gui->maze;
+	int num_cells;
+
+	gui->hover_row = row;
+	gui->hover_col = col;
+
+	num_cells = maze_get_num_levels(maze) * maze_get_num_rows(maze) *
+		    maze_get_num_cols(maze);
+	if (gui->preview_size < num_cells) {
+		g_free(gui->preview);
+		gui->preview = g_new(struct MazePos, num_cells);
+		gui->preview_size = num_cells;
+	}
+
+	gui->preview_len = maze_get_path_to_end(maze, gui->level, row, col,
+						gui->preview,
+						gui->preview_size);
+	if (gui->preview_len < 0)
+		gui->preview_len = 0;
+
+	/* Only the overlay changes, the board surface is reused */
+	gtk_widget_queue_draw(gui->drawing_area);
+}
+
+static void gui_update_diff(struct MazeGui *gui)
+{
+	struct Maze *maze = gui->maze;
+	int num_cells;
+
+	gui->num_diffs = 0;
+	if (!gui->diff_ref)
+		return;
+
+	num_cells = maze_get_num_levels(maze) * maze_get_num_rows(maze) *
+		    maze_get_num_cols(maze);
+	if (gui->diffs_size < num_cells) {
+		g_free(gui->diffs);
+		gui->diffs = g_new(struct MazePos, num_cells);
+		gui->diffs_size = num_cells;
+	}
+
+	/* Mazes of another size have nothing to compare */
+	gui->num_diffs = MAX(maze_diff(maze, gui->diff_ref, gui->diffs,
+				       gui->diffs_size), 0);
+}
+
+static void gui_race_free(struct MazeGui *gui)
+{
+	struct RacePane *pane;
+	int i;
+
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+		if (!pane->maze)
+			continue;
+
+		maze_solve_thread_cancel(pane->maze);
+		maze_free(pane->maze);
+		cairo_surface_destroy(pane->surface);
+		pane->maze = NULL;
+	}
+
+	gui->racing = FALSE;
+}
+
+static void gui_set_busy(struct MazeGui *gui, gboolean busy)
+{
+	gtk_widget_set_sensitive(gui->new_button, !busy);
+	gtk_widget_set_sensitive(gui->clear_button, !busy);
+}
+
+/*
+ * Carve a slice of the maze per frame so generation is animated and the
+ * UI stays responsive on large boards.
+ */
+static gboolean gui_generate_tick(GtkWidget *da, GdkFrameClock *clock,
+				  struct MazeGui *gui)
+{
+	struct Maze *maze = gui->maze;
+	int budget;
+
+	budget = maze_get_num_levels(maze) * maze_get_num_rows(maze) *
+		 maze_get_num_cols(maze) / 4 * maze_get_anim_speed(maze) / 10000;
+
+	if (maze_generate_step(maze, MAX(budget, 1)) > 0) {
+		gui_queue_redraw(gui);
+		return TRUE;
+	}
+
+	gui_set_busy(gui, FALSE);
+	gtk_widget_set_sensitive(gui->solve_button, TRUE);
+	gui_queue_redraw(gui);
+
+	return FALSE;
 }
 
 static void on_new_clicked(GtkButton *button, struct MazeGui *gui)
 {
+	int num_levels;
 	int num_rows;
 	int num_cols;
 	gboolean complex;
 
+	num_levels = gtk_spin_button_get_value(gui->spin_num_levels);
 	num_rows = gtk_spin_button_get_value(gui->spin_num_rows);
 	num_cols = gtk_spin_button_get_value(gui->spin_num_cols);
 	complex = gtk_toggle_button_get_active(gui->complex_check);
 
-	maze_create(gui->maze, num_rows, num_cols, complex);
+	if (gtk_toggle_button_get_active(gui->terrain_check))
+		maze_set_max_cost(gui->maze, MAZE_DEFAULT_MAX_COST);
+	else
+		maze_set_max_cost(gui->maze, 0);
+
+	maze_set_topology(gui->maze,
+			  gtk_combo_box_get_active(GTK_COMBO_BOX(gui->topology_combo)));
+	maze_set_generator(gui->maze,
+			   gtk_combo_box_get_active(GTK_COMBO_BOX(gui->generator_combo)));
+
+	gui_race_free(gui);
+
+	if (maze_generate_begin(gui->maze, num_levels, num_rows, num_cols,
+				complex))
+		return;
+
+	num_levels = maze_get_num_levels(gui->maze);
+	gtk_spin_button_set_value(gui->spin_num_levels, num_levels);
+	gtk_spin_button_set_range(gui->spin_view_level, 0, num_levels - 1);
+	gui->level = MIN(gui->level, num_levels - 1);
 
 	gtk_spin_button_set_value(gui->spin_num_rows, maze_get_num_rows(gui->maze));
 	gtk_spin_button_set_value(gui->spin_num_cols, maze_get_num_cols(gui->maze));
 
 	cairo_surface_free(gui);
 	cairo_surface_alloc(gui);
+	gui->preview_len = 0;
 
-	gtk_widget_queue_draw(gui->drawing_area);
+	if (maze_get_anim_speed(gui->maze) >= 100) {
+		maze_generate_step(gui->maze, G_MAXINT);
+		gui_queue_redraw(gui);
+		return;
+	}
+
+	gui_set_busy(gui, TRUE);
+	gtk_widget_set_sensitive(gui->solve_button, FALSE);
+	label_set_text(gui->info_label, "");
+
+	gtk_widget_add_tick_callback(gui->drawing_area,
+				     (GtkTickCallback)gui_generate_tick,
+				     gui, NULL);
 }
 
 static void on_clear_clicked(GtkButton *button, struct MazeGui *gui)
 {
+	gui_race_free(gui);
 	maze_clear_board(gui->maze);
 
-	gtk_widget_queue_draw(gui->drawing_area);
+	gui_queue_redraw(gui);
 }
 
-static void maze_solver_cb(int reason, struct MazeGui *gui)
+static void gui_solve_done(struct MazeGui *gui, int reason)
 {
 	struct Maze *maze = gui->maze;
 
+	gui_set_busy(gui, FALSE);
+	gtk_button_set_label(GTK_BUTTON(gui->solve_button), "Solve");
+
+	if (reason == SOLVER_CB_REASON_SOLVED)
+		label_set_text(gui->info_label,
+			       "Length: %d\nCost: %d\nTime: %.03fs",
+			       maze_get_path_length(maze),
+			       maze_get_path_cost(maze),
+			       maze_get_solve_time(maze));
+	else if (reason == SOLVER_CB_REASON_INFLOOP)
+		label_set_text(gui->info_label, "Unsolvalble (infinite loop)");
+
+	gui_queue_redraw(gui);
+}
+
+/*
+ * Runs once per frame while the solver thread is alive. Frames where the
+ * solver made no progress are not redrawn, and the callback goes away with
+ * the solver so an idle window gets no wakeups.
+ */
+static gboolean gui_solve_tick(GtkWidget *da, GdkFrameClock *clock,
+			       struct MazeGui *gui)
+{
+	guint changes;
+	int reason;
+
+	reason = maze_solve_poll(gui->maze);
 	if (reason != SOLVER_CB_REASON_RUNNING) {
-		gtk_widget_set_sensitive(gui->new_button, TRUE);
-		gtk_widget_set_sensitive(gui->clear_button, TRUE);
-		gtk_button_set_label(GTK_BUTTON(gui->solve_button), "Solve");
-
-		if (reason == SOLVER_CB_REASON_SOLVED)
-			label_set_text(gui->info_label, "Length: %d\nTime: %.03fs",
-				       maze_get_path_length(maze),
-				       maze_get_solve_time(maze));
-		else if (reason == SOLVER_CB_REASON_INFLOOP)
-			label_set_text(gui->info_label, "Unsolvalble (infinite loop)");
+		gui_solve_done(gui, reason);
+		return FALSE;
 	}
 
-	gtk_widget_queue_draw(gui->drawing_area);
+	changes = maze_get_changes(gui->maze);
+	if (changes != gui->changes) {
+		gui->changes = changes;
+		gui_queue_redraw(gui);
+	}
+
+	return TRUE;
+}
+
+static const SolverAlgorithm race_algos[GUI_RACE_PANES] = {
+	SOLVER_BFS,
+	SOLVER_DFS,
+	SOLVER_A_STAR,
+	SOLVER_DIJKSTRA,
+};
+
+static const char *race_names[GUI_RACE_PANES] = {
+	"BFS",
+	"DFS",
+	"A Star",
+	"Dijkstra",
+};
+
+/*
+ * Panes are drawn as one pixel per half cell and scaled up when painted,
+ * so refreshing one costs a store per cell instead of a cairo fill. Hex
+ * rows are shifted by one pixel.
+ */
+static void gui_race_render_pane(struct MazeGui *gui, struct RacePane *pane)
+{
+	struct Maze *maze = pane->maze;
+	guint32 pixels[CELL_TYPE_PATH_SOLUTION + 1];
+	guint32 *line;
+	guchar *data;
+	gboolean hex;
+	int stride;
+	int shift;
+	int num_rows;
+	int num_cols;
+	int row;
+	int col;
+	int i;
+
+	for (i = 0; i <= CELL_TYPE_PATH_SOLUTION; i++)
+		pixels[i] = get_cell_pixel(i);
+
+	num_rows = maze_get_num_rows(maze);
+	num_cols = maze_get_num_cols(maze);
+	hex = maze_get_topology(maze) == TOPOLOGY_HEX;
+
+	cairo_surface_flush(pane->surface);
+	data = cairo_image_surface_get_data(pane->surface);
+	stride = cairo_image_surface_get_stride(pane->surface);
+
+	for (row = 0; row < num_rows; row++) {
+		line = (guint32 *)(data + row * stride);
+		shift = hex && (row & 1);
+
+		line[0] = pixels[CELL_TYPE_EMPTY];
+		line[num_cols * 2] = pixels[CELL_TYPE_EMPTY];
+
+		for (col = 0; col < num_cols; col++)
+			line[col * 2 + shift] = line[col * 2 + 1 + shift] =
+				pixels[maze_get_cell_type(maze, gui->level, row, col)];
+	}
+
+	cairo_surface_mark_dirty(pane->surface);
+}
+
+static void draw_race(struct MazeGui *gui, cairo_t *cr, int width, int height)
+{
+	struct RacePane *pane;
+	double pane_width = width / 2.0;
+	double pane_height = height / 2.0;
+	int i;
+
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+
+		cairo_save(cr);
+		cairo_translate(cr, (i % 2) * pane_width, (i / 2) * pane_height);
+		cairo_scale(cr,
+			    (pane_width - 2) / cairo_image_surface_get_width(pane->surface),
+			    (pane_height - 2) / cairo_image_surface_get_height(pane->surface));
+		cairo_set_source_surface(cr, pane->surface, 0.0, 0.0);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+		cairo_paint(cr);
+		cairo_restore(cr);
+	}
+}
+
+static void gui_race_show_stats(struct MazeGui *gui)
+{
+	struct MazeSolverStats stats;
+	struct RacePane *pane;
+	GString *text;
+	int i;
+
+	text = g_string_new(NULL);
+
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+		maze_get_solver_stats(pane->maze, &stats);
+
+		g_string_append_printf(text, "%s%s: %.02fs\n  %d expanded, %d open\n",
+				       i ? "\n" : "", race_names[i],
+				       stats.elapsed, stats.expanded,
+				       stats.frontier);
+
+		if (pane->reason == SOLVER_CB_REASON_SOLVED)
+			g_string_append_printf(text, "  Length %d, cost %d\n",
+					       maze_get_path_length(pane->maze),
+					       maze_get_path_cost(pane->maze));
+		else if (pane->reason == SOLVER_CB_REASON_CANCELED)
+			g_string_append(text, "  Canceled\n");
+	}
+
+	gtk_label_set_text(gui->info_label, text->str);
+	g_string_free(text, TRUE);
+}
+
+/* Like gui_solve_tick(), but only the panes which moved are rendered */
+static gboolean gui_race_tick(GtkWidget *da, GdkFrameClock *clock,
+			      struct MazeGui *gui)
+{
+	struct RacePane *pane;
+	gboolean redraw = FALSE;
+	int num_running = 0;
+	guint changes;
+	int reason;
+	int i;
+
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+
+		reason = maze_solve_poll(pane->maze);
+		changes = maze_get_changes(pane->maze);
+		if (changes != pane->changes || reason != pane->reason) {
+			gui_race_render_pane(gui, pane);
+			pane->changes = changes;
+			pane->reason = reason;
+			redraw = TRUE;
+		}
+
+		if (reason == SOLVER_CB_REASON_RUNNING)
+			num_running++;
+	}
+
+	gui_race_show_stats(gui);
+
+	if (redraw)
+		gtk_widget_queue_draw(da);
+
+	if (num_running)
+		return TRUE;
+
+	gui->racing = FALSE;
+	gui_set_busy(gui, FALSE);
+	gtk_button_set_label(GTK_BUTTON(gui->solve_button), "Solve");
+
+	return FALSE;
+}
+
+static void gui_race_start(struct MazeGui *gui)
+{
+	struct RacePane *pane;
+	int i;
+
+	gui_race_free(gui);
+
+	/* Copy first so every solver starts at the same time */
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+
+		pane->maze = maze_dup(gui->maze);
+		if (!pane->maze) {
+			gui_race_free(gui);
+			return;
+		}
+
+		maze_set_solver_algorithm(pane->maze, race_algos[i]);
+		pane->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+							   maze_get_num_cols(pane->maze) * 2 + 1,
+							   maze_get_num_rows(pane->maze));
+		pane->reason = SOLVER_CB_REASON_RUNNING;
+		pane->changes = maze_get_changes(pane->maze);
+		gui_race_render_pane(gui, pane);
+	}
+
+	gui->racing = TRUE;
+	gui_set_busy(gui, TRUE);
+	gtk_button_set_label(GTK_BUTTON(gui->solve_button), "Cancel");
+
+	for (i = 0; i < GUI_RACE_PANES; i++)
+		maze_solve_thread(gui->race[i].maze, NULL, NULL);
+
+	gtk_widget_add_tick_callback(gui->drawing_area,
+				     (GtkTickCallback)gui_race_tick, gui, NULL);
 }
 
 static void on_solve_clicked(GtkButton *button, struct MazeGui *gui)
 {
 	struct Maze *maze = gui->maze;
 	SolverAlgorithm algo;
+	int i;
+
+	if (gui->racing) {
+		for (i = 0; i < GUI_RACE_PANES; i++)
+			if (maze_solver_running(gui->race[i].maze))
+				maze_solve_thread_cancel(gui->race[i].maze);
+		return;
+	}
 
 	if (maze_solver_running(maze)) {
 		maze_solve_thread_cancel(maze);
 		return;
 	}
 
+	if (gtk_toggle_button_get_active(gui->race_check)) {
+		gui_race_start(gui);
+		return;
+	}
+
+	gui_race_free(gui);
+
 	algo = gtk_combo_box_get_active(GTK_COMBO_BOX(gui->algo_combo));
 	maze_set_solver_algorithm(maze, algo);
 
-	gtk_widget_set_sensitive(gui->new_button, FALSE);
-	gtk_widget_set_sensitive(gui->clear_button, FALSE);
+	gui_set_busy(gui, TRUE);
 	gtk_button_set_label(GTK_BUTTON(gui->solve_button), "Cancel");
 	label_set_text(gui->info_label, "");
 
-	maze_solve_thread(maze, (MazeSolverFunc)maze_solver_cb, gui);
+	gui->changes = maze_get_changes(maze);
+	if (maze_solve_thread(maze, NULL, NULL)) {
+		gui_solve_done(gui, SOLVER_CB_REASON_CANCELED);
+		return;
+	}
+
+	gtk_widget_add_tick_callback(gui->drawing_area,
+				     (GtkTickCallback)gui_solve_tick, gui, NULL);
 }
 
-static void on_draw(GtkDrawingArea *da, cairo_t *cr, struct MazeGui *gui)
+/* Shade rough terrain in brown, darker for more expensive cells */
+static void draw_cell_cost(struct MazeGui *gui, int row, int col)
+{
+	struct Maze *maze = gui->maze;
+	double alpha;
+	int cost;
+
+	cost = maze_get_cell_cost(maze, gui->level, row, col);
+	if (cost <= 1)
+		return;
+
+	alpha = 0.6 * (cost - 1) / (maze_get_max_cost(maze) - 1);
+
+	cairo_set_source_rgba(gui->cr, 0.55, 0.35, 0.15, alpha);
+	cairo_rectangle(gui->cr, gui_cell_x(gui, row, col),
+			row * gui->cell_height,
+			gui->cell_width, gui->cell_height);
+	cairo_fill(gui->cr);
+}
+
+/*
+ * Mark rooms linked to the level above in the top half of the cell and
+ * rooms linked to the level below in the bottom half.
+ */
+static void draw_cell_stairs(struct MazeGui *gui, int row, int col)
+{
+	GdkRGBA color;
+	int stairs;
+	double x;
+	double y;
+	double w;
+	double h;
+
+	stairs = maze_get_cell_stairs(gui->maze, gui->level, row, col);
+	if (!stairs)
+		return;
+
+	w = gui->cell_width / 2.0;
+	h = gui->cell_height / 4.0;
+	x = gui_cell_x(gui, row, col) + w / 2;
+	y = row * gui->cell_height + h;
+
+	if (stairs & MAZE_STAIRS_UP) {
+		get_gdk_color(ORANGE, &color);
+		gdk_cairo_set_source_rgba(gui->cr, &color);
+		cairo_rectangle(gui->cr, x, y, w, h);
+		cairo_fill(gui->cr);
+	}
+
+	if (stairs & MAZE_STAIRS_DOWN) {
+		get_gdk_color(PURPLE, &color);
+		gdk_cairo_set_source_rgba(gui->cr, &color);
+		cairo_rectangle(gui->cr, x, y + h, w, h);
+		cairo_fill(gui->cr);
+	}
+}
+
+static void gui_render_board(struct MazeGui *gui)
 {
-	GtkAllocation da_rect;
 	int cell_width;
 	int cell_height;
 	int row, col;
-	CellColor cell_color;
 	GdkRGBA color;
 	struct Maze *maze = gui->maze;
 	int num_rows;
 	int num_cols;
-	int surface_width;
-	int surface_height;
-	double scale_x;
-	double scale_y;
-
-	gtk_widget_get_allocated_size(GTK_WIDGET(da), &da_rect, NULL);
 
 	num_rows = maze_get_num_rows(maze);
 	num_cols = maze_get_num_cols(maze);
@@ -258,89 +814,339 @@ static void on_draw(GtkDrawingArea *da, cairo_t *cr, struct MazeGui *gui)
 
 	for (row = 0; row < num_rows; row++) {
 		for (col = 0; col < num_cols; col++) {
-			GtkAllocation rect;
 			CellType cell_type;
 
-			cell_type = maze_get_cell_type(maze, row, col);
+			cell_type = maze_get_cell_type(maze, gui->level, row, col);
 
-			switch (cell_type) {
-			case CELL_TYPE_EMPTY:
+			if (cell_type == CELL_TYPE_EMPTY) {
+				draw_cell_cost(gui, row, col);
+				draw_cell_stairs(gui, row, col);
 				continue;
-
-			case CELL_TYPE_WALL:
-				cell_color = BLACK;
-				break;
-			case CELL_TYPE_START:
-				cell_color = RED;
-				break;
-			case CELL_TYPE_END:
-				cell_color = LIGHTBLUE;
-				break;
-			case CELL_TYPE_PATH_HEAD:
-				cell_color = DARKGRAY;
-				break;
-			case CELL_TYPE_PATH_VISITED:
-				cell_color = LIGHTGRAY;
-				break;
-			case CELL_TYPE_PATH_SOLUTION:
-				cell_color = GREEN;
-				break;
 			}
 
-			get_gdk_color(cell_color, &color);
-
-			rect.x = col * cell_width;
-			rect.y = row * cell_height;
-			rect.width = cell_width;
-			rect.height = cell_height;
+			get_gdk_color(get_cell_color(cell_type), &color);
 
 			gdk_cairo_set_source_rgba(gui->cr, &color);
-			gdk_cairo_rectangle(gui->cr, &rect);
+			cairo_rectangle(gui->cr, gui_cell_x(gui, row, col),
+					row * cell_height,
+					cell_width, cell_height);
 
 			cairo_fill(gui->cr);
+
+			if (cell_type != CELL_TYPE_WALL)
+				draw_cell_stairs(gui, row, col);
 		}
 	}
+}
+
+/* Hover preview, drawn over the board in surface coordinates */
+static void draw_preview(struct MazeGui *gui, cairo_t *cr)
+{
+	struct MazePos *pos;
+	int i;
+
+	cairo_set_source_rgba(cr, 1.0, 0.6, 0.0, 0.6);
+
+	for (i = 0; i < gui->preview_len; i++) {
+		pos = &gui->preview[i];
+		if (pos->level != gui->level)
+			continue;
+
+		cairo_rectangle(cr, gui_cell_x(gui, pos->row, pos->col),
+				pos->row * gui->cell_height,
+				gui->cell_width, gui->cell_height);
+	}
+
+	cairo_fill(cr);
+}
+
+/* Walls changed since the reference, outlined over the board */
+static void draw_diff(struct MazeGui *gui, cairo_t *cr)
+{
+	struct MazePos *pos;
+	int i;
+
+	cairo_set_source_rgba(cr, 1.0, 0.0, 1.0, 0.8);
+	cairo_set_line_width(cr, MAX(gui->cell_width / 4, 1));
+
+	for (i = 0; i < gui->num_diffs; i++) {
+		pos = &gui->diffs[i];
+		if (pos->level != gui->level)
+			continue;
+
+		cairo_rectangle(cr, gui_cell_x(gui, pos->row, pos->col),
+				pos->row * gui->cell_height,
+				gui->cell_width, gui->cell_height);
+	}
 
-	surface_width = cairo_image_surface_get_width(gui->surface);
-	surface_height = cairo_image_surface_get_height(gui->surface);
+	cairo_stroke(cr);
+}
 
-	scale_x = (double)da_rect.width / surface_width;
-	scale_y = (double)da_rect.height / surface_height;
+/*
+ * Solver counters are read with atomics and summed over the race panes,
+ * the solver threads never wait on the HUD.
+ */
+static void draw_hud(struct MazeGui *gui, cairo_t *cr, gint64 now)
+{
+	struct MazeSolverStats stats;
+	int expanded = 0;
+	int frontier = 0;
+	gsize memory = 0;
+	char line[64];
+	int i;
+
+	if (gui->race[0].maze) {
+		for (i = 0; i < GUI_RACE_PANES; i++) {
+			maze_get_solver_stats(gui->race[i].maze, &stats);
+			expanded += stats.expanded;
+			frontier += stats.frontier;
+			memory += maze_get_memory_usage(gui->race[i].maze);
+		}
+	} else {
+		maze_get_solver_stats(gui->maze, &stats);
+		expanded = stats.expanded;
+		frontier = stats.frontier;
+	}
+	memory += maze_get_memory_usage(gui->maze);
+
+	/* Rates are averaged over a quarter of a second */
+	if (now - gui->hud_sample_time >= G_USEC_PER_SEC / 4) {
+		if (expanded >= gui->hud_sample_expanded)
+			gui->hud_cells_per_sec = (double)(expanded - gui->hud_sample_expanded) *
+						 G_USEC_PER_SEC / (now - gui->hud_sample_time);
+		else
+			gui->hud_cells_per_sec = 0;
+
+		gui->hud_sample_expanded = expanded;
+		gui->hud_sample_time = now;
+	}
 
-	cairo_scale(cr, scale_x, scale_y);
-	cairo_set_source_surface(cr, gui->surface, 0.0, 0.0);
-	cairo_paint(cr);
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+	cairo_rectangle(cr, 0, 0, 220, 100);
+	cairo_fill(cr);
+
+	cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
+	cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, 12);
+
+	g_snprintf(line, sizeof(line), "%5.1f fps  render %.2f ms",
+		   gui->hud_fps, gui->hud_render_time / 1000.0);
+	cairo_move_to(cr, 8, 18);
+	cairo_show_text(cr, line);
+
+	g_snprintf(line, sizeof(line), "%.0f cells/s", gui->hud_cells_per_sec);
+	cairo_move_to(cr, 8, 38);
+	cairo_show_text(cr, line);
+
+	g_snprintf(line, sizeof(line), "%d expanded, %d open", expanded,
+		   frontier);
+	cairo_move_to(cr, 8, 58);
+	cairo_show_text(cr, line);
+
+	g_snprintf(line, sizeof(line), "%.1f MiB board and search",
+		   (double)memory / (1024 * 1024));
+	cairo_move_to(cr, 8, 78);
+	cairo_show_text(cr, line);
+}
+
+static void on_draw(GtkDrawingArea *da, cairo_t *cr, struct MazeGui *gui)
+{
+	GtkAllocation da_rect;
+	int surface_width;
+	int surface_height;
+	double scale_x;
+	double scale_y;
+	gint64 start;
+
+	start = g_get_monotonic_time();
+
+	gtk_widget_get_allocated_size(GTK_WIDGET(da), &da_rect, NULL);
+
+	if (gui->race[0].maze) {
+		draw_race(gui, cr, da_rect.width, da_rect.height);
+	} else {
+		/* Pointer moves only redraw the preview over the cached board */
+		if (gui->board_dirty) {
+			gui_render_board(gui);
+			gui_update_diff(gui);
+			gui->board_dirty = FALSE;
+		}
+
+		surface_width = cairo_image_surface_get_width(gui->surface);
+		surface_height = cairo_image_surface_get_height(gui->surface);
+
+		scale_x = (double)da_rect.width / surface_width;
+		scale_y = (double)da_rect.height / surface_height;
+
+		cairo_save(cr);
+		cairo_scale(cr, scale_x, scale_y);
+		cairo_set_source_surface(cr, gui->surface, 0.0, 0.0);
+		cairo_paint(cr);
+
+		draw_diff(gui, cr);
+		draw_preview(gui, cr);
+		cairo_restore(cr);
+	}
+
+	if (!gui->hud)
+		return;
+
+	gui->hud_render_time = g_get_monotonic_time() - start;
+	if (gui->hud_last_frame)
+		gui->hud_fps = 0.9 * gui->hud_fps +
+			       0.1 * G_USEC_PER_SEC / MAX(start - gui->hud_last_frame, 1);
+	gui->hud_last_frame = start;
+
+	draw_hud(gui, cr, start);
+}
+
+static void on_hud_toggled(GtkToggleButton *check, struct MazeGui *gui)
+{
+	gui->hud = gtk_toggle_button_get_active(check);
+	gui->hud_last_frame = 0;
+	gui->hud_fps = 0;
+
+	gtk_widget_queue_draw(gui->drawing_area);
+}
+
+/* Take the maze as it is now as the reference of the diff overlay */
+static void on_diff_toggled(GtkToggleButton *check, struct MazeGui *gui)
+{
+	maze_free(gui->diff_ref);
+	gui->diff_ref = NULL;
+
+	if (gtk_toggle_button_get_active(check))
+		gui->diff_ref = maze_dup(gui->maze);
+
+	gui_queue_redraw(gui);
+}
+
+static void on_view_level_changed(GtkSpinButton *spin, struct MazeGui *gui)
+{
+	struct RacePane *pane;
+	int i;
+
+	gui->level = gtk_spin_button_get_value_as_int(spin);
+	gui->preview_len = 0;
+
+	for (i = 0; i < GUI_RACE_PANES; i++) {
+		pane = &gui->race[i];
+		if (pane->maze)
+			gui_race_render_pane(gui, pane);
+	}
+
+	gui_queue_redraw(gui);
 }
 
 static void on_speed_changed(GtkRange *range, struct MazeGui *gui)
 {
+	int i;
+
 	maze_set_anim_speed(gui->maze, (uint)gtk_range_get_value(range));
+
+	for (i = 0; i < GUI_RACE_PANES; i++)
+		if (gui->race[i].maze)
+			maze_set_anim_speed(gui->race[i].maze,
+					    (uint)gtk_range_get_value(range));
 }
 
 static gboolean on_mouse_clicked(GtkWidget *da, GdkEventButton *event,
 				 struct MazeGui *gui)
 {
 	struct Maze *maze = gui->maze;
-	GtkAllocation rect;
 	int row;
 	int col;
 
-	gtk_widget_get_allocated_size(da, &rect, NULL);
-	row = event->y * maze_get_num_rows(maze) / rect.height;
-	col =  event->x * maze_get_num_cols(maze) / rect.width;
-
-	if ((event->state & GDK_CONTROL_MASK) == GDK_CONTROL_MASK)
-		maze_set_end_cell(maze, row, col);
+	/* Editing the maze leaves the race view */
+	if (gui->racing)
+		return TRUE;
+
+	gui_race_free(gui);
+
+	gui_get_cell_at(gui, da, event->x, event->y, &row, &col);
+
+	if (event->button == 3) {
+		/* Right click carves or fills a cell */
+		maze_set_wall(maze, gui->level, row, col,
+			      maze_get_cell_type(maze, gui->level, row, col) !=
+			      CELL_TYPE_WALL);
+	} else if ((event->state & GDK_SHIFT_MASK) == GDK_SHIFT_MASK) {
+		/* Shift+click toggles an additional exit */
+		if (maze_remove_exit(maze, gui->level, row, col))
+			maze_add_exit(maze, gui->level, row, col);
+	} else if ((event->state & GDK_CONTROL_MASK) == GDK_CONTROL_MASK)
+		maze_set_end_cell(maze, gui->level, row, col);
 	else
-		maze_set_start_cell(maze, row, col);
+		maze_set_start_cell(maze, gui->level, row, col);
+
+	gui_update_preview(gui, row, col);
+	gui_queue_redraw(gui);
+
+	return TRUE;
+}
+
+static gboolean on_mouse_moved(GtkWidget *da, GdkEventMotion *event,
+			       struct MazeGui *gui)
+{
+	int row;
+	int col;
+
+	if (gui->race[0].maze)
+		return TRUE;
+
+	gui_get_cell_at(gui, da, event->x, event->y, &row, &col);
+
+	if (row != gui->hover_row || col != gui->hover_col)
+		gui_update_preview(gui, row, col);
+
+	return TRUE;
+}
+
+static gboolean on_mouse_left(GtkWidget *da, GdkEventCrossing *event,
+			      struct MazeGui *gui)
+{
+	gui->hover_row = -1;
+	gui->hover_col = -1;
+	gui->preview_len = 0;
 
 	gtk_widget_queue_draw(da);
 
 	return TRUE;
 }
 
+static gboolean on_key_pressed(GtkWidget *window, GdkEventKey *event,
+			       struct MazeGui *gui)
+{
+	int err;
+
+	if ((event->state & GDK_CONTROL_MASK) != GDK_CONTROL_MASK ||
+	    gui->racing)
+		return FALSE;
+
+	/* Ctrl+Z undoes the last edit, Ctrl+Shift+Z or Ctrl+Y redoes it */
+	if (event->keyval == GDK_KEY_Z || event->keyval == GDK_KEY_y ||
+	    (event->keyval == GDK_KEY_z &&
+	     (event->state & GDK_SHIFT_MASK) == GDK_SHIFT_MASK))
+		err = maze_redo(gui->maze);
+	else if (event->keyval == GDK_KEY_z)
+		err = maze_undo(gui->maze);
+	else
+		return FALSE;
+
+	if (!err) {
+		gui_race_free(gui);
+		if (gui->hover_row >= 0)
+			gui_update_preview(gui, gui->hover_row, gui->hover_col);
+		gui_queue_redraw(gui);
+	}
+
+	return TRUE;
+}
+
 static void on_destroy(GtkWindow *win, struct MazeGui *gui)
 {
+	gui_race_free(gui);
 	maze_solve_thread_cancel(gui->maze);
 }
 
@@ -352,6 +1158,7 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	GtkWidget *vbox;
 	GtkWidget *vbox2;
 	GtkWidget *drawing_area;
+	GtkWidget *label_levels;
 	GtkWidget *label_rows;
 	GtkWidget *label_cols;
 	GtkWidget *spin;
@@ -368,6 +1175,8 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	gtk_window_set_title(GTK_WINDOW(window), "CMaze");
 	g_signal_connect(G_OBJECT(window), "destroy",
 			 G_CALLBACK(on_destroy), gui);
+	g_signal_connect(G_OBJECT(window), "key-press-event",
+			 G_CALLBACK(on_key_pressed), gui);
 
 	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 	gtk_container_set_border_width(GTK_CONTAINER(hbox), 5);
@@ -385,9 +1194,14 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	g_signal_connect(G_OBJECT(drawing_area), "draw",
 			 G_CALLBACK(on_draw), gui);
 	gtk_widget_add_events(drawing_area,
-			      GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
+			      GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK |
+			      GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK);
 	g_signal_connect(G_OBJECT(drawing_area), "button-release-event",
 			 G_CALLBACK(on_mouse_clicked), gui);
+	g_signal_connect(G_OBJECT(drawing_area), "motion-notify-event",
+			 G_CALLBACK(on_mouse_moved), gui);
+	g_signal_connect(G_OBJECT(drawing_area), "leave-notify-event",
+			 G_CALLBACK(on_mouse_left), gui);
 
 	frame = gtk_frame_new("Maze");
 	gtk_frame_set_label_align(GTK_FRAME(frame), 0.05, 0.5);
@@ -400,6 +1214,18 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 	gtk_box_pack_start(GTK_BOX(vbox2), hbox, FALSE, FALSE, 0);
 
+	label_levels = gtk_label_new("Levels:");
+	gtk_label_set_xalign(GTK_LABEL(label_levels), 1.0);
+	gtk_box_pack_start(GTK_BOX(hbox), label_levels, TRUE, FALSE, 0);
+
+	spin = gtk_spin_button_new_with_range(MAZE_MIN_LEVELS, MAZE_MAX_LEVELS, 1);
+	gui->spin_num_levels = GTK_SPIN_BUTTON(spin);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), maze_get_num_levels(maze));
+	gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
+
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_box_pack_start(GTK_BOX(vbox2), hbox, FALSE, FALSE, 0);
+
 	label_rows = gtk_label_new("Rows:");
 	gtk_label_set_xalign(GTK_LABEL(label_rows), 1.0);
 	gtk_box_pack_start(GTK_BOX(hbox), label_rows, TRUE, FALSE, 0);
@@ -421,11 +1247,46 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), maze_get_num_cols(maze));
 	gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
 
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_box_pack_start(GTK_BOX(vbox2), hbox, FALSE, FALSE, 0);
+
+	label = gtk_label_new("Topology:");
+	gtk_label_set_xalign(GTK_LABEL(label), 1.0);
+	gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, FALSE, 0);
+
+	combo = GTK_COMBO_BOX_TEXT(gtk_combo_box_text_new());
+	gui->topology_combo = combo;
+	gtk_combo_box_text_insert_text(combo, TOPOLOGY_SQUARE, "Square");
+	gtk_combo_box_text_insert_text(combo, TOPOLOGY_OCTILE, "Octile");
+	gtk_combo_box_text_insert_text(combo, TOPOLOGY_TORUS, "Torus");
+	gtk_combo_box_text_insert_text(combo, TOPOLOGY_HEX, "Hex");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), maze_get_topology(maze));
+	gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(combo), FALSE, FALSE, 0);
+
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_box_pack_start(GTK_BOX(vbox2), hbox, FALSE, FALSE, 0);
+
+	label = gtk_label_new("Generator:");
+	gtk_label_set_xalign(GTK_LABEL(label), 1.0);
+	gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, FALSE, 0);
+
+	combo = GTK_COMBO_BOX_TEXT(gtk_combo_box_text_new());
+	gui->generator_combo = combo;
+	gtk_combo_box_text_insert_text(combo, GENERATOR_BACKTRACKER, "Backtracker");
+	gtk_combo_box_text_insert_text(combo, GENERATOR_HUNT_AND_KILL, "Hunt and kill");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), maze_get_generator(maze));
+	gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(combo), FALSE, FALSE, 0);
+
 	check = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Complex"));
 	gui->complex_check = check;
 	gtk_toggle_button_set_active(check, maze_get_difficult(maze));
 	gtk_box_pack_start(GTK_BOX(vbox2), GTK_WIDGET(check), FALSE, FALSE, 0);
 
+	check = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Terrain"));
+	gui->terrain_check = check;
+	gtk_toggle_button_set_active(check, maze_get_max_cost(maze) > 1);
+	gtk_box_pack_start(GTK_BOX(vbox2), GTK_WIDGET(check), FALSE, FALSE, 0);
+
 	button = gtk_button_new_with_label("New");
 	gui->new_button = g_object_ref(button);
 	g_signal_connect(G_OBJECT(button), "clicked",
@@ -438,6 +1299,19 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 			 G_CALLBACK(on_clear_clicked), gui);
 	gtk_box_pack_start(GTK_BOX(vbox2), button, FALSE, FALSE, 0);
 
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_box_pack_start(GTK_BOX(vbox2), hbox, FALSE, FALSE, 0);
+
+	label = gtk_label_new("View level:");
+	gtk_label_set_xalign(GTK_LABEL(label), 1.0);
+	gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, FALSE, 0);
+
+	spin = gtk_spin_button_new_with_range(0, maze_get_num_levels(maze) - 1, 1);
+	gui->spin_view_level = GTK_SPIN_BUTTON(spin);
+	g_signal_connect(G_OBJECT(spin), "value-changed",
+			 G_CALLBACK(on_view_level_changed), gui);
+	gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
+
 	frame = gtk_frame_new("Solver Algorithm");
 	gtk_frame_set_label_align(GTK_FRAME(frame), 0.1, 0.5);
 	gtk_box_pack_start(GTK_BOX(vbox), frame, FALSE, FALSE, 3);
@@ -454,10 +1328,29 @@ static void gui_activate(GtkApplication* app, struct MazeGui *gui)
 	gtk_combo_box_text_insert_text(combo, SOLVER_A_STAR, "A Star");
 	gtk_combo_box_text_insert_text(combo, SOLVER_ALWAYS_TURN_LEFT, "Always Turn Left");
 	gtk_combo_box_text_insert_text(combo, SOLVER_ALWAYS_TURN_RIGHT, "Always Turn Right");
+	gtk_combo_box_text_insert_text(combo, SOLVER_DIJKSTRA, "Dijkstra");
+	gtk_combo_box_text_insert_text(combo, SOLVER_WEIGHTED_A_STAR, "Weighted A Star");
+	gtk_combo_box_text_insert_text(combo, SOLVER_NEAREST_EXIT, "Nearest Exit");
+	gtk_combo_box_text_insert_text(combo, SOLVER_PARALLEL_BFS, "Parallel BFS");
+	gtk_combo_box_text_insert_text(combo, SOLVER_SHARDED_BFS, "Sharded BFS");
 	gtk_combo_box_set_active(GTK_COMBO_BOX(combo),
 				 maze_get_solver_algorithm(maze));
 	gtk_container_add(GTK_CONTAINER(hbox), GTK_WIDGET(combo));
 
+	check = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Race BFS, DFS, A Star and Dijkstra"));
+	gui->race_check = check;
+	gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(check), FALSE, FALSE, 0);
+
+	check = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Performance overlay"));
+	g_signal_connect(G_OBJECT(check), "toggled",
+			 G_CALLBACK(on_hud_toggled), gui);
+	gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(check), FALSE, FALSE, 0);
+
+	check = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Show wall changes"));
+	g_signal_connect(G_OBJECT(check), "toggled",
+			 G_CALLBACK(on_diff_toggled), gui);
+	gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(check), FALSE, FALSE, 0);
+
 	frame = gtk_frame_new("Animation Speed");
 	gtk_frame_set_label_align(GTK_FRAME(frame), 0.1, 0.5);
 	gtk_box_pack_start(GTK_BOX(vbox), frame, FALSE, FALSE, 3);
@@ -494,6 +1387,9 @@ static void gui_cleanup(struct MazeGui *gui)
 	g_object_unref(gui->solve_button);
 
 	cairo_surface_free(gui);
+	g_free(gui->preview);
+	g_free(gui->diffs);
+	maze_free(gui->diff_ref);
 }
 
 int gtk_maze_run(struct Maze *maze)
@@ -502,6 +1398,8 @@ int gtk_maze_run(struct Maze *maze)
 
 	gui = g_malloc0(sizeof(*gui));
 	gui->maze = maze;
+	gui->hover_row = -1;
+	gui->hover_col = -1;
 
 	gui->app = gtk_application_new("org.escande.boids", G_APPLICATION_NON_UNIQUE);
 	g_signal_connect(gui->app, "activate", G_CALLBACK(gui_activate), gui);
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: MIT */
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "cmaze.h"
+
+/*
+ * Image importer
+ *
+ * Pixels are folded into the luminance sums of a band of cell_size pixel
+ * rows, one pixel row at a time, and each completed band becomes a row of
+ * cells: a wall when its mean luminance is below the threshold. Only one
+ * pixel row and one row of sums are kept, so the size of the image is only
+ * bounded by the number of cells it maps to.
+ *
+ * Binary PBM, PGM and PPM files are read directly, with 8 or 16 bits per
+ * sample. Other formats go through gdk-pixbuf, which decodes the whole
+ * image first.
+ */
+
+struct ImageImport {
+	int width;
+	int height;
+	int cell_size;
+	int threshold;
+
+	int num_rows;
+	int num_cols;
+
+	/* Luminance of the current pixel row */
+	guint8 *luma;
+
+	/* Luminance sums of the cells of the current band */
+	guint64 *sums;
+	int band_rows;
+	int row;
+
+	guint8 *layout;
+};
+
+static int image_import_init(struct ImageImport *imp, int width, int height,
+			     int cell_size, int threshold)
+{
+	if (width <= 0 || height <= 0)
+		return -1;
+
+	/* By default, the smallest cells that fit the largest maze */
+	if (cell_size <= 0)
+		cell_size = MAX((width + MAZE_MAX_COLS - 1) / MAZE_MAX_COLS,
+				(height + MAZE_MAX_ROWS - 1) / MAZE_MAX_ROWS);
+
+	imp->width = width;
+	imp->height = height;
+	imp->cell_size = cell_size;
+	imp->threshold = threshold;
+	imp->num_rows = (height + cell_size - 1) / cell_size;
+	imp->num_cols = (width + cell_size - 1) / cell_size;
+
+	if (imp->num_rows < MAZE_MIN_ROWS || imp->num_rows > MAZE_MAX_ROWS ||
+	    imp->num_cols < MAZE_MIN_COLS || imp->num_cols > MAZE_MAX_COLS) {
+		g_fprintf(stderr, "%dx%d image makes a %dx%d maze\n", width,
+			  height, imp->num_rows, imp->num_cols);
+		return -1;
+	}
+
+	imp->luma = g_malloc(width);
+	imp->sums = g_new0(guint64, imp->num_cols);
+	imp->band_rows = 0;
+	imp->row = 0;
+	imp->layout = g_malloc(imp->num_rows * imp->num_cols);
+
+	return 0;
+}
+
+static void image_import_clear(struct ImageImport *imp)
+{
+	g_free(imp->luma);
+	g_free(imp->sums);
+	g_free(imp->layout);
+}
+
+/* Turn the current band into a row of cells */
+static void image_import_flush(struct ImageImport *imp)
+{
+	guint8 *cells = &imp->layout[imp->row * imp->num_cols];
+	guint64 num_pixels;
+	int col;
+
+	for (col = 0; col < imp->num_cols; col++) {
+		num_pixels = (guint64)imp->band_rows *
+			     MIN(imp->cell_size,
+				 imp->width - col * imp->cell_size);
+		cells[col] = imp->sums[col] < imp->threshold * num_pixels;
+		imp->sums[col] = 0;
+	}
+
+	imp->band_rows = 0;
+	imp->row++;
+}
+
+/* Fold the pixel row in imp->luma */
+static void image_import_row(struct ImageImport *imp)
+{
+	guint64 sum;
+	int col;
+	int x;
+	int end;
+
+	for (col = 0, x = 0; col < imp->num_cols; col++) {
+		end = MIN(x + imp->cell_size, imp->width);
+		for (sum = 0; x < end; x++)
+			sum += imp->luma[x];
+		imp->sums[col] += sum;
+	}
+
+	if (++imp->band_rows == imp->cell_size)
+		image_import_flush(imp);
+}
+
+static int image_import_finish(struct ImageImport *imp, struct Maze *maze)
+{
+	if (imp->band_rows)
+		image_import_flush(imp);
+
+	return maze_set_layout(maze, imp->num_rows, imp->num_cols,
+			       imp->layout);
+}
+
+/* Next number of a PNM header, skipping blanks and comments */
+static int pnm_read_value(FILE *file, int *value)
+{
+	int c;
+
+	do {
+		c = getc(file);
+		if (c == '#')
+			while (c != '\n' && c != EOF)
+				c = getc(file);
+	} while (g_ascii_isspace(c));
+
+	if (!g_ascii_isdigit(c))
+		return -1;
+
+	for (*value = 0; g_ascii_isdigit(c); c = getc(file)) {
+		if (*value > (G_MAXINT - 9) / 10)
+			return -1;
+		*value = *value * 10 + c - '0';
+	}
+
+	/* A single blank ends the header */
+	return g_ascii_isspace(c) ? 0 : -1;
+}
+
+/* Convert a row of raw PNM samples in buf to luminance */
+static void pnm_row_to_luma(struct ImageImport *imp, char format, int maxval,
+			    const guint8 *buf)
+{
+	int num_samples = format == '6' ? 3 : 1;
+	guint sample[3];
+	int x;
+	int i;
+
+	if (format == '4') {
+		/* PBM: 1 is black */
+		for (x = 0; x < imp->width; x++)
+			imp->luma[x] = (buf[x >> 3] & (0x80 >> (x & 7))) ? 0 :
+									   255;
+		return;
+	}
+
+	for (x = 0; x < imp->width; x++) {
+		for (i = 0; i < num_samples; i++) {
+			if (maxval > 255) {
+				sample[i] = buf[0] << 8 | buf[1];
+				buf += 2;
+			} else {
+				sample[i] = *buf++;
+			}
+			sample[i] = sample[i] * 255 / maxval;
+		}
+
+		if (format == '6')
+			imp->luma[x] = (77 * sample[0] + 150 * sample[1] +
+					29 * sample[2]) >> 8;
+		else
+			imp->luma[x] = sample[0];
+	}
+}
+
+static int import_pnm(struct Maze *maze, FILE *file, int cell_size,
+		      int threshold)
+{
+	struct ImageImport imp = { 0 };
+	guint8 *buf = NULL;
+	gsize row_size;
+	char format;
+	int maxval = 1;
+	int width;
+	int height;
+	int err = -1;
+	int y;
+
+	format = getc(file);
+	if (pnm_read_value(file, &width) || pnm_read_value(file, &height) ||
+	    (format != '4' && pnm_read_value(file, &maxval)) ||
+	    maxval <= 0 || maxval > 65535)
+		goto exit;
+
+	if (image_import_init(&imp, width, height, cell_size, threshold))
+		goto exit;
+
+	if (format == '4')
+		row_size = (width + 7) / 8;
+	else
+		row_size = (gsize)width * (format == '6' ? 3 : 1) *
+			   (maxval > 255 ? 2 : 1);
+	buf = g_malloc(row_size);
+
+	for (y = 0; y < height; y++) {
+		if (fread(buf, 1, row_size, file) != row_size)
+			goto exit;
+
+		pnm_row_to_luma(&imp, format, maxval, buf);
+		image_import_row(&imp);
+	}
+
+	err = image_import_finish(&imp, maze);
+
+exit:
+	g_free(buf);
+	image_import_clear(&imp);
+
+	return err;
+}
+
+static int import_pixbuf(struct Maze *maze, const char *filename,
+			 int cell_size, int threshold)
+{
+	struct ImageImport imp = { 0 };
+	GdkPixbuf *pixbuf;
+	GError *error = NULL;
+	const guint8 *pixel;
+	int num_channels;
+	int stride;
+	int err = -1;
+	int x;
+	int y;
+
+	pixbuf = gdk_pixbuf_new_from_file(filename, &error);
+	if (!pixbuf) {
+		g_fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	if (image_import_init(&imp, gdk_pixbuf_get_width(pixbuf),
+			      gdk_pixbuf_get_height(pixbuf), cell_size,
+			      threshold))
+		goto exit;
+
+	num_channels = gdk_pixbuf_get_n_channels(pixbuf);
+	stride = gdk_pixbuf_get_rowstride(pixbuf);
+
+	for (y = 0; y < imp.height; y++) {
+		pixel = gdk_pixbuf_get_pixels(pixbuf) + (gsize)y * stride;
+		for (x = 0; x < imp.width; x++, pixel += num_channels)
+			imp.luma[x] = (77 * pixel[0] + 150 * pixel[1] +
+				       29 * pixel[2]) >> 8;
+
+		image_import_row(&imp);
+	}
+
+	err = image_import_finish(&imp, maze);
+
+exit:
+	image_import_clear(&imp);
+	g_object_unref(pixbuf);
+
+	return err;
+}
+
+/*
+ * Replace the maze with the black and white image in filename ("-" for a
+ * PNM on the standard input), see maze_set_layout() for the endpoints.
+ * cell_size is the side of a cell in pixels, 0 to fit the largest maze.
+ */
+int maze_import_image(struct Maze *maze, const char *filename, int cell_size,
+		      int threshold)
+{
+	gboolean from_stdin;
+	gboolean is_pnm;
+	FILE *file;
+	int magic;
+	int err = -1;
+
+	from_stdin = !g_strcmp0(filename, "-");
+	file = from_stdin ? stdin : fopen(filename, "rb");
+	if (!file)
+		return -1;
+
+	is_pnm = getc(file) == 'P';
+	magic = getc(file);
+	is_pnm = is_pnm && magic >= '4' && magic <= '6';
+
+	if (is_pnm) {
+		ungetc(magic, file);
+		err = import_pnm(maze, file, cell_size, threshold);
+	}
+
+	if (!from_stdin)
+		fclose(file);
+
+	if (!is_pnm && !from_stdin)
+		err = import_pixbuf(maze, filename, cell_size, threshold);
+
+	return err;
+}
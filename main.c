@@ -1,14 +1,177 @@
 /* SPDX-License-Identifier: MIT */
 #include "cmaze.h"
 
+static const char *algo_names[] = {
+	[SOLVER_BFS] = "BFS",
+	[SOLVER_DFS] = "DFS",
+	[SOLVER_A_STAR] = "A Star",
+	[SOLVER_ALWAYS_TURN_LEFT] = "Always Turn Left",
+	[SOLVER_ALWAYS_TURN_RIGHT] = "Always Turn Right",
+	[SOLVER_DIJKSTRA] = "Dijkstra",
+	[SOLVER_WEIGHTED_A_STAR] = "Weighted A Star",
+	[SOLVER_NEAREST_EXIT] = "Nearest Exit",
+	[SOLVER_PARALLEL_BFS] = "Parallel BFS",
+	[SOLVER_SHARDED_BFS] = "Sharded BFS",
+};
+
+/*
+ * Time every solver on the same maze, through the interactive path used by
+ * the GUI (animation disabled) and through the headless one.
+ */
+static void benchmark(struct Maze *maze, int num_runs)
+{
+	SolverAlgorithm algo;
+	float interactive;
+	float headless;
+	int i;
+
+	maze_set_anim_speed(maze, 100);
+
+	g_printf("%-18s %8s %12s %12s\n", "Solver", "Length",
+		 "Generic (s)", "Headless (s)");
+
+	for (algo = SOLVER_BFS; algo <= SOLVER_SHARDED_BFS; algo++) {
+		maze_set_solver_algorithm(maze, algo);
+
+		interactive = 0;
+		headless = 0;
+		for (i = 0; i < num_runs; i++) {
+			maze_solve(maze);
+			interactive += maze_get_solve_time(maze);
+
+			maze_solve_headless(maze);
+			headless += maze_get_solve_time(maze);
+		}
+
+		g_printf("%-18s %8d %12.06f %12.06f\n", algo_names[algo],
+			 maze_get_path_length(maze),
+			 interactive / num_runs, headless / num_runs);
+	}
+}
+
+/*
+ * Route num_agents agents between random open cells, starts and goals all
+ * distinct, and time the cooperative planner.
+ */
+static int benchmark_agents(struct Maze *maze, int num_agents, int max_delay)
+{
+	struct MazeAgent *agents;
+	struct MazePos *open;
+	struct MazePos tmp;
+	gint64 start;
+	gint64 duration;
+	int num_open = 0;
+	int num_planned;
+	int makespan = 0;
+	long steps = 0;
+	int level;
+	int row;
+	int col;
+	int i;
+	int j;
+
+	open = g_new(struct MazePos, maze_get_num_levels(maze) *
+				     maze_get_num_rows(maze) *
+				     maze_get_num_cols(maze));
+
+	for (level = 0; level < maze_get_num_levels(maze); level++)
+		for (row = 0; row < maze_get_num_rows(maze); row++)
+			for (col = 0; col < maze_get_num_cols(maze); col++)
+				if (maze_get_cell_type(maze, level, row, col) !=
+				    CELL_TYPE_WALL)
+					open[num_open++] = (struct MazePos) {
+						level, row, col
+					};
+
+	if (2 * num_agents > num_open) {
+		g_fprintf(stderr, "%d agents need %d open cells, the maze has %d\n",
+			  num_agents, 2 * num_agents, num_open);
+		g_free(open);
+		return -1;
+	}
+
+	for (i = 0; i < 2 * num_agents; i++) {
+		j = i + rand() % (num_open - i);
+		tmp = open[i];
+		open[i] = open[j];
+		open[j] = tmp;
+	}
+
+	agents = g_new0(struct MazeAgent, num_agents);
+	for (i = 0; i < num_agents; i++) {
+		agents[i].start = open[i];
+		agents[i].goal = open[num_agents + i];
+	}
+
+	start = g_get_monotonic_time();
+	num_planned = maze_plan_agents(maze, agents, num_agents, max_delay);
+	duration = g_get_monotonic_time() - start;
+
+	for (i = 0; i < num_agents; i++) {
+		if (!agents[i].path)
+			continue;
+
+		steps += agents[i].path_len - 1;
+		makespan = MAX(makespan, agents[i].path_len - 1);
+	}
+
+	g_printf("%-12s %8d\n%-12s %8d\n%-12s %8ld\n%-12s %8d\n%-12s %12.06f\n",
+		 "Agents", num_agents, "Routed", num_planned, "Steps", steps,
+		 "Makespan", makespan, "Time (s)", duration / 1e6);
+
+	maze_agents_clear(agents, num_agents);
+	g_free(agents);
+	g_free(open);
+
+	return num_planned < 0 ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
+	int num_levels = 1;
 	int num_rows = 121;
 	int num_cols = 121;
 	gboolean complex = FALSE;
 	uint anim_speed = 100;
+	uint max_cost = 0;
 	int seed = 0;
+	char *topology = NULL;
+	char *generator = NULL;
+	int num_runs = 0;
+	int num_threads = 0;
+	gboolean pin_threads = FALSE;
+	gboolean numa_report = FALSE;
+	int num_batch = 0;
+	char *batch_workers = NULL;
+	char *batch_output = NULL;
+	char *load_file = NULL;
+	char *save_file = NULL;
+	char *replay_file = NULL;
+	char *record_file = NULL;
+	gboolean compact = FALSE;
+	char *import_file = NULL;
+	int cell_size = 0;
+	int threshold = 128;
+	char *graph_file = NULL;
+	char *graph_format = NULL;
+	MazeGraphFormat graph_fmt = GRAPH_FORMAT_CSR;
+	FILE *graph;
+	gboolean validate = FALSE;
+	struct MazeReport report;
+	int num_agents = 0;
+	int agent_delay = 64;
+	int agent_budget = 0;
+	struct MazeSolveLimits limits = { 0 };
+	struct MazeBatchConfig batch = {
+		.num_gen_workers = 2,
+		.num_analyze_workers = 1,
+		.num_solve_workers = 2,
+		.num_export_workers = 1,
+		.pool_size = 16,
+	};
+	MazeTopology topo = TOPOLOGY_SQUARE;
+	MazeGenerator gen = GENERATOR_BACKTRACKER;
 	struct Maze *maze;
 
 	GError *error = NULL;
@@ -18,12 +181,62 @@ int main(int argc, char **argv)
 		  "Number of rows", "ROWS" },
 		{ "num-cols",   'c', 0, G_OPTION_ARG_INT, &num_cols,
 		  "Number of columns", "COLS" },
+		{ "num-levels", 'l', 0, G_OPTION_ARG_INT, &num_levels,
+		  "Number of levels", "LEVELS" },
 		{ "complex",  'C', 0, G_OPTION_ARG_NONE, &complex,
 		  "Produce a more complex maze", NULL },
+		{ "topology",   't', 0, G_OPTION_ARG_STRING, &topology,
+		  "Solver moves: square, octile, torus or hex", "TOPO" },
+		{ "generator",  'g', 0, G_OPTION_ARG_STRING, &generator,
+		  "Maze generator: backtracker or hunt-and-kill", "GEN" },
+		{ "threads",    'j', 0, G_OPTION_ARG_INT, &num_threads,
+		  "Threads or processes of the parallel solvers (default one per CPU)", "NUM" },
+		{ "pin-threads", 'p', 0, G_OPTION_ARG_NONE, &pin_threads,
+		  "Pin each stripe thread to a CPU", NULL },
+		{ "numa-report", 0, 0, G_OPTION_ARG_NONE, &numa_report,
+		  "Print the NUMA node of the board pages", NULL },
+		{ "max-cost",   'w', 0, G_OPTION_ARG_INT, &max_cost,
+		  "Maximum terrain cost of a cell (terrain enabled if > 1)", "VAL" },
 		{ "anim-speed", 'a', 0, G_OPTION_ARG_INT, &anim_speed,
 		  "Specify the animation speed (in percent)", "VAL" },
 		{ "rand-seed",  's', 0, G_OPTION_ARG_INT, &seed,
 		  "Random seed value", "VAL" },
+		{ "benchmark",  'b', 0, G_OPTION_ARG_INT, &num_runs,
+		  "Time the solvers over RUNS runs and exit", "RUNS" },
+		{ "batch",      'B', 0, G_OPTION_ARG_INT, &num_batch,
+		  "Generate, analyze and solve NUM mazes without GUI", "NUM" },
+		{ "batch-workers", 0, 0, G_OPTION_ARG_STRING, &batch_workers,
+		  "Threads per batch stage (default 2,1,2,1)", "GEN,ANA,SOL,EXP" },
+		{ "batch-output", 0, 0, G_OPTION_ARG_FILENAME, &batch_output,
+		  "Batch CSV output file (default stdout)", "FILE" },
+		{ "load",       0, 0, G_OPTION_ARG_FILENAME, &load_file,
+		  "Load the maze from FILE instead of generating it", "FILE" },
+		{ "import",     0, 0, G_OPTION_ARG_FILENAME, &import_file,
+		  "Import the maze from a black and white image", "FILE" },
+		{ "cell-size",  0, 0, G_OPTION_ARG_INT, &cell_size,
+		  "Image pixels per cell side (default fits the image)", "PIXELS" },
+		{ "threshold",  0, 0, G_OPTION_ARG_INT, &threshold,
+		  "Luminance below which a cell is a wall (default 128)", "VAL" },
+		{ "replay",     0, 0, G_OPTION_ARG_FILENAME, &replay_file,
+		  "Replay the edits recorded in FILE", "FILE" },
+		{ "save",       0, 0, G_OPTION_ARG_FILENAME, &save_file,
+		  "Save the maze to FILE before running", "FILE" },
+		{ "record",     0, 0, G_OPTION_ARG_FILENAME, &record_file,
+		  "Record the edits of the session to FILE", "FILE" },
+		{ "compact",    0, 0, G_OPTION_ARG_NONE, &compact,
+		  "Keep the maze compressed until it is solved or edited", NULL },
+		{ "export-graph", 0, 0, G_OPTION_ARG_FILENAME, &graph_file,
+		  "Export the junction graph to FILE (- for stdout)", "FILE" },
+		{ "graph-format", 0, 0, G_OPTION_ARG_STRING, &graph_format,
+		  "Graph format: csr, edges or graphml (default csr)", "FMT" },
+		{ "validate",   0, 0, G_OPTION_ARG_NONE, &validate,
+		  "Check that the maze is well formed and exit", NULL },
+		{ "agents",     0, 0, G_OPTION_ARG_INT, &num_agents,
+		  "Route NUM agents without collisions, time it and exit", "NUM" },
+		{ "agent-delay", 0, 0, G_OPTION_ARG_INT, &agent_delay,
+		  "Steps an agent may wait or detour (default 64)", "STEPS" },
+		{ "agent-budget", 0, 0, G_OPTION_ARG_INT, &agent_budget,
+		  "Search states expanded per agent (default no limit)", "NUM" },
 		{ NULL }
 	};
 
@@ -34,21 +247,180 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (topology) {
+		if (!g_strcmp0(topology, "square")) {
+			topo = TOPOLOGY_SQUARE;
+		} else if (!g_strcmp0(topology, "octile")) {
+			topo = TOPOLOGY_OCTILE;
+		} else if (!g_strcmp0(topology, "torus")) {
+			topo = TOPOLOGY_TORUS;
+		} else if (!g_strcmp0(topology, "hex")) {
+			topo = TOPOLOGY_HEX;
+		} else {
+			g_fprintf(stderr, "Invalid topology '%s'\n", topology);
+			return -1;
+		}
+	}
+
+	if (generator) {
+		if (!g_strcmp0(generator, "backtracker")) {
+			gen = GENERATOR_BACKTRACKER;
+		} else if (!g_strcmp0(generator, "hunt-and-kill")) {
+			gen = GENERATOR_HUNT_AND_KILL;
+		} else {
+			g_fprintf(stderr, "Invalid generator '%s'\n", generator);
+			return -1;
+		}
+	}
+
+	if (graph_format) {
+		if (!g_strcmp0(graph_format, "csr")) {
+			graph_fmt = GRAPH_FORMAT_CSR;
+		} else if (!g_strcmp0(graph_format, "edges")) {
+			graph_fmt = GRAPH_FORMAT_EDGE_LIST;
+		} else if (!g_strcmp0(graph_format, "graphml")) {
+			graph_fmt = GRAPH_FORMAT_GRAPHML;
+		} else {
+			g_fprintf(stderr, "Invalid graph format '%s'\n",
+				  graph_format);
+			return -1;
+		}
+	}
+
 	if (!seed)
 		seed = time(NULL);
 	srand(seed);
 
+	if (num_batch > 0) {
+		if (batch_workers &&
+		    sscanf(batch_workers, "%d,%d,%d,%d",
+			   &batch.num_gen_workers, &batch.num_analyze_workers,
+			   &batch.num_solve_workers,
+			   &batch.num_export_workers) != 4) {
+			g_fprintf(stderr, "Invalid batch workers '%s'\n",
+				  batch_workers);
+			return -1;
+		}
+
+		batch.output = stdout;
+		if (batch_output) {
+			batch.output = fopen(batch_output, "w");
+			if (!batch.output) {
+				g_fprintf(stderr, "Can't open %s\n", batch_output);
+				return -1;
+			}
+		}
+
+		batch.num_mazes = num_batch;
+		batch.num_levels = num_levels;
+		batch.num_rows = num_rows;
+		batch.num_cols = num_cols;
+		batch.complex = complex;
+		batch.max_cost = max_cost;
+		batch.topology = topo;
+		batch.generator = gen;
+		batch.algorithm = SOLVER_BFS;
+		batch.seed = seed;
+
+		err = maze_batch_run(&batch);
+
+		if (batch.output != stdout)
+			fclose(batch.output);
+
+		return err;
+	}
+
 	maze = maze_alloc();
 	maze_set_solver_algorithm(maze, SOLVER_BFS);
 	maze_set_anim_speed(maze, anim_speed);
+	maze_set_max_cost(maze, max_cost);
+	maze_set_topology(maze, topo);
+	maze_set_generator(maze, gen);
+	maze_set_num_threads(maze, num_threads);
+	maze_set_pin_threads(maze, pin_threads);
+
+	if (load_file) {
+		err = maze_load(maze, load_file);
+		if (err) {
+			g_fprintf(stderr, "Can't load %s\n", load_file);
+			goto exit_err;
+		}
+	} else if (import_file) {
+		err = maze_import_image(maze, import_file, cell_size, threshold);
+		if (err) {
+			g_fprintf(stderr, "Can't import %s\n", import_file);
+			goto exit_err;
+		}
+	} else {
+		err = maze_create(maze, num_levels, num_rows, num_cols, complex);
+		if (err) {
+			g_fprintf(stderr, "create_maze failed\n");
+			goto exit_err;
+		}
+	}
+
+	if (replay_file) {
+		err = maze_journal_replay(maze, replay_file);
+		if (err) {
+			g_fprintf(stderr, "Can't replay %s\n", replay_file);
+			goto exit_err;
+		}
+	}
+
+	if (save_file) {
+		err = maze_save(maze, save_file);
+		if (err) {
+			g_fprintf(stderr, "Can't save %s\n", save_file);
+			goto exit_err;
+		}
+	}
 
-	err = maze_create(maze, num_rows, num_cols, complex);
-	if (err) {
-		g_fprintf(stderr, "create_maze failed\n");
+	if (validate) {
+		err = maze_validate(maze, &report);
+		if (!err) {
+			g_printf("open cells: %d\npassages: %d\ncomponents: %d\n"
+				 "cycles: %d\nopenings: %d\nbad stairs: %d\n%s\n",
+				 report.num_open, report.num_passages,
+				 report.num_components, report.num_cycles,
+				 report.num_openings, report.num_bad_stairs,
+				 report.valid ? "valid" : "invalid");
+			err = report.valid ? 0 : -1;
+		}
 		goto exit_err;
 	}
 
-	err = gtk_maze_run(maze);
+	if (graph_file) {
+		graph = g_strcmp0(graph_file, "-") ? fopen(graph_file, "wb") :
+						     stdout;
+		err = graph ? maze_export_graph(maze, graph, graph_fmt) : -1;
+		if (graph && graph != stdout && fclose(graph))
+			err = -1;
+		if (err) {
+			g_fprintf(stderr, "Can't export %s\n", graph_file);
+			goto exit_err;
+		}
+	}
+
+	if (numa_report)
+		maze_print_numa_report(maze);
+
+	if (compact)
+		maze_compact(maze);
+
+	if (num_agents > 0) {
+		limits.max_expanded = agent_budget;
+		maze_set_solve_limits(maze, &limits);
+		err = benchmark_agents(maze, num_agents, agent_delay);
+	} else if (num_runs > 0) {
+		benchmark(maze, num_runs);
+	} else {
+		err = gtk_maze_run(maze);
+	}
+
+	if (record_file && maze_journal_save(maze, record_file)) {
+		g_fprintf(stderr, "Can't save %s\n", record_file);
+		err = -1;
+	}
 
 exit_err:
 	maze_free(maze);
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT */
+#include <cstdlib>
+
+#include "cmaze.hpp"
+
+/*
+ * Time the C solvers, generic and headless, against the C++ kernels on the
+ * same maze, for every topology. The Counted column runs CountStats
+ * and a callback animation, the price of not compiling them out.
+ *
+ * Usage: bench_cmaze_hpp [rows [cols [runs [max_cost]]]]
+ */
+
+static const char *topology_names[] = {
+	"square", "octile", "torus", "hex",
+};
+
+template <class Search, class Board>
+static float time_kernel(SolverAlgorithm algo, const Board &board,
+			 cmaze::SearchScratch &scratch, int num_runs)
+{
+	gint64 start = g_get_monotonic_time();
+
+	for (int i = 0; i < num_runs; i++)
+		Search::solve(algo, board, scratch);
+
+	return (g_get_monotonic_time() - start) / 1e6f / num_runs;
+}
+
+template <class Topology, class Board>
+static float time_headless(SolverAlgorithm algo, const Board &board,
+			   cmaze::SearchScratch &scratch, int num_runs)
+{
+	return time_kernel<cmaze::Search<Topology, Board> >(algo, board,
+							    scratch, num_runs);
+}
+
+template <class Topology>
+static float time_instrumented(SolverAlgorithm algo,
+			       const cmaze::DenseBoard &board,
+			       cmaze::SearchScratch &scratch, int num_runs)
+{
+	cmaze::CountStats stats;
+	long visited = 0;
+	auto anim = cmaze::animate([&visited](int) {
+		visited++;
+		return true;
+	});
+	typedef cmaze::Search<Topology, cmaze::DenseBoard, cmaze::CountStats,
+			      decltype(anim)> Instrumented;
+	gint64 start = g_get_monotonic_time();
+
+	for (int i = 0; i < num_runs; i++)
+		Instrumented::solve(algo, board, scratch, stats, anim);
+
+	return (g_get_monotonic_time() - start) / 1e6f / num_runs;
+}
+
+/* Torus can't be padded, its column reads 0 */
+template <class Topology>
+static float time_padded(SolverAlgorithm algo, const cmaze::PaddedBoard &board,
+			 cmaze::SearchScratch &scratch, int num_runs)
+{
+	return time_headless<Topology>(algo, board, scratch, num_runs);
+}
+
+template <>
+float time_padded<cmaze::Torus>(SolverAlgorithm, const cmaze::PaddedBoard &,
+				cmaze::SearchScratch &, int)
+{
+	return 0;
+}
+
+template <class Topology>
+static int benchmark(int rows, int cols, int num_runs, uint max_cost)
+{
+	static const SolverAlgorithm algos[] = { SOLVER_BFS, SOLVER_DIJKSTRA };
+	static const char *algo_names[] = { "bfs", "dijkstra" };
+	cmaze::SearchScratch scratch;
+	cmaze::MazeHandle maze;
+	float generic;
+	float headless;
+
+	maze.set_topology(Topology::topology);
+	maze.set_max_cost(max_cost);
+	if (maze.create(1, rows, cols)) {
+		g_fprintf(stderr, "create_maze failed\n");
+		return -1;
+	}
+	maze_set_anim_speed(maze.get(), 100);
+
+	cmaze::DenseBoard dense(maze);
+	cmaze::PaddedBoard padded(maze);
+
+	for (int a = 0; a < 2; a++) {
+		maze.set_solver_algorithm(algos[a]);
+
+		generic = 0;
+		headless = 0;
+		for (int i = 0; i < num_runs; i++) {
+			maze_solve(maze.get());
+			generic += maze.solve_time();
+
+			maze.solve_headless();
+			headless += maze.solve_time();
+		}
+
+		/* Warm the scratch up, the runs below allocate nothing */
+		cmaze::solve(Topology::topology, algos[a], dense, scratch);
+		if (scratch.path_length() != maze.path_length()) {
+			g_fprintf(stderr, "%s %s: path of %d cells, C found %d\n",
+				  topology_names[Topology::topology],
+				  algo_names[a], scratch.path_length(),
+				  maze.path_length());
+			return -1;
+		}
+
+		g_printf("%-8s %-9s %8d %12.06f %12.06f %12.06f %12.06f %12.06f\n",
+			 topology_names[Topology::topology], algo_names[a],
+			 maze.path_length(), generic / num_runs,
+			 headless / num_runs,
+			 time_headless<Topology>(algos[a], dense, scratch,
+						 num_runs),
+			 time_padded<Topology>(algos[a], padded, scratch,
+					       num_runs),
+			 time_instrumented<Topology>(algos[a], dense, scratch,
+						     num_runs));
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int rows = argc > 1 ? atoi(argv[1]) : 301;
+	int cols = argc > 2 ? atoi(argv[2]) : rows;
+	int num_runs = argc > 3 ? atoi(argv[3]) : 10;
+	uint max_cost = argc > 4 ? atoi(argv[4]) : 9;
+
+	if (num_runs < 1)
+		num_runs = 1;
+
+	g_printf("%-8s %-9s %8s %12s %12s %12s %12s %12s\n", "Topology",
+		 "Solver", "Length", "Generic (s)", "Headless (s)", "Dense (s)",
+		 "Padded (s)", "Counted (s)");
+
+	if (benchmark<cmaze::Square>(rows, cols, num_runs, max_cost) ||
+	    benchmark<cmaze::Octile>(rows, cols, num_runs, max_cost) ||
+	    benchmark<cmaze::Torus>(rows, cols, num_runs, max_cost) ||
+	    benchmark<cmaze::Hex>(rows, cols, num_runs, max_cost))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: MIT */
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cmaze.hpp"
+
+static_assert(!std::is_copy_constructible<cmaze::MazeHandle>::value,
+	      "MazeHandle must not be copyable");
+static_assert(!std::is_copy_assignable<cmaze::MazeHandle>::value,
+	      "MazeHandle must not be copyable");
+static_assert(std::is_nothrow_move_constructible<cmaze::MazeHandle>::value,
+	      "MazeHandle must be movable");
+static_assert(std::is_nothrow_move_assignable<cmaze::MazeHandle>::value,
+	      "MazeHandle must be movable");
+static_assert(!std::is_copy_constructible<cmaze::SearchScratch>::value,
+	      "SearchScratch must not be copyable");
+static_assert(!std::is_copy_assignable<cmaze::SearchScratch>::value,
+	      "SearchScratch must not be copyable");
+static_assert(std::is_nothrow_move_constructible<cmaze::SearchScratch>::value,
+	      "SearchScratch must be movable");
+
+/* The kernels for Topology on Board must find what the C solvers find */
+template <class Topology, class Board>
+static int check_engine(void)
+{
+	typedef cmaze::Search<Topology, Board> Headless;
+	typedef cmaze::Search<Topology, Board, cmaze::CountStats> Counted;
+	cmaze::SearchScratch scratch;
+	cmaze::SearchScratch moved;
+	cmaze::NoStats none;
+	cmaze::CountStats stats;
+	cmaze::NoAnimation anim;
+	int visited = 0;
+	auto cancel = cmaze::animate([&visited](int) {
+		return ++visited < 10;
+	});
+
+	for (guint32 seed = 1; seed <= 4; seed++) {
+		cmaze::MazeHandle maze;
+
+		maze.set_seed(seed);
+		maze.set_topology(Topology::topology);
+		maze.set_max_cost(seed & 1 ? 9 : 1);
+		if (maze.create(seed & 2 ? 2 : 1, 31, 37))
+			return -1;
+
+		Board board(maze);
+
+		maze.set_solver_algorithm(SOLVER_BFS);
+		if (maze.solve_headless() || Headless::bfs(board, scratch, none, anim) ||
+		    scratch.path_length() != maze.path_length())
+			return -1;
+
+		std::vector<struct MazePos> path = scratch.path(board);
+		if (maze.cell_type(path.front().level, path.front().row,
+				   path.front().col) != CELL_TYPE_START ||
+		    maze.cell_type(path.back().level, path.back().row,
+				   path.back().col) != CELL_TYPE_END)
+			return -1;
+
+		maze.set_solver_algorithm(SOLVER_DIJKSTRA);
+		stats = cmaze::CountStats();
+		if (maze.solve_headless() ||
+		    Counted::dijkstra(board, scratch, stats, anim) ||
+		    scratch.path_cost() != maze.path_cost() || !stats.expanded)
+			return -1;
+
+		if (cmaze::solve(Topology::topology, SOLVER_DIJKSTRA, board, scratch) ||
+		    scratch.path_cost() != maze.path_cost())
+			return -1;
+
+		moved = std::move(scratch);
+		if (moved.path_cost() != maze.path_cost())
+			return -1;
+		scratch = std::move(moved);
+
+		visited = 0;
+		if (cmaze::Search<Topology, Board, cmaze::NoStats,
+				  decltype(cancel)>::bfs(board, scratch, none, cancel) != -1 ||
+		    visited != 10)
+			return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	cmaze::MazeHandle maze;
+	cmaze::MazeHandle moved;
+	cmaze::MazeHandle copy;
+	int len;
+
+	maze.set_seed(1);
+	maze.set_solver_algorithm(SOLVER_BFS);
+	if (maze.create(1, 41, 41) || maze.solve_headless())
+		return 1;
+	len = maze.path_length();
+
+	moved = std::move(maze);
+	if (maze || !moved || moved.path_length() != len)
+		return 1;
+
+	copy = moved.dup();
+	if (!copy || copy.get() == moved.get())
+		return 1;
+
+	copy.set_solver_algorithm(SOLVER_DIJKSTRA);
+	if (copy.solve_headless() || copy.path_length() != len)
+		return 1;
+
+	if (check_engine<cmaze::Square, cmaze::DenseBoard>() ||
+	    check_engine<cmaze::Octile, cmaze::DenseBoard>() ||
+	    check_engine<cmaze::Torus, cmaze::DenseBoard>() ||
+	    check_engine<cmaze::Hex, cmaze::DenseBoard>() ||
+	    check_engine<cmaze::Square, cmaze::PaddedBoard>() ||
+	    check_engine<cmaze::Octile, cmaze::PaddedBoard>() ||
+	    check_engine<cmaze::Hex, cmaze::PaddedBoard>())
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: MIT */
+/* Built with cmaze.c itself, to reach the static board initialization */
+#include "cmaze.c"
+
+static int check_board(struct Maze *maze)
+{
+	struct Cell *cell;
+	int level;
+	int row;
+	int col;
+	int wall;
+
+	for (level = 0; level < maze->num_levels; level++) {
+		for (row = 0; row < maze->num_rows; row++) {
+			for (col = 0; col < maze->num_cols; col++) {
+				cell = maze_get_cell(maze, level, row, col);
+				wall = !((row & 1) && (col & 1));
+
+				if (cell->level != level || cell->row != row ||
+				    cell->col != col || cell->stairs ||
+				    cell->parent ||
+				    (cell->type == CELL_TYPE_WALL) != wall ||
+				    (maze->costs &&
+				     maze->costs[cell - maze->board] != 1)) {
+					g_fprintf(stderr, "bad cell %d,%d,%d\n",
+						  level, row, col);
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Scribble over the board, then initialize it again */
+static int reinit_board(struct Maze *maze, gboolean parallel)
+{
+	int num_stripes = maze_get_num_stripes(maze);
+
+	if (maze_init_in_parallel(maze, num_stripes) != parallel) {
+		g_fprintf(stderr, "%dx%dx%d board, %d stripes: %s init\n",
+			  maze->num_levels, maze->num_rows, maze->num_cols,
+			  num_stripes, parallel ? "serial" : "parallel");
+		return -1;
+	}
+
+	memset(maze->board, 0xa5, maze_num_cells(maze) * sizeof(struct Cell));
+	if (maze->costs)
+		memset(maze->costs, 0xa5, maze_num_cells(maze));
+
+	maze_init_board(maze);
+
+	return check_board(maze);
+}
+
+int main(void)
+{
+	struct Maze *maze;
+	int err = 0;
+
+	maze = maze_alloc();
+	maze_set_num_threads(maze, 4);
+	maze_set_max_cost(maze, MAZE_DEFAULT_MAX_COST);
+
+	/* The largest single level boards take the threaded path */
+	if (maze_create(maze, 1, MAZE_MAX_ROWS, MAZE_MAX_COLS, FALSE) ||
+	    reinit_board(maze, TRUE))
+		err = -1;
+
+	if (maze_create(maze, 3, 301, 301, FALSE) || reinit_board(maze, TRUE))
+		err = -1;
+
+	/* Small boards and single threads don't */
+	if (maze_create(maze, 1, 121, 121, FALSE) || reinit_board(maze, FALSE))
+		err = -1;
+
+	maze_set_num_threads(maze, 1);
+	if (maze_create(maze, 1, MAZE_MAX_ROWS, MAZE_MAX_COLS, FALSE) ||
+	    reinit_board(maze, FALSE))
+		err = -1;
+
+	maze_free(maze);
+
+	return err ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: MIT */
+#include "cmaze.h"
+
+#define MAX_DIFFS 16
+
+/* m must match a fresh copy of itself, and differ from old by num cells */
+static int check_diff(struct Maze *m, struct Maze *old, int num,
+		      const char *what)
+{
+	struct MazePos diffs[MAX_DIFFS];
+	struct Maze *fresh;
+	int num_fresh;
+	int num_old;
+
+	fresh = maze_dup(m);
+	num_fresh = maze_diff(m, fresh, diffs, MAX_DIFFS);
+	num_old = maze_diff(m, old, diffs, MAX_DIFFS);
+	maze_free(fresh);
+
+	if (num_fresh || num_old != num) {
+		g_fprintf(stderr, "%s: %d cells differ from a fresh copy, "
+			  "%d from the old one instead of %d\n", what,
+			  num_fresh, num_old, num);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* First open cell of the left column, besides the start */
+static int free_left_row(struct Maze *m)
+{
+	int row;
+
+	for (row = 1; row < maze_get_num_rows(m) - 1; row += 2)
+		if (maze_get_cell_type(m, 0, row, 1) != CELL_TYPE_WALL &&
+		    maze_get_cell_type(m, 0, row, 0) == CELL_TYPE_WALL)
+			return row;
+
+	return -1;
+}
+
+int main(void)
+{
+	struct Maze *m;
+	struct Maze *old;
+	int err = 0;
+	int row;
+
+	m = maze_alloc();
+	maze_set_seed(m, 2);
+	if (maze_create(m, 1, 41, 41, FALSE))
+		return 1;
+
+	/* Fill the wall plane cache */
+	old = maze_dup(m);
+	if (!maze_equal(m, old))
+		err = -1;
+
+	/* The old start closes and the new one opens */
+	row = free_left_row(m);
+	if (row < 0 || maze_set_start_cell(m, 0, row, 0) ||
+	    check_diff(m, old, 2, "start moved"))
+		err = -1;
+
+	if (maze_undo(m) || check_diff(m, old, 0, "start move undone"))
+		err = -1;
+
+	row = free_left_row(m);
+	if (row < 0 || maze_add_exit(m, 0, row, 0) ||
+	    check_diff(m, old, 1, "exit added"))
+		err = -1;
+
+	if (maze_remove_exit(m, 0, row, 0) ||
+	    check_diff(m, old, 0, "exit removed"))
+		err = -1;
+
+	maze_free(old);
+	maze_free(m);
+
+	return err ? 1 : 0;
+}